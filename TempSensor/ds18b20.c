@@ -14,8 +14,7 @@
 */
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "driver/gpio.h"
-#include "esp32/rom/ets_sys.h"
+#include <string.h>
 #include "ds18b20.h"
 
 // OneWire commands
@@ -47,90 +46,34 @@
 #define TEMP_11_BIT 0x5F // 11 bit
 #define TEMP_12_BIT 0x7F // 12 bit
 
-uint8_t DS_GPIO;
-uint8_t init=0;
-uint8_t bitResolution=12;
-uint8_t devices=0;
-
-DeviceAddress ROM_NO;
-uint8_t LastDiscrepancy;
-uint8_t LastFamilyDiscrepancy;
-bool LastDeviceFlag;
-
 /// Sends one bit to bus
-void ds18b20_write(char bit){
-	if (bit & 1) {
-		gpio_set_direction(DS_GPIO, GPIO_MODE_OUTPUT);
-		noInterrupts();
-		gpio_set_level(DS_GPIO,0);
-		ets_delay_us(6);
-		gpio_set_direction(DS_GPIO, GPIO_MODE_INPUT);	// release bus
-		ets_delay_us(64);
-		interrupts();
-	} else {
-		gpio_set_direction(DS_GPIO, GPIO_MODE_OUTPUT);
-		noInterrupts();
-		gpio_set_level(DS_GPIO,0);
-		ets_delay_us(60);
-		gpio_set_direction(DS_GPIO, GPIO_MODE_INPUT);	// release bus
-		ets_delay_us(10);
-		interrupts();
-	}
+void ds18b20_write(ds18b20_bus_t *bus, char bit){
+	onewire_write_bit(&bus->wire, bit & 1);
+	bus->busStats.busTimeUs += ONEWIRE_SLOT_US;
 }
 
 // Reads one bit from bus
-unsigned char ds18b20_read(void){
-	unsigned char value = 0;
-	gpio_set_direction(DS_GPIO, GPIO_MODE_OUTPUT);
-	noInterrupts();
-	gpio_set_level(DS_GPIO, 0);
-	ets_delay_us(6);
-	gpio_set_direction(DS_GPIO, GPIO_MODE_INPUT);
-	ets_delay_us(9);
-	value = gpio_get_level(DS_GPIO);
-	ets_delay_us(55);
-	interrupts();
-	return (value);
+unsigned char ds18b20_read(ds18b20_bus_t *bus){
+	bus->busStats.busTimeUs += ONEWIRE_SLOT_US;
+	return onewire_read_bit(&bus->wire);
 }
 // Sends one byte to bus
-void ds18b20_write_byte(char data){
-  unsigned char i;
-  unsigned char x;
-  for(i=0;i<8;i++){
-    x = data>>i;
-    x &= 0x01;
-    ds18b20_write(x);
-  }
-  ets_delay_us(100);
+void ds18b20_write_byte(ds18b20_bus_t *bus, char data){
+	onewire_write_byte(&bus->wire, data);
+	bus->busStats.busTimeUs += ONEWIRE_BYTE_US;
 }
 // Reads one byte from bus
-unsigned char ds18b20_read_byte(void){
-  unsigned char i;
-  unsigned char data = 0;
-  for (i=0;i<8;i++)
-  {
-    if(ds18b20_read()) data|=0x01<<i;
-    ets_delay_us(15);
-  }
-  return(data);
+unsigned char ds18b20_read_byte(ds18b20_bus_t *bus){
+	bus->busStats.busTimeUs += ONEWIRE_BYTE_US;
+	return onewire_read_byte(&bus->wire);
 }
 // Sends reset pulse
-unsigned char ds18b20_reset(void){
-	unsigned char presence;
-	gpio_set_direction(DS_GPIO, GPIO_MODE_OUTPUT);
-	noInterrupts();
-	gpio_set_level(DS_GPIO, 0);
-	ets_delay_us(480);
-	gpio_set_level(DS_GPIO, 1);
-	gpio_set_direction(DS_GPIO, GPIO_MODE_INPUT);
-	ets_delay_us(70);
-	presence = (gpio_get_level(DS_GPIO) == 0);
-	ets_delay_us(410);
-	interrupts();
-	return presence;
-}
-
-bool ds18b20_setResolution(const DeviceAddress tempSensorAddresses[], int numAddresses, uint8_t newResolution) {
+unsigned char ds18b20_reset(ds18b20_bus_t *bus){
+	bus->busStats.busTimeUs += ONEWIRE_RESET_US;
+	return onewire_reset(&bus->wire);
+}
+
+bool ds18b20_setResolution(ds18b20_bus_t *bus, const DeviceAddress tempSensorAddresses[], int numAddresses, uint8_t newResolution) {
 	bool success = false;
 	// handle the sensors with configuration register
 	newResolution = constrain(newResolution, 9, 12);
@@ -139,7 +82,7 @@ bool ds18b20_setResolution(const DeviceAddress tempSensorAddresses[], int numAdd
 	// loop through each address
 	for (int i = 0; i < numAddresses; i++){
 		// we can only update the sensor if it is connected
-		if (ds18b20_isConnected((DeviceAddress*) tempSensorAddresses[i], scratchPad)) {
+		if (ds18b20_isConnected(bus, (DeviceAddress*) tempSensorAddresses[i], scratchPad)) {
 			switch (newResolution) {
 			case 12:
 				newValue = TEMP_12_BIT;
@@ -158,8 +101,10 @@ bool ds18b20_setResolution(const DeviceAddress tempSensorAddresses[], int numAdd
 			// if it needs to be updated we write the new value
 			if (scratchPad[CONFIGURATION] != newValue) {
 				scratchPad[CONFIGURATION] = newValue;
-				ds18b20_writeScratchPad((DeviceAddress*) tempSensorAddresses[i], scratchPad);
+				ds18b20_writeScratchPad(bus, (DeviceAddress*) tempSensorAddresses[i], scratchPad);
 			}
+			// conversions now take at least as long as this device needs
+			if (newResolution > bus->bitResolution) bus->bitResolution = newResolution;
 			// done
 			success = true;
 		}
@@ -167,22 +112,45 @@ bool ds18b20_setResolution(const DeviceAddress tempSensorAddresses[], int numAdd
 	return success;
 }
 
-void ds18b20_writeScratchPad(const DeviceAddress *deviceAddress, const uint8_t *scratchPad) {
-	ds18b20_reset();
-	ds18b20_select(deviceAddress);
-	ds18b20_write_byte(WRITESCRATCH);
-	ds18b20_write_byte(scratchPad[HIGH_ALARM_TEMP]); // high alarm temp
-	ds18b20_write_byte(scratchPad[LOW_ALARM_TEMP]); // low alarm temp
-	ds18b20_write_byte(scratchPad[CONFIGURATION]);
-	ds18b20_reset();
+// Writes the TH/TL alarm registers. A device flags an alarm after a conversion
+// when the integer part of the temperature is <= lowAlarm or >= highAlarm.
+// Only the scratchpad is written, the EEPROM copy is left untouched to avoid wear.
+bool ds18b20_setAlarms(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, int8_t lowAlarm, int8_t highAlarm) {
+	ScratchPad scratchPad;
+	// configuration register is written with the alarms, keep its current value
+	if (!ds18b20_isConnected(bus, deviceAddress, scratchPad)) return false;
+	if ((scratchPad[LOW_ALARM_TEMP] != (uint8_t)lowAlarm) || (scratchPad[HIGH_ALARM_TEMP] != (uint8_t)highAlarm)) {
+		scratchPad[LOW_ALARM_TEMP] = lowAlarm;
+		scratchPad[HIGH_ALARM_TEMP] = highAlarm;
+		ds18b20_writeScratchPad(bus, deviceAddress, scratchPad);
+	}
+	return true;
+}
+
+void ds18b20_writeScratchPad(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, const uint8_t *scratchPad) {
+	ds18b20_reset(bus);
+	ds18b20_select(bus, deviceAddress);
+	ds18b20_write_byte(bus, WRITESCRATCH);
+	ds18b20_write_byte(bus, scratchPad[HIGH_ALARM_TEMP]); // high alarm temp
+	ds18b20_write_byte(bus, scratchPad[LOW_ALARM_TEMP]); // low alarm temp
+	ds18b20_write_byte(bus, scratchPad[CONFIGURATION]);
+	// No trailing reset, the next transaction starts with one
+	bus->busStats.savedUs += ONEWIRE_RESET_US;
+}
+
+bool ds18b20_readScratchPad(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, uint8_t* scratchPad) {
+	return ds18b20_readScratchPadBytes(bus, deviceAddress, scratchPad, 9);
 }
 
-bool ds18b20_readScratchPad(const DeviceAddress *deviceAddress, uint8_t* scratchPad) {
+// Reads the first len bytes of the scratchpad. A read of less than 9 bytes is
+// left unfinished, the device abandons it on the reset that starts the next
+// transaction so no trailing reset is sent in either case.
+bool ds18b20_readScratchPadBytes(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, uint8_t* scratchPad, uint8_t len) {
 	// send the reset command and fail fast
-	int b = ds18b20_reset();
+	int b = ds18b20_reset(bus);
 	if (b == 0) return false;
-	ds18b20_select(deviceAddress);
-	ds18b20_write_byte(READSCRATCH);
+	ds18b20_select(bus, deviceAddress);
+	ds18b20_write_byte(bus, READSCRATCH);
 	// Read all registers in a simple loop
 	// byte 0: temperature LSB
 	// byte 1: temperature MSB
@@ -193,35 +161,143 @@ bool ds18b20_readScratchPad(const DeviceAddress *deviceAddress, uint8_t* scratch
 	// byte 6: DS18B20 & DS1822: store for crc
 	// byte 7: DS18B20 & DS1822: store for crc
 	// byte 8: SCRATCHPAD_CRC
+	len = constrain(len, 1, 9);
+	for (uint8_t i = 0; i < len; i++) {
+		scratchPad[i] = ds18b20_read_byte(bus);
+	}
+	bus->busStats.savedUs += ONEWIRE_RESET_US + ((9 - len) * ONEWIRE_BYTE_US);
+	return true;
+}
+
+// Classifies a full scratchpad read. A device that did not drive the bus reads
+// back as all ones, which never has a valid CRC.
+static ds18b20_status_t scratchPadStatus(const uint8_t *scratchPad) {
+	if (ds18b20_isAllZeros(scratchPad)) return DS18B20_ALL_ZEROS;
+	if (ds18b20_crc8(scratchPad, 8) == scratchPad[SCRATCHPAD_CRC]) return DS18B20_OK;
 	for (uint8_t i = 0; i < 9; i++) {
-		scratchPad[i] = ds18b20_read_byte();
+		if (scratchPad[i] != 0xFF) return DS18B20_CRC_ERROR;
 	}
-	b = ds18b20_reset();
-	return (b == 1);
+	return DS18B20_NO_DEVICE;
 }
 
-void ds18b20_select(const DeviceAddress *address){
+// Reads the temperature of one device in as few bus slots as possible.
+// Without CRC validation only the two temperature bytes are read. They read
+// 0xFFFF both when the device did not respond and for a genuine -0.0625C at
+// 12 bits, so that value is confirmed with a full read and CRC check. With
+// CRC validation all 9 bytes are read and checked. Only CRC errors are
+// retried, a device that did not respond will not respond to a retry in the
+// same sweep either. When the full scratchpad was read, resolution (if not
+// NULL) is set from the configuration register.
+ds18b20_status_t ds18b20_readTemperature(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, int16_t *rawTemp, bool validateCrc, uint8_t maxAttempts, uint8_t *resolution) {
+	ScratchPad scratchPad;
+	ds18b20_status_t status = DS18B20_NO_PRESENCE;
+	uint8_t len = 0;
+	uint8_t attempt;
+
+	for (attempt = 0; attempt < maxAttempts; attempt++) {
+		len = validateCrc ? 9 : 2;
+		if (!ds18b20_readScratchPadBytes(bus, deviceAddress, scratchPad, len)) {
+			status = DS18B20_NO_PRESENCE;
+		} else if (validateCrc) {
+			status = scratchPadStatus(scratchPad);
+		} else if ((scratchPad[TEMP_LSB] == 0xFF) && (scratchPad[TEMP_MSB] == 0xFF)) {
+			len = 9;
+			if (!ds18b20_readScratchPadBytes(bus, deviceAddress, scratchPad, len)) {
+				status = DS18B20_NO_PRESENCE;
+			} else {
+				status = scratchPadStatus(scratchPad);
+			}
+		} else {
+			status = DS18B20_OK;
+		}
+
+		if (status != DS18B20_CRC_ERROR) break;
+	}
+
+	if ((status != DS18B20_OK) && (status != DS18B20_CRC_ERROR) && (attempt + 1 < maxAttempts)) {
+		// Retries that would have been made by reading until the attempts ran out
+		bus->busStats.savedUs += (maxAttempts - attempt - 1) * (ONEWIRE_RESET_US + (19 * ONEWIRE_BYTE_US));
+	}
+
+	if (status == DS18B20_OK) {
+		*rawTemp = calculateTemperature(deviceAddress, scratchPad);
+		if ((len == 9) && (resolution != NULL)) *resolution = ds18b20_scratchPadResolution(scratchPad);
+	}
+	return status;
+}
+
+// Addresses one device. When the last search found a single device on the
+// bus and the caller has a single device registered there, it is addressed
+// with SKIP ROM instead of sending its 64 bit ROM code. Any other device on
+// the bus would answer a SKIP ROM read, so both counts must agree.
+void ds18b20_select(ds18b20_bus_t *bus, const DeviceAddress *address){
     uint8_t i;
-    ds18b20_write_byte(SELECTDEVICE);           // Choose ROM
-    for (i = 0; i < 8; i++) ds18b20_write_byte(((uint8_t *)address)[i]);
+    if ((bus->busDevices == 1) && (bus->knownDevices == 1)) {
+        ds18b20_write_byte(bus, SKIPROM);
+        bus->busStats.savedUs += 8 * ONEWIRE_BYTE_US;
+        return;
+    }
+    ds18b20_write_byte(bus, SELECTDEVICE);           // Choose ROM
+    for (i = 0; i < 8; i++) ds18b20_write_byte(bus, ((uint8_t *)address)[i]);
+}
+
+// Starts a conversion on every device on the bus and returns immediately
+void ds18b20_startConversion(ds18b20_bus_t *bus){
+	ds18b20_reset(bus);
+	ds18b20_write_byte(bus, SKIPROM);
+	ds18b20_write_byte(bus, GETTEMP);
+}
+
+// Starts a conversion and waits for it to finish. Devices hold read slots low
+// until their conversion is complete so the bus is polled instead of sleeping
+// for the worst case conversion time.
+void ds18b20_requestTemperatures(ds18b20_bus_t *bus){
+	ds18b20_startConversion(bus);
+
+	TickType_t start = xTaskGetTickCount();
+	while (!isConversionComplete(bus) && ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(millisToWaitForConversion(bus)))) vTaskDelay(1);
+}
+
+uint8_t ds18b20_getBusDeviceCount(ds18b20_bus_t *bus) {
+	return bus->busDevices;
 }
 
-void ds18b20_requestTemperatures(){
-	ds18b20_reset();
-	ds18b20_write_byte(SKIPROM);
-	ds18b20_write_byte(GETTEMP);
+// Sets how many devices the caller expects on the bus
+void ds18b20_setKnownDeviceCount(ds18b20_bus_t *bus, uint8_t count) {
+	bus->knownDevices = count;
+}
+
+// Discards the device count of the last search, after a device stopped
+// responding. Devices are addressed by ROM until the next complete search.
+void ds18b20_forgetBusDeviceCount(ds18b20_bus_t *bus) {
+	bus->busDevices = 0;
+}
 
-	vTaskDelay(millisToWaitForConversion()/portTICK_PERIOD_MS);
+void ds18b20_getBusStats(ds18b20_bus_t *bus, ds18b20_busStats_t *stats) {
+	*stats = bus->busStats;
+}
 
-    //while (!isConversionComplete() && ((esp_timer_get_time() / 1000ULL) - start < millisToWaitForConversion())) vPortYield();
+void ds18b20_resetBusStats(ds18b20_bus_t *bus) {
+	bus->busStats.busTimeUs = 0;
+	bus->busStats.savedUs = 0;
 }
 
-bool isConversionComplete() {
-	uint8_t b = ds18b20_read();
+bool isConversionComplete(ds18b20_bus_t *bus) {
+	uint8_t b = ds18b20_read(bus);
 	return (b == 1);
 }
 
-uint16_t millisToWaitForConversion() {
+// Sets the resolution of the slowest device on the bus, which times conversions
+void ds18b20_setBusResolution(ds18b20_bus_t *bus, uint8_t bitResolution) {
+	bus->bitResolution = constrain(bitResolution, 9, 12);
+}
+
+uint16_t millisToWaitForConversion(ds18b20_bus_t *bus) {
+	return ds18b20_millisForResolution(bus->bitResolution);
+}
+
+// Worst case conversion time of a device at a resolution
+uint16_t ds18b20_millisForResolution(uint8_t bitResolution) {
 	switch (bitResolution) {
 	case 9:
 		return 100;		// was 94
@@ -234,8 +310,8 @@ uint16_t millisToWaitForConversion() {
 	}
 }
 
-bool ds18b20_isConnected(const DeviceAddress *deviceAddress, uint8_t *scratchPad) {
-	bool b = ds18b20_readScratchPad(deviceAddress, scratchPad);
+bool ds18b20_isConnected(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, uint8_t *scratchPad) {
+	bool b = ds18b20_readScratchPad(bus, deviceAddress, scratchPad);
 	return b && !ds18b20_isAllZeros(scratchPad) && (ds18b20_crc8(scratchPad, 8) == scratchPad[SCRATCHPAD_CRC]);
 }
 
@@ -258,9 +334,21 @@ bool ds18b20_isAllZeros(const uint8_t * const scratchPad) {
 	return true;
 }
 
-float ds18b20_getTempF(const DeviceAddress *deviceAddress) {
+// Returns the resolution in bits (9-12) held in a scratchpad's configuration register
+uint8_t ds18b20_scratchPadResolution(const uint8_t *scratchPad) {
+	return ((scratchPad[CONFIGURATION] >> 5) & 0x03) + 9;
+}
+
+// Clears the bits of a fixed-point temperature that are undefined below 12 bit resolution
+int16_t ds18b20_maskResolution(int16_t rawTemp, uint8_t bitResolution) {
+	bitResolution = constrain(bitResolution, 9, 12);
+	// 12 bit LSB is bit 3 of the 2^-7 fixed point value
+	return rawTemp & ~((1 << (3 + 12 - bitResolution)) - 1);
+}
+
+float ds18b20_getTempF(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress) {
 	ScratchPad scratchPad;
-	if (ds18b20_isConnected(deviceAddress, scratchPad)){
+	if (ds18b20_isConnected(bus, deviceAddress, scratchPad)){
 		int16_t rawTemp = calculateTemperature(deviceAddress, scratchPad);
 		if (rawTemp <= DEVICE_DISCONNECTED_RAW)
 			return DEVICE_DISCONNECTED;
@@ -271,9 +359,9 @@ float ds18b20_getTempF(const DeviceAddress *deviceAddress) {
 	return DEVICE_DISCONNECTED;
 }
 
-float ds18b20_getTempC(const DeviceAddress *deviceAddress) {
+float ds18b20_getTempC(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress) {
 	ScratchPad scratchPad;
-	if (ds18b20_isConnected(deviceAddress, scratchPad)){
+	if (ds18b20_isConnected(bus, deviceAddress, scratchPad)){
 		int16_t rawTemp = calculateTemperature(deviceAddress, scratchPad);
 		if (rawTemp <= DEVICE_DISCONNECTED_RAW)
 			return DEVICE_DISCONNECTED;
@@ -291,22 +379,22 @@ int16_t calculateTemperature(const DeviceAddress *deviceAddress, uint8_t* scratc
 }
 
 // Returns temperature from sensor
-float ds18b20_get_temp(void) {
-  if(init==1){
+float ds18b20_get_temp(ds18b20_bus_t *bus) {
+  if(bus->init==1){
     unsigned char check;
     char temp1=0, temp2=0;
-      check=ds18b20_RST_PULSE();
+      check=ds18b20_RST_PULSE(bus);
       if(check==1)
       {
-        ds18b20_send_byte(0xCC);
-        ds18b20_send_byte(0x44);
+        ds18b20_send_byte(bus, 0xCC);
+        ds18b20_send_byte(bus, 0x44);
         vTaskDelay(750 / portTICK_RATE_MS);
-        check=ds18b20_RST_PULSE();
-        ds18b20_send_byte(0xCC);
-        ds18b20_send_byte(0xBE);
-        temp1=ds18b20_read_byte();
-        temp2=ds18b20_read_byte();
-        check=ds18b20_RST_PULSE();
+        check=ds18b20_RST_PULSE(bus);
+        ds18b20_send_byte(bus, 0xCC);
+        ds18b20_send_byte(bus, 0xBE);
+        temp1=ds18b20_read_byte(bus);
+        temp2=ds18b20_read_byte(bus);
+        check=ds18b20_RST_PULSE(bus);
         float temp=0;
         temp=(float)(temp1+(temp2*256))/16;
         return temp;
@@ -317,24 +405,25 @@ float ds18b20_get_temp(void) {
   else{return 0;}
 }
 
-void ds18b20_init(int GPIO) {
-	DS_GPIO = GPIO;
-	gpio_pad_select_gpio(DS_GPIO);
-	init = 1;
+// Initializes a bus. Each bus needs its own GPIO, and with the UART backend its own UART.
+void ds18b20_init(ds18b20_bus_t *bus, int GPIO, int uart) {
+	memset(bus, 0, sizeof(ds18b20_bus_t));
+	bus->bitResolution = 12;
+	bus->init = onewire_init(&bus->wire, GPIO, uart);
 }
 
 //
 // You need to use this function to start a search again from the beginning.
 // You do not need to do it for the first search, though you could.
 //
-void reset_search() {
-	devices=0;
+void reset_search(ds18b20_bus_t *bus) {
+	bus->devices=0;
 	// reset the search state
-	LastDiscrepancy = 0;
-	LastDeviceFlag = false;
-	LastFamilyDiscrepancy = 0;
+	bus->LastDiscrepancy = 0;
+	bus->LastDeviceFlag = false;
+	bus->LastFamilyDiscrepancy = 0;
 	for (int i = 7; i >= 0; i--) {
-		ROM_NO[i] = 0;
+		bus->ROM_NO[i] = 0;
 	}
 }
 // --- Replaced by the one from the Dallas Semiconductor web site ---
@@ -344,7 +433,15 @@ void reset_search() {
 // Return TRUE  : device found, ROM number in ROM_NO buffer
 //        FALSE : device not found, end of search
 
-bool search(uint8_t *newAddr, bool search_mode) {
+//
+// Conditional search, only finds devices whose last conversion was outside
+// their TH/TL alarm registers. Call reset_search() first as with search().
+//
+bool alarm_search(ds18b20_bus_t *bus, uint8_t *newAddr) {
+	return search(bus, newAddr, false);
+}
+
+bool search(ds18b20_bus_t *bus, uint8_t *newAddr, bool search_mode) {
 	uint8_t id_bit_number;
 	uint8_t last_zero, rom_byte_number;
 	bool search_result;
@@ -360,28 +457,28 @@ bool search(uint8_t *newAddr, bool search_mode) {
 	search_result = false;
 
 	// if the last call was not the last one
-	if (!LastDeviceFlag) {
+	if (!bus->LastDeviceFlag) {
 		// 1-Wire reset
-		if (!ds18b20_reset()) {
+		if (!ds18b20_reset(bus)) {
 			// reset the search
-			LastDiscrepancy = 0;
-			LastDeviceFlag = false;
-			LastFamilyDiscrepancy = 0;
+			bus->LastDiscrepancy = 0;
+			bus->LastDeviceFlag = false;
+			bus->LastFamilyDiscrepancy = 0;
 			return false;
 		}
 
 		// issue the search command
 		if (search_mode == true) {
-			ds18b20_write_byte(0xF0);   // NORMAL SEARCH
+			ds18b20_write_byte(bus, 0xF0);   // NORMAL SEARCH
 		} else {
-			ds18b20_write_byte(0xEC);   // CONDITIONAL SEARCH
+			ds18b20_write_byte(bus, ALARMSEARCH);   // CONDITIONAL SEARCH
 		}
 
 		// loop to do the search
 		do {
 			// read a bit and its complement
-			id_bit = ds18b20_read();
-			cmp_id_bit = ds18b20_read();
+			id_bit = ds18b20_read(bus);
+			cmp_id_bit = ds18b20_read(bus);
 
 			// check for no devices on 1-wire
 			if ((id_bit == 1) && (cmp_id_bit == 1)) {
@@ -393,12 +490,12 @@ bool search(uint8_t *newAddr, bool search_mode) {
 				} else {
 					// if this discrepancy if before the Last Discrepancy
 					// on a previous next then pick the same as last time
-					if (id_bit_number < LastDiscrepancy) {
-						search_direction = ((ROM_NO[rom_byte_number]
+					if (id_bit_number < bus->LastDiscrepancy) {
+						search_direction = ((bus->ROM_NO[rom_byte_number]
 								& rom_byte_mask) > 0);
 					} else {
 						// if equal to last pick 1, if not then pick 0
-						search_direction = (id_bit_number == LastDiscrepancy);
+						search_direction = (id_bit_number == bus->LastDiscrepancy);
 					}
 					// if 0 was picked then record its position in LastZero
 					if (search_direction == 0) {
@@ -406,19 +503,19 @@ bool search(uint8_t *newAddr, bool search_mode) {
 
 						// check for Last discrepancy in family
 						if (last_zero < 9)
-							LastFamilyDiscrepancy = last_zero;
+							bus->LastFamilyDiscrepancy = last_zero;
 					}
 				}
 
 				// set or clear the bit in the ROM byte rom_byte_number
 				// with mask rom_byte_mask
 				if (search_direction == 1)
-					ROM_NO[rom_byte_number] |= rom_byte_mask;
+					bus->ROM_NO[rom_byte_number] |= rom_byte_mask;
 				else
-					ROM_NO[rom_byte_number] &= ~rom_byte_mask;
+					bus->ROM_NO[rom_byte_number] &= ~rom_byte_mask;
 
 				// serial number search direction write bit
-				ds18b20_write(search_direction);
+				ds18b20_write(bus, search_direction);
 
 				// increment the byte counter id_bit_number
 				// and shift the mask rom_byte_mask
@@ -436,28 +533,32 @@ bool search(uint8_t *newAddr, bool search_mode) {
 		// if the search was successful then
 		if (!(id_bit_number < 65)) {
 			// search successful so set LastDiscrepancy,LastDeviceFlag,search_result
-			LastDiscrepancy = last_zero;
+			bus->LastDiscrepancy = last_zero;
 
 			// check for last device
-			if (LastDiscrepancy == 0) {
-				LastDeviceFlag = true;
+			if (bus->LastDiscrepancy == 0) {
+				bus->LastDeviceFlag = true;
 			}
 			search_result = true;
 		}
 	}
 
 	// if no device found then reset counters so next 'search' will be like a first
-	if (!search_result || !ROM_NO[0]) {
-		devices=0;
-		LastDiscrepancy = 0;
-		LastDeviceFlag = false;
-		LastFamilyDiscrepancy = 0;
+	if (!search_result || !bus->ROM_NO[0]) {
+		bus->devices=0;
+		bus->LastDiscrepancy = 0;
+		bus->LastDeviceFlag = false;
+		bus->LastFamilyDiscrepancy = 0;
 		search_result = false;
 	} else {
 		for (int i = 0; i < 8; i++){
-			newAddr[i] = ROM_NO[i];
+			newAddr[i] = bus->ROM_NO[i];
+		}
+		bus->devices++;
+		// A normal search that reached the last device knows how many are on the bus
+		if (bus->LastDeviceFlag && search_mode) {
+			bus->busDevices = bus->devices;
 		}
-		devices++;
 	}
 	return search_result;
 }
@@ -13,6 +13,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <esp_system.h>
+#include "onewire.h"
 
 #ifndef DS18B20_H_  
 #define DS18B20_H_
@@ -28,6 +29,39 @@
 typedef uint8_t DeviceAddress[8];
 typedef uint8_t ScratchPad[9];
 
+// Result of a temperature read transaction
+typedef enum {
+	DS18B20_OK = 0,
+	DS18B20_NO_PRESENCE,	// No presence pulse after reset, nothing on the bus responded
+	DS18B20_NO_DEVICE,		// Addressed device did not drive the bus, data read back as all ones
+	DS18B20_ALL_ZEROS,		// Scratchpad read back as all zeros
+	DS18B20_CRC_ERROR,		// Scratchpad CRC mismatch
+} ds18b20_status_t;
+
+// Bus time accounting, estimated from the slot timing of the 1-Wire backend
+typedef struct {
+	uint32_t busTimeUs;		// Time spent on the bus
+	uint32_t savedUs;		// Time saved by coalesced resets, SKIP ROM, partial reads and skipped retries
+} ds18b20_busStats_t;
+
+// State of one 1-Wire bus. Allocated by the caller, initialized with ds18b20_init() and
+// passed to every call for that bus. Calls for different buses can run in parallel from
+// different tasks, calls for the same bus must come from one task at a time.
+typedef struct {
+	onewire_bus_t wire;
+	uint8_t init;
+	uint8_t bitResolution;	// Slowest resolution on the bus, times conversions
+	uint8_t devices;
+	uint8_t busDevices;		// Devices found by the last complete search, 0 if unknown
+	uint8_t knownDevices;	// Devices the caller has registered on the bus, 0 if unknown
+	ds18b20_busStats_t busStats;
+	// Search state
+	DeviceAddress ROM_NO;
+	uint8_t LastDiscrepancy;
+	uint8_t LastFamilyDiscrepancy;
+	bool LastDeviceFlag;
+} ds18b20_bus_t;
+
 // Dow-CRC using polynomial X^8 + X^5 + X^4 + X^0
 // Tiny 2x16 entry CRC table created by Arjen Lentz
 // See http://lentz.com.au/blog/calculating-crc-with-a-tiny-32-entry-lookup-table
@@ -44,36 +78,51 @@ static const uint8_t dscrc2x16_table[] = {
 #endif
 /* *INDENT-ON* */
 
-void ds18b20_init(int GPIO);
+void ds18b20_init(ds18b20_bus_t *bus, int GPIO, int uart);
 
 #define ds18b20_send ds18b20_write
 #define ds18b20_send_byte ds18b20_write_byte
 #define ds18b20_RST_PULSE ds18b20_reset
 
-void ds18b20_write(char bit);
-unsigned char ds18b20_read(void);
-void ds18b20_write_byte(char data);
-unsigned char ds18b20_read_byte(void);
-unsigned char ds18b20_reset(void);
-
-bool ds18b20_setResolution(const DeviceAddress tempSensorAddresses[], int numAddresses, uint8_t newResolution);
-bool ds18b20_isConnected(const DeviceAddress *deviceAddress, uint8_t *scratchPad);
-void ds18b20_writeScratchPad(const DeviceAddress *deviceAddress, const uint8_t *scratchPad);
-bool ds18b20_readScratchPad(const DeviceAddress *deviceAddress, uint8_t *scratchPad);
-void ds18b20_select(const DeviceAddress *address);
+void ds18b20_write(ds18b20_bus_t *bus, char bit);
+unsigned char ds18b20_read(ds18b20_bus_t *bus);
+void ds18b20_write_byte(ds18b20_bus_t *bus, char data);
+unsigned char ds18b20_read_byte(ds18b20_bus_t *bus);
+unsigned char ds18b20_reset(ds18b20_bus_t *bus);
+
+bool ds18b20_setResolution(ds18b20_bus_t *bus, const DeviceAddress tempSensorAddresses[], int numAddresses, uint8_t newResolution);
+bool ds18b20_setAlarms(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, int8_t lowAlarm, int8_t highAlarm);
+bool ds18b20_isConnected(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, uint8_t *scratchPad);
+void ds18b20_writeScratchPad(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, const uint8_t *scratchPad);
+bool ds18b20_readScratchPad(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, uint8_t *scratchPad);
+bool ds18b20_readScratchPadBytes(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, uint8_t *scratchPad, uint8_t len);
+ds18b20_status_t ds18b20_readTemperature(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress, int16_t *rawTemp, bool validateCrc, uint8_t maxAttempts, uint8_t *resolution);
+void ds18b20_select(ds18b20_bus_t *bus, const DeviceAddress *address);
 uint8_t ds18b20_crc8(const uint8_t *addr, uint8_t len);
 bool ds18b20_isAllZeros(const uint8_t * const scratchPad);
-bool isConversionComplete();
-uint16_t millisToWaitForConversion();
-
-void ds18b20_requestTemperatures();
-float ds18b20_getTempF(const DeviceAddress *deviceAddress);
-float ds18b20_getTempC(const DeviceAddress *deviceAddress);
+uint8_t ds18b20_scratchPadResolution(const uint8_t *scratchPad);
+int16_t ds18b20_maskResolution(int16_t rawTemp, uint8_t bitResolution);
+bool isConversionComplete(ds18b20_bus_t *bus);
+uint16_t millisToWaitForConversion(ds18b20_bus_t *bus);
+uint16_t ds18b20_millisForResolution(uint8_t bitResolution);
+void ds18b20_setBusResolution(ds18b20_bus_t *bus, uint8_t bitResolution);
+
+void ds18b20_startConversion(ds18b20_bus_t *bus);
+void ds18b20_requestTemperatures(ds18b20_bus_t *bus);
+float ds18b20_getTempF(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress);
+float ds18b20_getTempC(ds18b20_bus_t *bus, const DeviceAddress *deviceAddress);
 int16_t calculateTemperature(const DeviceAddress *deviceAddress, uint8_t* scratchPad);
-float ds18b20_get_temp(void);
+float ds18b20_get_temp(ds18b20_bus_t *bus);
+
+uint8_t ds18b20_getBusDeviceCount(ds18b20_bus_t *bus);
+void ds18b20_setKnownDeviceCount(ds18b20_bus_t *bus, uint8_t count);
+void ds18b20_forgetBusDeviceCount(ds18b20_bus_t *bus);
+void ds18b20_getBusStats(ds18b20_bus_t *bus, ds18b20_busStats_t *stats);
+void ds18b20_resetBusStats(ds18b20_bus_t *bus);
 
-void reset_search();
-bool search(uint8_t *newAddr, bool search_mode);
+void reset_search(ds18b20_bus_t *bus);
+bool search(ds18b20_bus_t *bus, uint8_t *newAddr, bool search_mode);
+bool alarm_search(ds18b20_bus_t *bus, uint8_t *newAddr);
 
 /* *INDENT-OFF* */
 #ifdef __cplusplus
@@ -0,0 +1,76 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef ONEWIRE_H_
+#define ONEWIRE_H_
+
+/*
+ * 1-Wire bus backends. Exactly one is compiled in, selected at build time with
+ * ONEWIRE_BACKEND (e.g. add -DONEWIRE_BACKEND=ONEWIRE_BACKEND_GPIO to the component
+ * compile definitions).
+ *
+ * ONEWIRE_BACKEND_GPIO : Bit-banged slots timed with ets_delay_us() inside critical sections.
+ * ONEWIRE_BACKEND_UART : Slots generated by a UART peripheral. TX and RX are routed to the same
+ *                        open drain pin, a reset is one byte at 7200 baud and each time slot is
+ *                        one byte at 115200 baud. The calling task blocks on the UART driver
+ *                        while slots are on the wire so the CPU is free for other tasks.
+ */
+#define ONEWIRE_BACKEND_GPIO 0
+#define ONEWIRE_BACKEND_UART 1
+
+#ifndef ONEWIRE_BACKEND
+#define ONEWIRE_BACKEND ONEWIRE_BACKEND_UART
+#endif
+
+// Approximate time each operation occupies the bus, used for bus time accounting
+#if (ONEWIRE_BACKEND == ONEWIRE_BACKEND_UART)
+#define ONEWIRE_RESET_US 1389	// One byte at 7200 baud
+#define ONEWIRE_SLOT_US  87		// One byte at 115200 baud
+#define ONEWIRE_BYTE_US  (8 * ONEWIRE_SLOT_US)
+#else
+#define ONEWIRE_RESET_US 960
+#define ONEWIRE_SLOT_US  70
+#define ONEWIRE_BYTE_US  (8 * (ONEWIRE_SLOT_US + 15))	// Includes inter slot delays
+#endif
+
+// Backend state of one bus
+typedef struct {
+	int gpio;
+	int uart;		// UART backend only, UART0 is reserved for the console
+	uint32_t baud;	// UART backend only
+} onewire_bus_t;
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    extern "C" {
+#endif
+/* *INDENT-ON* */
+
+bool onewire_init(onewire_bus_t *bus, int gpio, int uart);
+bool onewire_reset(onewire_bus_t *bus);
+void onewire_write_bit(onewire_bus_t *bus, uint8_t bit);
+uint8_t onewire_read_bit(onewire_bus_t *bus);
+void onewire_write_byte(onewire_bus_t *bus, uint8_t data);
+uint8_t onewire_read_byte(onewire_bus_t *bus);
+
+/* *INDENT-OFF* */
+#ifdef __cplusplus
+    }
+#endif
+/* *INDENT-ON* */
+
+#endif
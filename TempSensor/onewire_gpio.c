@@ -0,0 +1,107 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "onewire.h"
+
+#if (ONEWIRE_BACKEND == ONEWIRE_BACKEND_GPIO)
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp32/rom/ets_sys.h"
+#include "ds18b20.h"
+
+bool onewire_init(onewire_bus_t *bus, int gpio, int uart){
+	bus->gpio = gpio;
+	gpio_pad_select_gpio(bus->gpio);
+	return true;
+}
+
+/// Sends one bit to bus
+void onewire_write_bit(onewire_bus_t *bus, uint8_t bit){
+	if (bit & 1) {
+		gpio_set_direction(bus->gpio, GPIO_MODE_OUTPUT);
+		noInterrupts();
+		gpio_set_level(bus->gpio,0);
+		ets_delay_us(6);
+		gpio_set_direction(bus->gpio, GPIO_MODE_INPUT);	// release bus
+		ets_delay_us(64);
+		interrupts();
+	} else {
+		gpio_set_direction(bus->gpio, GPIO_MODE_OUTPUT);
+		noInterrupts();
+		gpio_set_level(bus->gpio,0);
+		ets_delay_us(60);
+		gpio_set_direction(bus->gpio, GPIO_MODE_INPUT);	// release bus
+		ets_delay_us(10);
+		interrupts();
+	}
+}
+
+// Reads one bit from bus
+uint8_t onewire_read_bit(onewire_bus_t *bus){
+	uint8_t value = 0;
+	gpio_set_direction(bus->gpio, GPIO_MODE_OUTPUT);
+	noInterrupts();
+	gpio_set_level(bus->gpio, 0);
+	ets_delay_us(6);
+	gpio_set_direction(bus->gpio, GPIO_MODE_INPUT);
+	ets_delay_us(9);
+	value = gpio_get_level(bus->gpio);
+	ets_delay_us(55);
+	interrupts();
+	return (value);
+}
+
+// Sends one byte to bus
+void onewire_write_byte(onewire_bus_t *bus, uint8_t data){
+  uint8_t i;
+  uint8_t x;
+  for(i=0;i<8;i++){
+    x = data>>i;
+    x &= 0x01;
+    onewire_write_bit(bus, x);
+  }
+  ets_delay_us(100);
+}
+
+// Reads one byte from bus
+uint8_t onewire_read_byte(onewire_bus_t *bus){
+  uint8_t i;
+  uint8_t data = 0;
+  for (i=0;i<8;i++)
+  {
+    if(onewire_read_bit(bus)) data|=0x01<<i;
+    ets_delay_us(15);
+  }
+  return(data);
+}
+
+// Sends reset pulse
+bool onewire_reset(onewire_bus_t *bus){
+	uint8_t presence;
+	gpio_set_direction(bus->gpio, GPIO_MODE_OUTPUT);
+	noInterrupts();
+	gpio_set_level(bus->gpio, 0);
+	ets_delay_us(480);
+	gpio_set_level(bus->gpio, 1);
+	gpio_set_direction(bus->gpio, GPIO_MODE_INPUT);
+	ets_delay_us(70);
+	presence = (gpio_get_level(bus->gpio) == 0);
+	ets_delay_us(410);
+	interrupts();
+	return presence;
+}
+
+#endif
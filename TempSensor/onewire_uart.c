@@ -0,0 +1,139 @@
+/*
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "onewire.h"
+
+#if (ONEWIRE_BACKEND == ONEWIRE_BACKEND_UART)
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_rom_gpio.h"
+#include "soc/gpio_sig_map.h"
+
+// A 7200 baud 0xF0 holds the bus low for ~694us (reset pulse). RX samples the first released bit
+// ~69us after release, inside the 60-75us every presence pulse covers (15-60us late, 60us+ long).
+// At 9600 baud that sample lands at ~52us and misses a late, short presence pulse.
+#define RESET_BAUD      7200
+#define RESET_BYTE      0xF0
+// At 115200 baud one byte is one ~87us time slot. The start bit alone (~8.7us low) is a
+// write 1 / read slot, 0x00 holds the bus low for ~78us which is a write 0 slot.
+#define SLOT_BAUD       115200
+#define SLOT_WRITE_1    0xFF
+#define SLOT_WRITE_0    0x00
+#define SLOT_READ       SLOT_WRITE_1
+
+// Longest a transfer of 8 slots (or a reset) can take before the bus is considered stuck
+#define TRANSFER_TIMEOUT_TICKS pdMS_TO_TICKS(20)
+#define RX_BUFFER_SIZE  256     // Must be larger than the UART hardware FIFO
+
+static uint32_t uartTxSignal(uart_port_t uart){
+	switch (uart) {
+	case 0:
+		return U0TXD_OUT_IDX;
+	case 1:
+		return U1TXD_OUT_IDX;
+	default:
+		return U2TXD_OUT_IDX;
+	}
+}
+
+static void setBaud(onewire_bus_t *bus, uint32_t baud){
+	if (bus->baud != baud) {
+		uart_wait_tx_done(bus->uart, TRANSFER_TIMEOUT_TICKS);
+		uart_set_baudrate(bus->uart, baud);
+		bus->baud = baud;
+	}
+}
+
+// Sends slots on the bus and replaces each with the byte read back while it was on the wire.
+// Blocks the calling task (not the CPU) until every slot has been echoed back.
+static bool transfer(onewire_bus_t *bus, uint8_t *slots, uint8_t len){
+	uart_flush_input(bus->uart);
+	uart_write_bytes(bus->uart, (const char *)slots, len);
+	return uart_read_bytes(bus->uart, slots, len, TRANSFER_TIMEOUT_TICKS) == len;
+}
+
+bool onewire_init(onewire_bus_t *bus, int gpio, int uart){
+	const uart_config_t uartConfig = {
+		.baud_rate = SLOT_BAUD,
+		.data_bits = UART_DATA_8_BITS,
+		.parity    = UART_PARITY_DISABLE,
+		.stop_bits = UART_STOP_BITS_1,
+		.flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+	};
+
+	bus->gpio = gpio;
+	bus->uart = uart;
+	if (uart_driver_install(bus->uart, RX_BUFFER_SIZE, 0, 0, NULL, 0) != ESP_OK) return false;
+	if (uart_param_config(bus->uart, &uartConfig) != ESP_OK) return false;
+	bus->baud = SLOT_BAUD;
+
+	// Deliver received bytes after one idle symbol instead of the default 10
+	uart_set_rx_timeout(bus->uart, 1);
+
+	// TX and RX share the bus pin. The pin is switched to open drain (which also resets its
+	// output routing) so TX is routed back onto it afterwards. RX keeps its input routing.
+	uart_set_pin(bus->uart, gpio, gpio, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+	gpio_set_direction(gpio, GPIO_MODE_INPUT_OUTPUT_OD);
+	esp_rom_gpio_connect_out_signal(gpio, uartTxSignal(bus->uart), false, false);
+	return true;
+}
+
+bool onewire_reset(onewire_bus_t *bus){
+	uint8_t slot = RESET_BYTE;
+	bool echoed;
+
+	setBaud(bus, RESET_BAUD);
+	echoed = transfer(bus, &slot, 1);
+	setBaud(bus, SLOT_BAUD);
+
+	// Any device pulling the bus low during the presence window corrupts the echoed byte
+	return echoed && (slot != RESET_BYTE);
+}
+
+void onewire_write_bit(onewire_bus_t *bus, uint8_t bit){
+	uint8_t slot = (bit & 1) ? SLOT_WRITE_1 : SLOT_WRITE_0;
+	transfer(bus, &slot, 1);
+}
+
+uint8_t onewire_read_bit(onewire_bus_t *bus){
+	uint8_t slot = SLOT_READ;
+	if (!transfer(bus, &slot, 1)) return 1;	// Idle bus reads as 1
+	return (slot == SLOT_READ);
+}
+
+void onewire_write_byte(onewire_bus_t *bus, uint8_t data){
+	uint8_t slots[8];
+	for (uint8_t i = 0; i < 8; i++) {
+		slots[i] = ((data >> i) & 1) ? SLOT_WRITE_1 : SLOT_WRITE_0;
+	}
+	transfer(bus, slots, 8);
+}
+
+uint8_t onewire_read_byte(onewire_bus_t *bus){
+	uint8_t slots[8];
+	uint8_t data = 0;
+	for (uint8_t i = 0; i < 8; i++) {
+		slots[i] = SLOT_READ;
+	}
+	if (!transfer(bus, slots, 8)) return 0xFF;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (slots[i] == SLOT_READ) data |= 0x01 << i;
+	}
+	return data;
+}
+
+#endif
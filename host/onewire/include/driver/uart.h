@@ -0,0 +1,41 @@
+#pragma once
+/**
+ * @file uart.h
+ *
+ * @brief
+ * 1-Wire timing test UART. Written bytes are played on the simulated bus line when they are read
+ * back, with the line sampled in the middle of each bit.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef int uart_port_t;
+
+typedef enum { UART_DATA_8_BITS = 3 } uart_word_length_t;
+typedef enum { UART_PARITY_DISABLE = 0 } uart_parity_t;
+typedef enum { UART_STOP_BITS_1 = 1 } uart_stop_bits_t;
+typedef enum { UART_HW_FLOWCTRL_DISABLE = 0 } uart_hw_flowcontrol_t;
+
+#define UART_PIN_NO_CHANGE (-1)
+
+typedef struct
+{
+    int baud_rate;
+    uart_word_length_t data_bits;
+    uart_parity_t parity;
+    uart_stop_bits_t stop_bits;
+    uart_hw_flowcontrol_t flow_ctrl;
+} uart_config_t;
+
+esp_err_t uart_driver_install(uart_port_t uart, int rxBufferSize, int txBufferSize, int queueSize, void *queue, int intrFlags);
+esp_err_t uart_param_config(uart_port_t uart, const uart_config_t *config);
+esp_err_t uart_set_rx_timeout(uart_port_t uart, uint8_t symbols);
+esp_err_t uart_set_pin(uart_port_t uart, int tx, int rx, int rts, int cts);
+esp_err_t uart_set_baudrate(uart_port_t uart, uint32_t baud);
+esp_err_t uart_wait_tx_done(uart_port_t uart, TickType_t ticks);
+esp_err_t uart_flush_input(uart_port_t uart);
+int uart_write_bytes(uart_port_t uart, const void *src, size_t len);
+int uart_read_bytes(uart_port_t uart, void *buf, uint32_t len, TickType_t ticks);
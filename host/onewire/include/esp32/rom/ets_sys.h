@@ -0,0 +1,11 @@
+#pragma once
+/**
+ * @file ets_sys.h
+ *
+ * @brief
+ * 1-Wire timing test busy wait, advances the simulated time
+ */
+
+#include <stdint.h>
+
+void ets_delay_us(uint32_t us);
@@ -0,0 +1,12 @@
+#pragma once
+/**
+ * @file esp_err.h
+ *
+ * @brief
+ * 1-Wire timing test error codes
+ */
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
@@ -0,0 +1,14 @@
+#pragma once
+/**
+ * @file esp_rom_gpio.h
+ *
+ * @brief
+ * 1-Wire timing test GPIO matrix, the UART always drives the bus line
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+static inline void esp_rom_gpio_connect_out_signal(uint32_t gpio, uint32_t signal, bool invert, bool invertEnable)
+{
+}
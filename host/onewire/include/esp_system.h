@@ -0,0 +1,9 @@
+#pragma once
+/**
+ * @file esp_system.h
+ *
+ * @brief
+ * 1-Wire timing test system header, included by ds18b20.h
+ */
+
+#include "esp_err.h"
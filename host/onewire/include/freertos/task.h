@@ -0,0 +1,9 @@
+#pragma once
+/**
+ * @file task.h
+ *
+ * @brief
+ * 1-Wire timing test FreeRTOS tasks, nothing the backends use
+ */
+
+#include "freertos/FreeRTOS.h"
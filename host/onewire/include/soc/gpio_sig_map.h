@@ -0,0 +1,11 @@
+#pragma once
+/**
+ * @file gpio_sig_map.h
+ *
+ * @brief
+ * 1-Wire timing test GPIO matrix signals
+ */
+
+#define U0TXD_OUT_IDX 14
+#define U1TXD_OUT_IDX 17
+#define U2TXD_OUT_IDX 198
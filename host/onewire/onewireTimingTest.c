@@ -0,0 +1,576 @@
+/**
+ * @file onewireTimingTest.c
+ *
+ * @brief
+ * Checks the slot timing of the 1-Wire backends without hardware. The backend under test is
+ * linked against stub drivers that record what it drives onto a simulated bus line: the GPIO
+ * backend's pin levels timed by ets_delay_us(), or the UART backend's bytes expanded to start,
+ * data and stop bits at the current baud rate. A simulated DS18B20 answers on the same line with
+ * the extremes of its datasheet timing, and every recorded reset, presence and read/write slot is
+ * checked against the standard speed limits.
+ *
+ * Build and run both backends with
+ *
+ *   make -C host/onewire check
+ */
+
+// Driver Includes
+#include "onewire.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp32/rom/ets_sys.h"
+
+// Standard Library Includes
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (ONEWIRE_BACKEND == ONEWIRE_BACKEND_UART)
+#define BACKEND_NAME "uart"
+#else
+#define BACKEND_NAME "gpio"
+#endif
+
+/* Standard speed limits, DS18B20 datasheet */
+#define RESET_LOW_MIN_US        480     // tRSTL
+#define RESET_LOW_MAX_US        960     // Longer resets may not be seen as a reset
+#define RESET_HIGH_MIN_US       480     // tRSTH, presence detect and recovery
+#define PRESENCE_DELAY_MIN_US   15      // tPDHIGH
+#define PRESENCE_DELAY_MAX_US   60
+#define PRESENCE_LOW_MIN_US     60      // tPDLOW
+#define PRESENCE_LOW_MAX_US     240
+#define SLOT_MIN_US             60      // tSLOT
+#define SLOT_MAX_US             120
+#define RECOVERY_MIN_US         1       // tREC
+#define LOW_1_MIN_US            1       // tLOW1 and tLOWR
+#define LOW_1_MAX_US            15
+#define LOW_0_MIN_US            60      // tLOW0
+#define LOW_0_MAX_US            120
+#define READ_VALID_MIN_US       15      // tRDV, a device holds a 0 at least this long...
+#define READ_VALID_MAX_US       60      // ...and releases the line before the slot ends
+
+#define LINE_MAX_PULSES         32
+
+/* A low pulse on the line, times in simulated us */
+typedef struct
+{
+    double fall;
+    double rise;
+} LinePulse_t;
+
+/* Simulated DS18B20 timing */
+typedef struct
+{
+    bool present;
+    double presenceDelayUs;
+    double presenceLowUs;
+    double readHoldUs;
+} Device_t;
+
+static double Now;                                  // Simulated time, us
+static bool MasterLow;
+static LinePulse_t MasterPulses[LINE_MAX_PULSES];   // Recorded since lineRecord()
+static int MasterPulseCount;
+static LinePulse_t DevicePulses[LINE_MAX_PULSES];
+static int DevicePulseCount;
+
+static Device_t Device;
+static uint32_t DeviceBits;                         // Answered in read slots, LSB first
+static int DeviceBitCount;
+
+static int Failures;
+
+/* Stub driver state */
+static bool GpioOutput;
+static uint32_t GpioLevel = 1;
+static uint32_t UartBaud;
+static uint8_t UartTx[16];
+static size_t UartTxLen;
+
+static void fail(const char *format, ...)
+{
+    va_list args;
+
+    printf("%s: FAIL ", BACKEND_NAME);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+    Failures++;
+}
+
+/* Line model */
+
+/**
+ * @brief Starts a new recording of the master's pulses, the device forgets earlier ones
+ */
+static void lineRecord(void)
+{
+    MasterPulseCount = 0;
+    DevicePulseCount = 0;
+}
+
+static void devicePull(double fromUs, double toUs)
+{
+    if(DevicePulseCount < LINE_MAX_PULSES)
+    {
+        DevicePulses[DevicePulseCount].fall = fromUs;
+        DevicePulses[DevicePulseCount].rise = toUs;
+        DevicePulseCount++;
+    }
+}
+
+/**
+ * @brief Sets what the master drives onto the line at the current time
+ *
+ * The device reacts to the master's edges: a falling edge starts a slot it answers a 0 in by
+ * holding the line low, releasing the line after a reset pulse is answered with a presence pulse.
+ */
+static void lineDrive(bool low)
+{
+    if(low && !MasterLow)
+    {
+        MasterLow = true;
+        if(MasterPulseCount < LINE_MAX_PULSES)
+        {
+            MasterPulses[MasterPulseCount].fall = Now;
+        }
+        if(Device.present && (DeviceBitCount > 0))
+        {
+            if(!(DeviceBits & 1))
+            {
+                devicePull(Now, Now + Device.readHoldUs);
+            }
+            DeviceBits >>= 1;
+            DeviceBitCount--;
+        }
+    }
+    else if(!low && MasterLow)
+    {
+        MasterLow = false;
+        if(MasterPulseCount < LINE_MAX_PULSES)
+        {
+            MasterPulses[MasterPulseCount].rise = Now;
+            if(Device.present && ((Now - MasterPulses[MasterPulseCount].fall) >= RESET_LOW_MIN_US))
+            {
+                devicePull(Now + Device.presenceDelayUs, Now + Device.presenceDelayUs + Device.presenceLowUs);
+            }
+            MasterPulseCount++;
+        }
+    }
+}
+
+/**
+ * @brief Wired-AND of the master and the device at the current time, 1 when released
+ */
+static int lineLevel(void)
+{
+    if(MasterLow)
+    {
+        return 0;
+    }
+    for(int i = 0; i < DevicePulseCount; i++)
+    {
+        if((Now >= DevicePulses[i].fall) && (Now <= DevicePulses[i].rise))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Stub drivers */
+
+void ets_delay_us(uint32_t us)
+{
+    Now += us;
+}
+
+void gpio_pad_select_gpio(uint8_t gpio)
+{
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode)
+{
+    // Open drain is the UART backend's pin, its TX drives the line
+    GpioOutput = (mode == GPIO_MODE_OUTPUT);
+    lineDrive(GpioOutput && (GpioLevel == 0));
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+    GpioLevel = level;
+    lineDrive(GpioOutput && (GpioLevel == 0));
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+    return lineLevel();
+}
+
+esp_err_t uart_driver_install(uart_port_t uart, int rxBufferSize, int txBufferSize, int queueSize, void *queue, int intrFlags)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart, const uart_config_t *config)
+{
+    UartBaud = config->baud_rate;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_rx_timeout(uart_port_t uart, uint8_t symbols)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart, int tx, int rx, int rts, int cts)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_set_baudrate(uart_port_t uart, uint32_t baud)
+{
+    UartBaud = baud;
+    return ESP_OK;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t uart, TickType_t ticks)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart)
+{
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart, const void *src, size_t len)
+{
+    if(len > (sizeof(UartTx) - UartTxLen))
+    {
+        len = sizeof(UartTx) - UartTxLen;
+    }
+    memcpy(&UartTx[UartTxLen], src, len);
+    UartTxLen += len;
+    return len;
+}
+
+/**
+ * @brief Plays one byte on the line, start bit, 8 data bits LSB first and a stop bit
+ *
+ * @return The byte RX sampled in the middle of each data bit
+ */
+static uint8_t uartPlay(uint8_t data)
+{
+    double bitUs = 1e6 / UartBaud;
+    uint8_t echo = 0;
+
+    for(int bit = 0; bit < 10; bit++)
+    {
+        lineDrive((bit == 0) || ((bit <= 8) && !((data >> (bit - 1)) & 1)));
+        Now += bitUs / 2;
+        if((bit >= 1) && (bit <= 8) && lineLevel())
+        {
+            echo |= 1 << (bit - 1);
+        }
+        Now += bitUs / 2;
+    }
+    return echo;
+}
+
+int uart_read_bytes(uart_port_t uart, void *buf, uint32_t len, TickType_t ticks)
+{
+    uint8_t *rx = buf;
+    uint32_t count = 0;
+
+    for(size_t i = 0; i < UartTxLen; i++)
+    {
+        uint8_t echo = uartPlay(UartTx[i]);
+        if(count < len)
+        {
+            rx[count++] = echo;
+        }
+    }
+    UartTxLen = 0;
+    return count;
+}
+
+/* Checks */
+
+static void deviceSet(bool present, double presenceDelayUs, double presenceLowUs, double readHoldUs)
+{
+    Device.present = present;
+    Device.presenceDelayUs = presenceDelayUs;
+    Device.presenceLowUs = presenceLowUs;
+    Device.readHoldUs = readHoldUs;
+    DeviceBitCount = 0;
+}
+
+static void printPulses(void)
+{
+    for(int i = 0; i < MasterPulseCount; i++)
+    {
+        printf("    master low %8.1f - %8.1f us (%5.1f us)\n", MasterPulses[i].fall, MasterPulses[i].rise,
+               MasterPulses[i].rise - MasterPulses[i].fall);
+    }
+    for(int i = 0; i < DevicePulseCount; i++)
+    {
+        printf("    device low %8.1f - %8.1f us\n", DevicePulses[i].fall, DevicePulses[i].rise);
+    }
+}
+
+/**
+ * @brief Checks the recorded pulses are one time slot each for the bits given
+ *
+ * @param[in] what      Name of the operation for messages
+ * @param[in] start     Recorded pulse of the first slot
+ * @param[in] bits      Slots, LSB first. A 1 is a write 1 or read slot, a 0 a write 0 slot.
+ * @param[in] count     Number of slots
+ * @param[in] end       Time the operation returned, us
+ *
+ * @return true if every slot is inside the standard speed limits
+ */
+static bool checkSlots(const char *what, int start, uint32_t bits, int count, double end)
+{
+    int failures = Failures;
+
+    if((MasterPulseCount - start) != count)
+    {
+        fail("%s: %d slots recorded, expected %d", what, MasterPulseCount - start, count);
+        return false;
+    }
+
+    for(int i = 0; i < count; i++)
+    {
+        const LinePulse_t *pulse = &MasterPulses[start + i];
+        double low = pulse->rise - pulse->fall;
+        double next = (i + 1 < count) ? MasterPulses[start + i + 1].fall : end;
+
+        if((bits >> i) & 1)
+        {
+            if((low < LOW_1_MIN_US) || (low >= LOW_1_MAX_US))
+            {
+                fail("%s: slot %d write 1/read low %.1f us, limits %d-%d us", what, i, low, LOW_1_MIN_US, LOW_1_MAX_US);
+            }
+        }
+        else if((low < LOW_0_MIN_US) || (low > LOW_0_MAX_US))
+        {
+            fail("%s: slot %d write 0 low %.1f us, limits %d-%d us", what, i, low, LOW_0_MIN_US, LOW_0_MAX_US);
+        }
+
+        // The next slot (or whatever the caller does next) must not start inside this one
+        if((next - pulse->fall) < (SLOT_MIN_US + RECOVERY_MIN_US))
+        {
+            fail("%s: slot %d lasts %.1f us, minimum %d us plus %d us recovery", what, i, next - pulse->fall,
+                 SLOT_MIN_US, RECOVERY_MIN_US);
+        }
+        if((next - pulse->rise) < RECOVERY_MIN_US)
+        {
+            fail("%s: slot %d recovery %.1f us, minimum %d us", what, i, next - pulse->rise, RECOVERY_MIN_US);
+        }
+    }
+    return (Failures == failures);
+}
+
+/**
+ * @brief Decodes written bits the way a device samples them, anywhere from 15 to 60 us into the slot
+ */
+static bool checkWritten(const char *what, uint32_t data, int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        const LinePulse_t *pulse = &MasterPulses[i];
+        double low = pulse->rise - pulse->fall;
+        int bit = (data >> i) & 1;
+
+        if((bit && (low > READ_VALID_MIN_US)) || (!bit && (low < READ_VALID_MAX_US)))
+        {
+            fail("%s: slot %d low %.1f us, a device may not sample %d", what, i, low, bit);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testReset(void)
+{
+    static const double presenceDelaysUs[] = { PRESENCE_DELAY_MIN_US, PRESENCE_DELAY_MAX_US };
+    static const double presenceLowsUs[] = { PRESENCE_LOW_MIN_US, PRESENCE_LOW_MAX_US };
+    onewire_bus_t bus;
+
+    onewire_init(&bus, 4, 2);
+
+    for(int d = 0; d < 2; d++)
+    {
+        for(int l = 0; l < 2; l++)
+        {
+            bool presence;
+            double start = Now;
+
+            deviceSet(true, presenceDelaysUs[d], presenceLowsUs[l], READ_VALID_MIN_US);
+            lineRecord();
+            presence = onewire_reset(&bus);
+
+            if(MasterPulseCount != 1)
+            {
+                fail("reset: %d pulses recorded, expected 1", MasterPulseCount);
+                printPulses();
+                continue;
+            }
+
+            double low = MasterPulses[0].rise - MasterPulses[0].fall;
+            double high = Now - MasterPulses[0].rise;
+            bool ok = true;
+
+            if((low < RESET_LOW_MIN_US) || (low > RESET_LOW_MAX_US))
+            {
+                fail("reset: low %.1f us, limits %d-%d us", low, RESET_LOW_MIN_US, RESET_LOW_MAX_US);
+                ok = false;
+            }
+            if(high < RESET_HIGH_MIN_US)
+            {
+                fail("reset: released %.1f us before returning, minimum %d us", high, RESET_HIGH_MIN_US);
+                ok = false;
+            }
+            if(!presence)
+            {
+                fail("reset: presence %.0f us after release for %.0f us not detected", presenceDelaysUs[d],
+                     presenceLowsUs[l]);
+                ok = false;
+            }
+            if(!ok)
+            {
+                printPulses();
+            }
+            else if((d == 0) && (l == 0))
+            {
+                printf("%s: reset low %.1f us, released %.1f us, takes %.1f us\n", BACKEND_NAME, low, high, Now - start);
+            }
+        }
+    }
+
+    deviceSet(false, 0, 0, 0);
+    lineRecord();
+    if(onewire_reset(&bus))
+    {
+        fail("reset: presence detected on an empty bus");
+        printPulses();
+    }
+}
+
+static void testWrite(void)
+{
+    static const uint8_t patterns[] = { 0xA5, 0x00, 0xFF, 0x3C };
+    onewire_bus_t bus;
+
+    onewire_init(&bus, 4, 2);
+    deviceSet(true, PRESENCE_DELAY_MIN_US, PRESENCE_LOW_MIN_US, READ_VALID_MIN_US);
+
+    for(size_t p = 0; p < sizeof(patterns); p++)
+    {
+        char what[32];
+
+        snprintf(what, sizeof(what), "write byte 0x%02X", patterns[p]);
+        lineRecord();
+        onewire_write_byte(&bus, patterns[p]);
+        if(!checkSlots(what, 0, patterns[p], 8, Now) || !checkWritten(what, patterns[p], 8))
+        {
+            printPulses();
+        }
+    }
+
+    for(int bit = 0; bit <= 1; bit++)
+    {
+        char what[32];
+
+        snprintf(what, sizeof(what), "write bit %d", bit);
+        lineRecord();
+        onewire_write_bit(&bus, bit);
+        if(!checkSlots(what, 0, bit, 1, Now) || !checkWritten(what, bit, 1))
+        {
+            printPulses();
+        }
+        else
+        {
+            printf("%s: write %d low %.1f us, slot %.1f us\n", BACKEND_NAME, bit,
+                   MasterPulses[0].rise - MasterPulses[0].fall, Now - MasterPulses[0].fall);
+        }
+    }
+}
+
+static void testRead(void)
+{
+    static const uint8_t patterns[] = { 0x5A, 0x00, 0xFF, 0xC3 };
+    static const double holdsUs[] = { READ_VALID_MIN_US, READ_VALID_MAX_US };
+    onewire_bus_t bus;
+
+    onewire_init(&bus, 4, 2);
+
+    for(int h = 0; h < 2; h++)
+    {
+        for(size_t p = 0; p < sizeof(patterns); p++)
+        {
+            char what[48];
+            uint8_t data;
+
+            snprintf(what, sizeof(what), "read byte 0x%02X held %.0f us", patterns[p], holdsUs[h]);
+            deviceSet(true, PRESENCE_DELAY_MIN_US, PRESENCE_LOW_MIN_US, holdsUs[h]);
+            DeviceBits = patterns[p];
+            DeviceBitCount = 8;
+            lineRecord();
+            data = onewire_read_byte(&bus);
+            if(data != patterns[p])
+            {
+                fail("%s: read 0x%02X", what, data);
+                printPulses();
+            }
+            else if(!checkSlots(what, 0, 0xFF, 8, Now))
+            {
+                printPulses();
+            }
+        }
+
+        for(int bit = 0; bit <= 1; bit++)
+        {
+            char what[48];
+            uint8_t data;
+
+            snprintf(what, sizeof(what), "read bit %d held %.0f us", bit, holdsUs[h]);
+            deviceSet(true, PRESENCE_DELAY_MIN_US, PRESENCE_LOW_MIN_US, holdsUs[h]);
+            DeviceBits = bit;
+            DeviceBitCount = 1;
+            lineRecord();
+            data = onewire_read_bit(&bus);
+            if(data != bit)
+            {
+                fail("%s: read %d", what, data);
+                printPulses();
+            }
+            else if(!checkSlots(what, 0, 1, 1, Now))
+            {
+                printPulses();
+            }
+            else if((h == 0) && (bit == 1))
+            {
+                printf("%s: read low %.1f us, slot %.1f us\n", BACKEND_NAME,
+                       MasterPulses[0].rise - MasterPulses[0].fall, Now - MasterPulses[0].fall);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    testReset();
+    testWrite();
+    testRead();
+
+    printf("%s: %s, %d failures\n", BACKEND_NAME, Failures ? "FAIL" : "pass", Failures);
+    return Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file rulesBench.c
+ *
+ * @brief
+ * Host benchmark of the pump rules engine. Measures compiled evaluation time against the number
+ * of rules in a program. Build and run from the repository root with:
+ *
+ *      gcc -O2 -Imain host/rulesBench.c main/rules.c -o rulesBench && ./rulesBench
+ *
+ */
+
+#include "rules.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ITERATIONS 200000
+
+/* Variables in the order the pump control task passes them */
+enum
+{
+    VAR_AMBIENT = 0,
+    VAR_WATER,
+    VAR_SOLAR,
+    VAR_HOUR,
+    VAR_PUMP,
+    VAR_COUNT
+};
+
+static const char * const VarNames[VAR_COUNT] = { "ambient", "water", "solar", "hour", "pump" };
+
+/* Representative rule, repeated to build larger programs */
+static const char * const Rule = "water < 35 || (ambient < 3 && hour >= 0 && hour < 6) || solar - water > 8";
+
+static double nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+/**
+ * @brief Checks the example rule against known inputs before timing it
+ */
+static int checkRule(const RuleProgram_t *program)
+{
+    int32_t vars[VAR_COUNT];
+    int failures = 0;
+
+    // Nothing true
+    vars[VAR_AMBIENT] = 20 * RULES_FIXED_SCALE;
+    vars[VAR_WATER] = 36 * RULES_FIXED_SCALE;
+    vars[VAR_SOLAR] = 40 * RULES_FIXED_SCALE;
+    vars[VAR_HOUR] = 12 * RULES_FIXED_SCALE;
+    vars[VAR_PUMP] = 0;
+    failures += (rulesEvaluate(program, vars) != 0);
+
+    // Solar collector more than 8C above water
+    vars[VAR_SOLAR] = 44.5 * RULES_FIXED_SCALE;
+    failures += (rulesEvaluate(program, vars) != 1);
+
+    // Disconnected water sensor makes the comparisons using it false
+    vars[VAR_WATER] = RULES_VALUE_INVALID;
+    failures += (rulesEvaluate(program, vars) != 0);
+
+    // Cold night
+    vars[VAR_AMBIENT] = 2 * RULES_FIXED_SCALE;
+    vars[VAR_HOUR] = 3 * RULES_FIXED_SCALE;
+    failures += (rulesEvaluate(program, vars) != 1);
+
+    return failures;
+}
+
+/**
+ * @brief Checks that ! doesn't turn a comparison with a disconnected sensor true
+ */
+static int checkNegatedRule()
+{
+    static RuleProgram_t program;
+    const char * const rules[] = { "!(water > 30)", "!(water > 30) || ambient < 3", "!(water > 30 && ambient > 30)" };
+    int32_t vars[VAR_COUNT] = { 0 };
+    RuleCompileError_t error;
+    int failures = 0;
+
+    if(!rulesCompile(&program, rules, 3, VarNames, VAR_COUNT, &error))
+    {
+        return 1;
+    }
+
+    vars[VAR_AMBIENT] = 20 * RULES_FIXED_SCALE;
+    vars[VAR_WATER] = 20 * RULES_FIXED_SCALE;
+    failures += (rulesEvaluate(&program, vars) != 0x7);
+
+    // Invalid through !, a false side still decides &&
+    vars[VAR_WATER] = RULES_VALUE_INVALID;
+    failures += (rulesEvaluate(&program, vars) != 0x4);
+
+    // A true side still decides ||
+    vars[VAR_AMBIENT] = 2 * RULES_FIXED_SCALE;
+    failures += (rulesEvaluate(&program, vars) != 0x6);
+
+    return failures;
+}
+
+int main()
+{
+    static RuleProgram_t program;
+    const char *rules[RULES_MAX];
+    int32_t vars[VAR_COUNT] = { 0 };
+    RuleCompileError_t error;
+    volatile uint32_t sink = 0;
+    double start;
+    double elapsed;
+
+    for(uint8_t i = 0; i < RULES_MAX; i++)
+    {
+        rules[i] = Rule;
+    }
+
+    if(!rulesCompile(&program, rules, 1, VarNames, VAR_COUNT, &error) || (checkRule(&program) != 0) ||
+       (checkNegatedRule() != 0))
+    {
+        printf("Rule check failed\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("rules  code bytes  ns/eval\n");
+
+    for(uint8_t count = 1; count <= RULES_MAX; count *= 2)
+    {
+        if(!rulesCompile(&program, rules, count, VarNames, VAR_COUNT, &error))
+        {
+            printf("%5d  compile failed, rule %d at %d: %s\n", count, error.rule, error.position, error.message);
+            continue;
+        }
+
+        start = nowNs();
+        for(uint32_t i = 0; i < ITERATIONS; i++)
+        {
+            // Vary an input so the work can't be hoisted out of the loop
+            vars[VAR_WATER] = (int32_t)(i & 0x1FFF);
+            sink += rulesEvaluate(&program, vars);
+        }
+        elapsed = nowNs() - start;
+
+        printf("%5d  %10d  %7.1f\n", count, program.codeLen, elapsed / ITERATIONS);
+    }
+
+    return EXIT_SUCCESS;
+}
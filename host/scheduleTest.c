@@ -0,0 +1,166 @@
+/**
+ * @file scheduleTest.c
+ *
+ * @brief
+ * Host test of the weekly schedule. Replays a year of transitions in the project TIMEZONE and
+ * checks them minute by minute against a brute force evaluation of the run windows, including
+ * windows in the hours repeated and skipped by DST changes. Build and run from the repository
+ * root with:
+ *
+ *      gcc -O2 -Imain host/scheduleTest.c main/schedule.c -o scheduleTest && ./scheduleTest
+ *
+ */
+
+#include "schedule.h"
+#include "ProjectConfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_EVENTS 4096
+
+/* Covers overlaps, a window past the end of the week and both DST change hours (Sunday 01:00-03:00) */
+static const ScheduleWindow_t Windows[] =
+{
+    { SCHEDULE_EVERY_DAY, 6 * 60, 8 * 60 },
+    { SCHEDULE_EVERY_DAY, 7 * 60 + 30, 9 * 60 },
+    { SCHEDULE_WEEKDAYS, 12 * 60, 12 * 60 + 1 },
+    { SCHEDULE_SATURDAY, 23 * 60, 30 },
+    { SCHEDULE_SUNDAY, 1 * 60 + 15, 1 * 60 + 45 },
+    { SCHEDULE_SUNDAY, 2 * 60 + 15, 2 * 60 + 45 },
+    { SCHEDULE_FRIDAY, 23 * 60 + 59, 0 },
+};
+
+#define WINDOW_COUNT (sizeof(Windows) / sizeof(Windows[0]))
+
+static double nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+/**
+ * @brief Reference state straight from the windows, without the compiled schedule
+ */
+static bool referenceState(time_t time)
+{
+    struct tm timeInfo;
+    int minute;
+    int yesterday;
+
+    localtime_r(&time, &timeInfo);
+    minute = (timeInfo.tm_hour * 60) + timeInfo.tm_min;
+    yesterday = (timeInfo.tm_wday + 6) % 7;
+
+    for(unsigned w = 0; w < WINDOW_COUNT; w++)
+    {
+        const ScheduleWindow_t *window = &Windows[w];
+
+        if(window->end > window->start)
+        {
+            if((window->days & (1 << timeInfo.tm_wday)) && (minute >= window->start) && (minute < window->end))
+            {
+                return true;
+            }
+        }
+        else    // Past midnight
+        {
+            if((window->days & (1 << timeInfo.tm_wday)) && (minute >= window->start))
+            {
+                return true;
+            }
+            if((window->days & (1 << yesterday)) && (minute < window->end))
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+int main()
+{
+    static Schedule_t schedule;
+    static time_t events[MAX_EVENTS];
+    struct tm startInfo = { .tm_year = 2023 - 1900, .tm_mon = 0, .tm_mday = 1, .tm_isdst = -1 };
+    time_t start;
+    time_t end;
+    time_t now;
+    double startNs;
+    double elapsedNs;
+    int eventCount = 0;
+    int changes = 0;
+    int failures = 0;
+    int e = 0;
+    bool state;
+
+    setenv("TZ", TIMEZONE, 1);
+    tzset();
+
+    if(!scheduleCompile(&schedule, Windows, WINDOW_COUNT))
+    {
+        printf("Schedule failed to compile\n");
+        return 1;
+    }
+
+    start = mktime(&startInfo);
+    end = start + (365 * 24 * 3600);
+
+    // Replay every transition of the year
+    startNs = nowNs();
+    for(now = start; (now < end) && (eventCount < MAX_EVENTS); )
+    {
+        now = scheduleNextTransition(&schedule, now);
+        if(now == 0)
+        {
+            break;
+        }
+        events[eventCount++] = now;
+    }
+    elapsedNs = nowNs() - startNs;
+
+    printf("%d transitions (%d table entries) replayed in %.3f ms, %.0f ns each\n",
+           eventCount, schedule.count, elapsedNs / 1e6, elapsedNs / eventCount);
+
+    // Walk the year a minute at a time. The state must match the reference, and change only at a
+    // replayed transition. Transitions where the state doesn't change are ones in the hour skipped
+    // when DST starts.
+    state = referenceState(start);
+    for(now = start; now < events[eventCount - 1]; now += 60)
+    {
+        bool reference = referenceState(now);
+
+        if(scheduleStateAt(&schedule, now) != reference)
+        {
+            if(failures++ < 10)
+            {
+                printf("State mismatch at %s", ctime(&now));
+            }
+        }
+
+        while((e < eventCount) && (events[e] < now))
+        {
+            e++;
+        }
+
+        if(reference != state)
+        {
+            changes++;
+            if((e >= eventCount) || (events[e] != now))
+            {
+                if(failures++ < 10)
+                {
+                    printf("Missed transition at %s", ctime(&now));
+                }
+            }
+            state = reference;
+        }
+    }
+
+    printf("%d state changes, %d transitions without one, %d failures\n", changes, (eventCount - 1) - changes, failures);
+
+    return (failures != 0);
+}
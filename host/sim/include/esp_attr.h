@@ -0,0 +1,10 @@
+#pragma once
+/**
+ * @file esp_attr.h
+ *
+ * @brief
+ * Host simulator stand in, there is no RTC memory so retained data starts cleared as on power on
+ */
+
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
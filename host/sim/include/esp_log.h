@@ -0,0 +1,14 @@
+#pragma once
+/**
+ * @file esp_log.h
+ *
+ * @brief
+ * Host simulator stand in for ESP-IDF logging, prefixed with the simulated time
+ */
+
+void simLog(char level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, format, ...) simLog('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) simLog('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) simLog('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) simLog('D', tag, format, ##__VA_ARGS__)
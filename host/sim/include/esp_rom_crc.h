@@ -0,0 +1,11 @@
+#pragma once
+/**
+ * @file esp_rom_crc.h
+ *
+ * @brief
+ * Host simulator stand in for the ROM CRC functions
+ */
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
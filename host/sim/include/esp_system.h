@@ -0,0 +1,31 @@
+#pragma once
+/**
+ * @file esp_system.h
+ *
+ * @brief
+ * Host simulator stand in, the simulation always starts from power on
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum
+{
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+    ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+static inline esp_reset_reason_t esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
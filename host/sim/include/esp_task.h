@@ -0,0 +1,9 @@
+#pragma once
+/**
+ * @file esp_task.h
+ *
+ * @brief
+ * Host simulator stand in for the ESP-IDF task stack sizes
+ */
+
+#define ESP_TASK_MAIN_STACK 4096
@@ -0,0 +1,32 @@
+#pragma once
+/**
+ * @file timers.h
+ *
+ * @brief
+ * Host simulator FreeRTOS software timers. Callbacks run when the simulation reaches their
+ * expiry, in place of the timer service task.
+ */
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct SimTimer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+typedef struct SimTimer
+{
+    const char *name;
+    TimerCallbackFunction_t callback;
+    void *id;
+    TickType_t period;
+    bool autoReload;
+    bool active;
+    int64_t expiryUs;
+    struct SimTimer *next;
+} StaticTimer_t;
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+                                 TimerCallbackFunction_t callback, StaticTimer_t *buffer);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticksToWait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticksToWait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticksToWait);
+void *pvTimerGetTimerID(TimerHandle_t timer);
@@ -0,0 +1,12 @@
+#pragma once
+/**
+ * @file simCompat.h
+ *
+ * @brief
+ * Included ahead of every simulator source for what newlib provides on the ESP32 and glibc
+ * doesn't
+ */
+
+#include <stddef.h>
+
+size_t strlcpy(char *dst, const char *src, size_t size);
@@ -0,0 +1,492 @@
+/**
+ * @file onewireSim.c
+ *
+ * @brief
+ * Simulated 1-Wire buses of DS18B20 devices. Each bus is a state machine fed the bits the
+ * driver writes, reads return the wired-AND of what the selected devices drive. Conversions take
+ * the datasheet time for the device's resolution in simulated time and sample the device's
+ * temperature source when they complete.
+ */
+
+// Project Includes
+#include "onewireSim.h"
+#include "sim.h"
+
+// Driver Includes
+#include "onewire.h"
+#include "ds18b20.h"
+
+// Standard Library Includes
+#include <math.h>
+#include <string.h>
+
+#define SIM_ONEWIRE_MAX_BUSES 4
+
+#define DS18B20_FAMILY 0x28
+
+/* What the bus expects next */
+typedef enum
+{
+    SIM_BUS_IDLE,               // Waiting for a reset
+    SIM_BUS_ROM_COMMAND,
+    SIM_BUS_MATCH_ROM,
+    SIM_BUS_SEARCH,
+    SIM_BUS_FUNCTION_COMMAND,
+    SIM_BUS_WRITE_SCRATCHPAD,
+    SIM_BUS_READ_SCRATCHPAD,
+    SIM_BUS_CONVERTING,         // Read slots report conversion complete
+} SimBusState_t;
+
+/* Simulated DS18B20 */
+typedef struct
+{
+    int gpio;
+    uint8_t rom[8];
+    SimTempSource_t source;
+    void *arg;
+    uint8_t scratchpad[9];
+    uint8_t eeprom[3];          // TH, TL, configuration
+    bool converting;
+    int64_t conversionEndUs;
+    bool alarm;
+    bool selected;
+} SimDevice_t;
+
+/* Simulated 1-Wire bus */
+typedef struct
+{
+    int gpio;
+    SimBusState_t state;
+    uint8_t shift;              // Bits of the byte being written, LSB first
+    uint8_t bitCount;
+    uint8_t byteCount;
+    uint8_t romBit;             // Search and match ROM position
+    uint8_t searchSlot;         // 0 and 1 read the bit and its complement, 2 writes the direction
+} SimBus_t;
+
+SimDevice_t Devices[SIM_ONEWIRE_MAX_DEVICES];
+uint8_t DeviceCount = 0;
+
+SimBus_t Buses[SIM_ONEWIRE_MAX_BUSES];
+uint8_t BusCount = 0;
+
+static SimBus_t *getBus(onewire_bus_t *wire)
+{
+    for(uint8_t b = 0; b < BusCount; b++)
+    {
+        if(Buses[b].gpio == wire->gpio)
+        {
+            return &Buses[b];
+        }
+    }
+    return NULL;
+}
+
+static inline bool romBit(const SimDevice_t *device, uint8_t bit)
+{
+    return (device->rom[bit / 8] >> (bit % 8)) & 1;
+}
+
+static inline uint8_t deviceResolution(const SimDevice_t *device)
+{
+    return ((device->scratchpad[4] >> 5) & 0x03) + 9;
+}
+
+static void updateScratchpadCrc(SimDevice_t *device)
+{
+    device->scratchpad[8] = ds18b20_crc8(device->scratchpad, 8);
+}
+
+/**
+ * @brief Checks if a device is connected at the current simulated time
+ */
+static bool devicePresent(const SimDevice_t *device)
+{
+    float celsius;
+    return device->source(device->arg, SimTimeUs, &celsius);
+}
+
+/**
+ * @brief Completes a conversion once its time is up, latching the temperature and alarm flag
+ */
+static void updateConversion(SimDevice_t *device)
+{
+    float celsius;
+    int32_t raw;
+    uint8_t resolution;
+
+    if(!device->converting || (SimTimeUs < device->conversionEndUs))
+    {
+        return;
+    }
+
+    device->converting = false;
+    if(!device->source(device->arg, device->conversionEndUs, &celsius))
+    {
+        return;
+    }
+
+    // 1/16 C register, undefined low bits read as zero below 12 bits
+    resolution = deviceResolution(device);
+    raw = (int32_t)floorf(celsius * 16.0f);
+    raw = (raw < -55 * 16) ? -55 * 16 : ((raw > 125 * 16) ? 125 * 16 : raw);
+    raw &= ~((1 << (12 - resolution)) - 1);
+
+    device->scratchpad[0] = (uint8_t)(raw & 0xFF);
+    device->scratchpad[1] = (uint8_t)((raw >> 8) & 0xFF);
+    updateScratchpadCrc(device);
+
+    // Integer part compared against TH and TL
+    device->alarm = ((raw >> 4) >= (int8_t)device->scratchpad[2]) || ((raw >> 4) <= (int8_t)device->scratchpad[3]);
+}
+
+/**
+ * @brief
+ * Adds a DS18B20 to the bus on a GPIO. Its ROM code is family 0x28 with the serial in the
+ * first serial byte, bit reversed so a search finds devices in order of serial.
+ *
+ * @param gpio Bus the device is on
+ * @param serial Serial number
+ * @param source Temperature of the device over time
+ * @param arg Argument passed to source
+ * @return true if added
+ */
+bool onewireSimAddDevice(int gpio, uint8_t serial, SimTempSource_t source, void *arg)
+{
+    SimDevice_t *device;
+    uint8_t reversed = 0;
+
+    if(DeviceCount >= SIM_ONEWIRE_MAX_DEVICES)
+    {
+        return false;
+    }
+
+    for(int i = 0; i < 8; i++)
+    {
+        reversed |= ((serial >> i) & 1) << (7 - i);
+    }
+
+    device = &Devices[DeviceCount++];
+    memset(device, 0, sizeof(SimDevice_t));
+    device->gpio = gpio;
+    device->source = source;
+    device->arg = arg;
+
+    device->rom[0] = DS18B20_FAMILY;
+    device->rom[1] = reversed;
+    device->rom[6] = 0x5A;
+    device->rom[7] = ds18b20_crc8(device->rom, 7);
+
+    // Power up state: 85 C, alarms from EEPROM, 12 bits
+    device->eeprom[0] = 75;
+    device->eeprom[1] = 70;
+    device->eeprom[2] = 0x7F;
+    device->scratchpad[0] = 0x50;
+    device->scratchpad[1] = 0x05;
+    memcpy(&device->scratchpad[2], device->eeprom, 3);
+    device->scratchpad[5] = 0xFF;
+    device->scratchpad[6] = 0x0C;
+    device->scratchpad[7] = 0x10;
+    updateScratchpadCrc(device);
+
+    return true;
+}
+
+/**
+ * @brief Runs a function command once its byte has been written
+ */
+static void functionCommand(SimBus_t *bus, uint8_t command)
+{
+    switch(command)
+    {
+        case 0x44:  // Convert T, typical devices finish in about 90% of the driver's worst case
+            for(uint8_t d = 0; d < DeviceCount; d++)
+            {
+                if(Devices[d].selected)
+                {
+                    Devices[d].converting = true;
+                    Devices[d].conversionEndUs = SimTimeUs + ((int64_t)ds18b20_millisForResolution(deviceResolution(&Devices[d])) * 900);
+                }
+            }
+            bus->state = SIM_BUS_CONVERTING;
+            break;
+
+        case 0xBE:  // Read scratchpad
+            bus->state = SIM_BUS_READ_SCRATCHPAD;
+            break;
+
+        case 0x4E:  // Write scratchpad
+            bus->state = SIM_BUS_WRITE_SCRATCHPAD;
+            break;
+
+        case 0x48:  // Copy scratchpad
+            for(uint8_t d = 0; d < DeviceCount; d++)
+            {
+                if(Devices[d].selected)
+                {
+                    memcpy(Devices[d].eeprom, &Devices[d].scratchpad[2], 3);
+                }
+            }
+            bus->state = SIM_BUS_IDLE;
+            break;
+
+        case 0xB8:  // Recall EEPROM
+            for(uint8_t d = 0; d < DeviceCount; d++)
+            {
+                if(Devices[d].selected)
+                {
+                    memcpy(&Devices[d].scratchpad[2], Devices[d].eeprom, 3);
+                    updateScratchpadCrc(&Devices[d]);
+                }
+            }
+            bus->state = SIM_BUS_CONVERTING;    // Read slots report the recall complete
+            break;
+
+        default:    // Read power supply and unknown commands, devices drive nothing
+            bus->state = SIM_BUS_IDLE;
+            break;
+    }
+}
+
+/**
+ * @brief Handles a byte written by the driver
+ */
+static void byteWritten(SimBus_t *bus, uint8_t data)
+{
+    switch(bus->state)
+    {
+        case SIM_BUS_ROM_COMMAND:
+            if(data == 0xCC)        // Skip ROM
+            {
+                bus->state = SIM_BUS_FUNCTION_COMMAND;
+            }
+            else if(data == 0x55)   // Match ROM
+            {
+                bus->state = SIM_BUS_MATCH_ROM;
+            }
+            else if((data == 0xF0) || (data == 0xEC))   // Search, alarm search
+            {
+                for(uint8_t d = 0; d < DeviceCount; d++)
+                {
+                    updateConversion(&Devices[d]);
+                    Devices[d].selected &= (data == 0xF0) || Devices[d].alarm;
+                }
+                bus->state = SIM_BUS_SEARCH;
+            }
+            else
+            {
+                bus->state = SIM_BUS_IDLE;
+            }
+            break;
+
+        case SIM_BUS_FUNCTION_COMMAND:
+            functionCommand(bus, data);
+            break;
+
+        case SIM_BUS_WRITE_SCRATCHPAD:
+            for(uint8_t d = 0; d < DeviceCount; d++)
+            {
+                if(Devices[d].selected)
+                {
+                    Devices[d].scratchpad[2 + bus->byteCount] = (bus->byteCount == 2) ? ((data & 0x60) | 0x1F) : data;
+                    updateScratchpadCrc(&Devices[d]);
+                }
+            }
+            if(++bus->byteCount >= 3)
+            {
+                bus->state = SIM_BUS_IDLE;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+bool onewire_init(onewire_bus_t *wire, int gpio, int uart)
+{
+    SimBus_t *bus;
+
+    wire->gpio = gpio;
+    wire->uart = uart;
+    wire->baud = 0;
+
+    bus = getBus(wire);
+    if((bus == NULL) && (BusCount < SIM_ONEWIRE_MAX_BUSES))
+    {
+        bus = &Buses[BusCount++];
+        memset(bus, 0, sizeof(SimBus_t));
+        bus->gpio = gpio;
+    }
+
+    return bus != NULL;
+}
+
+bool onewire_reset(onewire_bus_t *wire)
+{
+    SimBus_t *bus = getBus(wire);
+    bool presence = false;
+
+    if(bus == NULL)
+    {
+        return false;
+    }
+
+    for(uint8_t d = 0; d < DeviceCount; d++)
+    {
+        SimDevice_t *device = &Devices[d];
+
+        if(device->gpio == bus->gpio)
+        {
+            updateConversion(device);
+            device->selected = devicePresent(device);
+            presence |= device->selected;
+        }
+        else
+        {
+            device->selected = false;
+        }
+    }
+
+    bus->state = presence ? SIM_BUS_ROM_COMMAND : SIM_BUS_IDLE;
+    bus->shift = 0;
+    bus->bitCount = 0;
+    bus->byteCount = 0;
+    bus->romBit = 0;
+    bus->searchSlot = 0;
+    return presence;
+}
+
+void onewire_write_bit(onewire_bus_t *wire, uint8_t bit)
+{
+    SimBus_t *bus = getBus(wire);
+
+    if(bus == NULL)
+    {
+        return;
+    }
+
+    if(bus->state == SIM_BUS_SEARCH)
+    {
+        // Direction bit, devices with the other bit drop out until the next reset
+        if(bus->searchSlot == 2)
+        {
+            for(uint8_t d = 0; d < DeviceCount; d++)
+            {
+                Devices[d].selected &= (romBit(&Devices[d], bus->romBit) == (bit & 1));
+            }
+            bus->searchSlot = 0;
+            if(++bus->romBit >= 64)
+            {
+                bus->state = SIM_BUS_FUNCTION_COMMAND;
+            }
+        }
+        return;
+    }
+
+    if(bus->state == SIM_BUS_MATCH_ROM)
+    {
+        for(uint8_t d = 0; d < DeviceCount; d++)
+        {
+            Devices[d].selected &= (romBit(&Devices[d], bus->romBit) == (bit & 1));
+        }
+        if(++bus->romBit >= 64)
+        {
+            bus->state = SIM_BUS_FUNCTION_COMMAND;
+        }
+        return;
+    }
+
+    bus->shift |= (bit & 1) << bus->bitCount;
+    if(++bus->bitCount >= 8)
+    {
+        uint8_t data = bus->shift;
+
+        bus->shift = 0;
+        bus->bitCount = 0;
+        byteWritten(bus, data);
+    }
+}
+
+uint8_t onewire_read_bit(onewire_bus_t *wire)
+{
+    SimBus_t *bus = getBus(wire);
+    uint8_t bit = 1;
+
+    if(bus == NULL)
+    {
+        return 1;
+    }
+
+    switch(bus->state)
+    {
+        case SIM_BUS_SEARCH:
+            // Every remaining device drives its ROM bit, then its complement
+            if(bus->searchSlot < 2)
+            {
+                for(uint8_t d = 0; d < DeviceCount; d++)
+                {
+                    if(Devices[d].selected)
+                    {
+                        bit &= romBit(&Devices[d], bus->romBit) ^ bus->searchSlot;
+                    }
+                }
+                bus->searchSlot++;
+            }
+            break;
+
+        case SIM_BUS_CONVERTING:
+            for(uint8_t d = 0; d < DeviceCount; d++)
+            {
+                updateConversion(&Devices[d]);
+                if(Devices[d].selected && Devices[d].converting)
+                {
+                    bit = 0;
+                }
+            }
+            break;
+
+        case SIM_BUS_READ_SCRATCHPAD:
+            if(bus->byteCount < 9)
+            {
+                for(uint8_t d = 0; d < DeviceCount; d++)
+                {
+                    if(Devices[d].selected)
+                    {
+                        updateConversion(&Devices[d]);
+                        bit &= (Devices[d].scratchpad[bus->byteCount] >> bus->bitCount) & 1;
+                    }
+                }
+                if(++bus->bitCount >= 8)
+                {
+                    bus->bitCount = 0;
+                    bus->byteCount++;
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return bit;
+}
+
+void onewire_write_byte(onewire_bus_t *wire, uint8_t data)
+{
+    for(int i = 0; i < 8; i++)
+    {
+        onewire_write_bit(wire, (data >> i) & 1);
+    }
+}
+
+uint8_t onewire_read_byte(onewire_bus_t *wire)
+{
+    uint8_t data = 0;
+
+    for(int i = 0; i < 8; i++)
+    {
+        data |= onewire_read_bit(wire) << i;
+    }
+    return data;
+}
@@ -0,0 +1,25 @@
+#pragma once
+/**
+ * @file onewireSim.h
+ *
+ * @brief
+ * Simulated 1-Wire buses with DS18B20 devices, in place of the GPIO and UART backends. Devices
+ * answer at bit level, so the unmodified ds18b20.c driver and its search, alarm search, partial
+ * reads and conversion polling run against them.
+ */
+
+// Standard Library Includes
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Max devices across all simulated buses */
+#define SIM_ONEWIRE_MAX_DEVICES 8
+
+/**
+ * Temperature of a device at a simulated time. Returns false while the device is disconnected,
+ * it then neither answers a reset nor drives the bus.
+ */
+typedef bool (*SimTempSource_t)(void *arg, int64_t timeUs, float *celsius);
+
+/* Public Function Prototypes */
+bool onewireSimAddDevice(int gpio, uint8_t serial, SimTempSource_t source, void *arg);
@@ -0,0 +1,468 @@
+/**
+ * @file pumpSim.c
+ *
+ * @brief
+ * Host simulator of the pump control loop. pumpControl.c, temperature.c and the DS18B20 driver
+ * run unmodified against simulated FreeRTOS, GPIO, NVS and 1-Wire layers while a temperature
+ * trace is replayed on simulated sensors, in simulated time. Reports the relay transitions,
+ * minimum run and off time violations and the host CPU time the tasks took.
+ *
+ * A trace is CSV with a header naming the sensor role of each column after the time:
+ *
+ *      seconds,ambient,water
+ *      0,4.5,8.0
+ *      60,4.4,
+ *
+ * Temperatures are C and interpolated between rows, an empty or nan value disconnects the
+ * sensor until the next row with a value. The sensors are found on the bus in role order and
+ * take their roles the way a board's sensors do on first boot, so a trace needs every role up to
+ * the last one it uses. Build and run from this directory with:
+ *
+ *      make && ./pumpSim [options] trace.csv
+ */
+
+// Project Includes
+#include "sim.h"
+#include "onewireSim.h"
+#include "ProjectConfig.h"
+#include "pumpControl.h"
+#include "temperature.h"
+
+// Stub Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_task.h"
+
+// Standard Library Includes
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_START "2023-12-01 00:00"
+#define LINE_LEN 512
+
+/* Replayed temperature trace */
+typedef struct
+{
+    double *seconds;
+    float *values[TEMP_SENSOR_ROLE_COUNT];
+    uint32_t rows;
+    uint32_t capacity;
+    uint8_t columns;
+    uint8_t roleColumn[TEMP_SENSOR_ROLE_COUNT];     // Column of each role, columns if none
+} Trace_t;
+
+/* Per sensor interpolation state, samples are requested in increasing time */
+typedef struct
+{
+    uint8_t column;
+    uint32_t row;
+} TraceCursor_t;
+
+/* Relay history */
+typedef struct
+{
+    uint32_t transitions;
+    uint32_t starts;
+    uint32_t violations;
+    int64_t runUs;
+    int64_t lastChangeUs;
+    uint32_t level;
+} RelayStats_t;
+
+extern const char * const TempSensorRoleNames[TEMP_SENSOR_ROLE_COUNT];
+extern uint32_t MinPumpRunTimeSec;
+extern uint32_t MinPumpOffTimeSec;
+
+Trace_t Trace;
+TraceCursor_t Cursors[TEMP_SENSOR_ROLE_COUNT];
+RelayStats_t Relay;
+bool Verbose = false;
+
+/**
+ * @brief Temperature of a trace column at a time, false if the sensor is disconnected
+ */
+static bool traceTemperature(void *arg, int64_t timeUs, float *celsius)
+{
+    TraceCursor_t *cursor = (TraceCursor_t *)arg;
+    double seconds = timeUs / 1e6;
+    const float *values = Trace.values[cursor->column];
+    uint32_t row = cursor->row;
+    double fraction;
+
+    // Conversions complete slightly out of order across buses, step back if needed
+    while((row > 0) && (Trace.seconds[row] > seconds))
+    {
+        row--;
+    }
+    while(((row + 1) < Trace.rows) && (Trace.seconds[row + 1] <= seconds))
+    {
+        row++;
+    }
+    cursor->row = row;
+
+    if(isnan(values[row]))
+    {
+        return false;
+    }
+
+    if(((row + 1) >= Trace.rows) || isnan(values[row + 1]) || (seconds <= Trace.seconds[row]))
+    {
+        *celsius = values[row];
+    }
+    else
+    {
+        fraction = (seconds - Trace.seconds[row]) / (Trace.seconds[row + 1] - Trace.seconds[row]);
+        *celsius = values[row] + (float)(fraction * (values[row + 1] - values[row]));
+    }
+
+    return true;
+}
+
+/**
+ * @brief Parses the header line, mapping columns to sensor roles
+ */
+static bool parseHeader(char *line)
+{
+    char *field = strtok(line, ",\r\n");
+
+    for(uint8_t r = 0; r < TEMP_SENSOR_ROLE_COUNT; r++)
+    {
+        Trace.roleColumn[r] = TEMP_SENSOR_ROLE_COUNT;
+    }
+
+    if((field == NULL) || (strcmp(field, "seconds") != 0))
+    {
+        fprintf(stderr, "Trace header must start with \"seconds\"\n");
+        return false;
+    }
+
+    while((field = strtok(NULL, ",\r\n")) != NULL)
+    {
+        uint8_t role;
+
+        for(role = 0; role < TEMP_SENSOR_ROLE_COUNT; role++)
+        {
+            if(strcmp(field, TempSensorRoleNames[role]) == 0)
+            {
+                break;
+            }
+        }
+
+        if((role == TEMP_SENSOR_ROLE_COUNT) || (Trace.roleColumn[role] != TEMP_SENSOR_ROLE_COUNT))
+        {
+            fprintf(stderr, "Unknown or repeated sensor role \"%s\"\n", field);
+            return false;
+        }
+
+        Trace.roleColumn[role] = Trace.columns++;
+    }
+
+    return Trace.columns != 0;
+}
+
+/**
+ * @brief Parses a row, fields without a number are disconnected samples
+ */
+static bool parseRow(char *line)
+{
+    char *cursor = line;
+    char *end;
+
+    if(Trace.rows == Trace.capacity)
+    {
+        Trace.capacity = (Trace.capacity == 0) ? 4096 : (Trace.capacity * 2);
+        Trace.seconds = realloc(Trace.seconds, Trace.capacity * sizeof(double));
+        for(uint8_t c = 0; c < Trace.columns; c++)
+        {
+            Trace.values[c] = realloc(Trace.values[c], Trace.capacity * sizeof(float));
+        }
+    }
+
+    Trace.seconds[Trace.rows] = strtod(cursor, &end);
+    if((end == cursor) || ((Trace.rows > 0) && (Trace.seconds[Trace.rows] <= Trace.seconds[Trace.rows - 1])))
+    {
+        return false;
+    }
+
+    for(uint8_t c = 0; c < Trace.columns; c++)
+    {
+        float value = NAN;
+
+        cursor = strchr(end, ',');
+        if(cursor != NULL)
+        {
+            cursor++;
+            value = strtof(cursor, &end);
+            if(end == cursor)
+            {
+                value = NAN;
+            }
+        }
+        else
+        {
+            end = cursor = "";
+        }
+
+        Trace.values[c][Trace.rows] = value;
+    }
+
+    Trace.rows++;
+    return true;
+}
+
+/**
+ * @brief Loads a trace file
+ */
+static bool loadTrace(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    char line[LINE_LEN];
+    uint32_t lineNumber = 1;
+
+    if(file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    if((fgets(line, sizeof(line), file) == NULL) || !parseHeader(line))
+    {
+        fclose(file);
+        return false;
+    }
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        lineNumber++;
+        if((line[0] == '\n') || (line[0] == '#'))
+        {
+            continue;
+        }
+        if(!parseRow(line))
+        {
+            fprintf(stderr, "%s:%u: bad or out of order row\n", path, lineNumber);
+            fclose(file);
+            return false;
+        }
+    }
+
+    fclose(file);
+    return Trace.rows >= 2;
+}
+
+/**
+ * @brief Formats a simulated time as local wall clock time
+ */
+static const char *wallClock(int64_t timeUs)
+{
+    static char buffer[32];
+    time_t now = SimEpoch + (time_t)(timeUs / 1000000);
+    struct tm timeInfo;
+
+    localtime_r(&now, &timeInfo);
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeInfo);
+    return buffer;
+}
+
+/**
+ * @brief Records pump relay transitions and checks them against the minimum run and off times
+ */
+static void gpioChanged(int gpio, uint32_t level)
+{
+    int64_t heldUs = SimTimeUs - Relay.lastChangeUs;
+    uint32_t minSec = level ? MinPumpOffTimeSec : MinPumpRunTimeSec;
+
+    if((gpio != PUMP_GPIO) || (level == Relay.level))
+    {
+        return;
+    }
+
+    if(heldUs < ((int64_t)minSec * 1000000))
+    {
+        Relay.violations++;
+        printf("%s Pump %s after %.1f s %s, minimum %u s\n", wallClock(SimTimeUs), level ? "started" : "stopped",
+               heldUs / 1e6, level ? "off" : "running", minSec);
+    }
+
+    if(Verbose)
+    {
+        printf("%s Pump %s", wallClock(SimTimeUs), level ? "ON " : "OFF");
+        for(uint8_t r = 0; r < TEMP_SENSOR_ROLE_COUNT; r++)
+        {
+            float celsius;
+
+            if(Trace.roleColumn[r] == TEMP_SENSOR_ROLE_COUNT)
+            {
+                continue;
+            }
+            if(traceTemperature(&Cursors[r], SimTimeUs, &celsius))
+            {
+                printf("  %s %.2f", TempSensorRoleNames[r], celsius);
+            }
+            else
+            {
+                printf("  %s --", TempSensorRoleNames[r]);
+            }
+        }
+        printf("\n");
+    }
+
+    Relay.runUs += level ? 0 : heldUs;
+    Relay.starts += level ? 1 : 0;
+    Relay.transitions++;
+    Relay.lastChangeUs = SimTimeUs;
+    Relay.level = level;
+}
+
+static void printTaskStats(const char *name, const SimTaskStats_t *stats, void *arg)
+{
+    double simulatedSec = *(double *)arg;
+
+    printf("%-12s %10u %14.2f %14.2f\n", name, stats->activations,
+           (stats->activations != 0) ? (stats->cpuNs / 1e3) / stats->activations : 0.0,
+           (stats->cpuNs / 1e3) / simulatedSec);
+}
+
+static double wallNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] trace.csv\n"
+            "  -s \"YYYY-MM-DD HH:MM\"  Local time of the first row (default " DEFAULT_START ")\n"
+            "  -a C      Minimum ambient temperature\n"
+            "  -A C      Ambient temperature hysteresis\n"
+            "  -w C      Minimum water temperature\n"
+            "  -W C      Water temperature hysteresis\n"
+            "  -p sec    Prediction horizon, 0 disables prediction\n"
+            "  -v        Print each relay transition\n"
+            "  -l E|W|I|D  Firmware log level (default W)\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static const TempBusConfig_t busConfigs[] = TEMP_SENSOR_BUSES;
+    const char *start = DEFAULT_START;
+    struct tm startInfo = { 0 };
+    float settings[4] = { 0 };
+    bool settingSet[4] = { false };
+    long horizonSec = -1;
+    double simulatedSec;
+    double startNs;
+    double elapsedSec;
+    int64_t endUs;
+    int option;
+
+    while((option = getopt(argc, argv, "s:a:A:w:W:p:vl:")) != -1)
+    {
+        switch(option)
+        {
+            case 's': start = optarg; break;
+            case 'a': settings[0] = strtof(optarg, NULL); settingSet[0] = true; break;
+            case 'A': settings[1] = strtof(optarg, NULL); settingSet[1] = true; break;
+            case 'w': settings[2] = strtof(optarg, NULL); settingSet[2] = true; break;
+            case 'W': settings[3] = strtof(optarg, NULL); settingSet[3] = true; break;
+            case 'p': horizonSec = strtol(optarg, NULL, 10); break;
+            case 'v': Verbose = true; break;
+            case 'l': SimLogLevel = optarg[0]; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if(optind != (argc - 1))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    setenv("TZ", TIMEZONE, 1);
+    tzset();
+
+    if(sscanf(start, "%d-%d-%d %d:%d", &startInfo.tm_year, &startInfo.tm_mon, &startInfo.tm_mday,
+              &startInfo.tm_hour, &startInfo.tm_min) != 5)
+    {
+        fprintf(stderr, "Bad start time \"%s\"\n", start);
+        return 2;
+    }
+    startInfo.tm_year -= 1900;
+    startInfo.tm_mon -= 1;
+    startInfo.tm_isdst = -1;
+    SimEpoch = mktime(&startInfo);
+
+    if(!loadTrace(argv[optind]))
+    {
+        fprintf(stderr, "No trace loaded from %s\n", argv[optind]);
+        return 1;
+    }
+
+    // Sensors in role order, all on the first bus
+    for(uint8_t r = 0; r < TEMP_SENSOR_ROLE_COUNT; r++)
+    {
+        if(Trace.roleColumn[r] == TEMP_SENSOR_ROLE_COUNT)
+        {
+            continue;
+        }
+        for(uint8_t earlier = 0; earlier < r; earlier++)
+        {
+            if(Trace.roleColumn[earlier] == TEMP_SENSOR_ROLE_COUNT)
+            {
+                fprintf(stderr, "Trace has \"%s\" without \"%s\", it would take that role\n",
+                        TempSensorRoleNames[r], TempSensorRoleNames[earlier]);
+                return 1;
+            }
+        }
+
+        Cursors[r].column = Trace.roleColumn[r];
+        onewireSimAddDevice(busConfigs[0].gpio, r + 1, traceTemperature, &Cursors[r]);
+    }
+
+    // Boot as app_main() does
+    simSetGpioCallback(gpioChanged);
+    configureTempSensors();
+    PumpControlInit();
+
+    if(settingSet[0]) SetMinAmbientTemperature(tempCToFixed(settings[0]));
+    if(settingSet[1]) SetAmbientTempHysteresis(tempCToFixed(settings[1]));
+    if(settingSet[2]) SetMinWaterTemperature(tempCToFixed(settings[2]));
+    if(settingSet[3]) SetWaterTempHysteresis(tempCToFixed(settings[3]));
+    if(horizonSec >= 0) SetPredictHorizonSec((uint32_t)horizonSec);
+
+    xTaskCreate(&PumpControlTask, "Pump Ctrl", ESP_TASK_MAIN_STACK, NULL, 0, NULL);
+
+    endUs = (int64_t)(Trace.seconds[Trace.rows - 1] * 1e6);
+    startNs = wallNs();
+    simRun(endUs);
+    elapsedSec = (wallNs() - startNs) / 1e9;
+    simulatedSec = endUs / 1e6;
+
+    Relay.runUs += Relay.level ? (SimTimeUs - Relay.lastChangeUs) : 0;
+
+    printf("\n%s: %u rows, %.1f days from %s\n", argv[optind], Trace.rows, simulatedSec / 86400.0, wallClock(0));
+    printf("Ambient min %.2f C hysteresis %.2f C, water min %.2f C hysteresis %.2f C, horizon %u s, "
+           "min run %u s, min off %u s\n",
+           tempFixedToC(GetMinAmbientTemperature()), tempFixedToC(GetAmbientTempHysteresis()),
+           tempFixedToC(GetMinWaterTemperature()), tempFixedToC(GetWaterTempHysteresis()),
+           GetPredictHorizonSec(), MinPumpRunTimeSec, MinPumpOffTimeSec);
+    printf("Relay transitions: %u (%u starts), run time %.1f h (%.1f%%)\n", Relay.transitions, Relay.starts,
+           Relay.runUs / 3.6e9, (100.0 * Relay.runUs) / endUs);
+    printf("Minimum time violations: %u\n\n", Relay.violations);
+
+    printf("%-12s %10s %14s %14s\n", "Task", "Runs", "CPU us/run", "CPU us/sim s");
+    simForEachTask(printTaskStats, &simulatedSec);
+
+    printf("\nSimulated %.0f s in %.2f s, %.0fx real time\n", simulatedSec, elapsedSec,
+           (elapsedSec > 0) ? simulatedSec / elapsedSec : 0.0);
+
+    return (Relay.violations != 0);
+}
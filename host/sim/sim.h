@@ -0,0 +1,37 @@
+#pragma once
+/**
+ * @file sim.h
+ *
+ * @brief
+ * Interface between the host simulator's platform layers and its main program
+ */
+
+// Standard Library Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* CPU use of a simulated task */
+typedef struct
+{
+    double cpuNs;           // Host CPU time spent running the task
+    uint32_t activations;   // Times the task ran until it blocked
+} SimTaskStats_t;
+
+/* Simulated time since boot, what esp_timer_get_time() returns */
+extern int64_t SimTimeUs;
+
+/* Wall clock time at boot */
+extern time_t SimEpoch;
+
+/* Log level shown, 'E', 'W', 'I' or 'D' */
+extern char SimLogLevel;
+
+/* Scheduler */
+void simRun(int64_t endUs);
+bool simGetTaskStats(const char *name, SimTaskStats_t *stats);
+void simForEachTask(void (*function)(const char *name, const SimTaskStats_t *stats, void *arg), void *arg);
+
+/* GPIO, called when an output changes level */
+typedef void (*SimGpioCallback_t)(int gpio, uint32_t level);
+void simSetGpioCallback(SimGpioCallback_t callback);
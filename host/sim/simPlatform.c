@@ -0,0 +1,303 @@
+/**
+ * @file simPlatform.c
+ *
+ * @brief
+ * Simulated logging, GPIO, NVS and system time for the host simulator
+ */
+
+// Project Includes
+#include "sim.h"
+#include "sysTime.h"
+
+// Stub Includes
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "driver/gpio.h"
+
+// Standard Library Includes
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_NVS_MAX_BLOBS 16
+#define SIM_NVS_MAX_HANDLES 8
+#define SIM_NVS_NAME_LEN 16
+
+/* In memory NVS blob */
+typedef struct
+{
+    char space[SIM_NVS_NAME_LEN];
+    char key[SIM_NVS_NAME_LEN];
+    void *value;
+    size_t length;
+} SimNvsBlob_t;
+
+/* Open NVS handle */
+typedef struct
+{
+    bool open;
+    bool writable;
+    char space[SIM_NVS_NAME_LEN];
+} SimNvsHandle_t;
+
+char SimLogLevel = 'W';
+
+SimGpioCallback_t GpioCallback = NULL;
+
+SimNvsBlob_t NvsBlobs[SIM_NVS_MAX_BLOBS];
+SimNvsHandle_t NvsHandles[SIM_NVS_MAX_HANDLES];
+
+static int logRank(char level)
+{
+    switch(level)
+    {
+        case 'E': return 0;
+        case 'W': return 1;
+        case 'I': return 2;
+        default:  return 3;
+    }
+}
+
+void simLog(char level, const char *tag, const char *format, ...)
+{
+    va_list args;
+
+    if(logRank(level) > logRank(SimLogLevel))
+    {
+        return;
+    }
+
+    printf("%c (%10.3f) %s: ", level, SimTimeUs / 1e6, tag);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch(code)
+    {
+        case ESP_OK:                return "ESP_OK";
+        case ESP_FAIL:              return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_INVALID_CRC:   return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        default:                    return "UNKNOWN ERROR";
+    }
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+
+    if(size != 0)
+    {
+        size_t copy = (length < size) ? length : (size - 1);
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+
+    return length;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while(len--)
+    {
+        crc ^= *buf++;
+        for(int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+/*
+ * System time, the simulated clock is always set
+ */
+
+bool isTimeSet()
+{
+    return true;
+}
+
+/*
+ * GPIO
+ */
+
+/**
+ * @brief
+ * Sets the function called when an output changes level
+ */
+void simSetGpioCallback(SimGpioCallback_t callback)
+{
+    GpioCallback = callback;
+}
+
+void gpio_pad_select_gpio(uint8_t gpio)
+{
+    (void)gpio;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode)
+{
+    (void)gpio;
+    (void)mode;
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+    if(GpioCallback != NULL)
+    {
+        GpioCallback(gpio, level);
+    }
+    return ESP_OK;
+}
+
+/*
+ * NVS
+ */
+
+static SimNvsBlob_t *findBlob(const char *space, const char *key)
+{
+    for(int i = 0; i < SIM_NVS_MAX_BLOBS; i++)
+    {
+        if((NvsBlobs[i].value != NULL) && (strcmp(NvsBlobs[i].space, space) == 0) && (strcmp(NvsBlobs[i].key, key) == 0))
+        {
+            return &NvsBlobs[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t openMode, nvs_handle_t *handle)
+{
+    bool exists = false;
+
+    for(int i = 0; i < SIM_NVS_MAX_BLOBS; i++)
+    {
+        exists |= (NvsBlobs[i].value != NULL) && (strcmp(NvsBlobs[i].space, name) == 0);
+    }
+
+    // As on the device, a namespace that was never written can't be opened read only
+    if(!exists && (openMode == NVS_READONLY))
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    for(int i = 0; i < SIM_NVS_MAX_HANDLES; i++)
+    {
+        if(!NvsHandles[i].open)
+        {
+            NvsHandles[i].open = true;
+            NvsHandles[i].writable = (openMode == NVS_READWRITE);
+            strlcpy(NvsHandles[i].space, name, sizeof(NvsHandles[i].space));
+            *handle = i + 1;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NO_MEM;
+}
+
+static SimNvsHandle_t *getHandle(nvs_handle_t handle)
+{
+    if((handle == 0) || (handle > SIM_NVS_MAX_HANDLES) || !NvsHandles[handle - 1].open)
+    {
+        return NULL;
+    }
+    return &NvsHandles[handle - 1];
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+    SimNvsHandle_t *open = getHandle(handle);
+    SimNvsBlob_t *blob;
+
+    if(open == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    blob = findBlob(open->space, key);
+    if(blob == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    if(value == NULL)
+    {
+        *length = blob->length;
+        return ESP_OK;
+    }
+    if(*length < blob->length)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(value, blob->value, blob->length);
+    *length = blob->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    SimNvsHandle_t *open = getHandle(handle);
+    SimNvsBlob_t *blob;
+
+    if((open == NULL) || !open->writable)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    blob = findBlob(open->space, key);
+    for(int i = 0; (blob == NULL) && (i < SIM_NVS_MAX_BLOBS); i++)
+    {
+        if(NvsBlobs[i].value == NULL)
+        {
+            blob = &NvsBlobs[i];
+            strlcpy(blob->space, open->space, sizeof(blob->space));
+            strlcpy(blob->key, key, sizeof(blob->key));
+        }
+    }
+    if(blob == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    free(blob->value);
+    blob->value = malloc(length);
+    if(blob->value == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(blob->value, value, length);
+    blob->length = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return (getHandle(handle) != NULL) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    SimNvsHandle_t *open = getHandle(handle);
+
+    if(open != NULL)
+    {
+        open->open = false;
+    }
+}
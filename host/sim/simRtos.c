@@ -0,0 +1,522 @@
+/**
+ * @file simRtos.c
+ *
+ * @brief
+ * Simulated time FreeRTOS tasks, task notifications, software timers and esp_timer.
+ *
+ * Each task runs on its own ucontext stack and only gives up the CPU when it blocks, so only
+ * one task runs at a time and critical sections need no locking. When no task is ready the
+ * scheduler jumps simulated time to the earliest task wake up or timer expiry and runs the
+ * timer callbacks due, as the timer service and esp_timer tasks would. Nothing waits in real
+ * time, a run is as fast as the firmware code it executes.
+ */
+
+// Project Includes
+#include "sim.h"
+
+// Stub Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
+
+// Standard Library Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+
+#define SIM_TICK_US (1000000 / configTICK_RATE_HZ)
+#define SIM_TASK_STACK_BYTES (256 * 1024)
+#define SIM_FOREVER INT64_MAX
+
+/* Simulated task */
+struct SimTask
+{
+    ucontext_t context;
+    void *stack;
+    TaskFunction_t function;
+    void *parameters;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    int64_t wakeUs;             // Blocked until, SIM_FOREVER for no timeout
+    bool waitingNotify;         // Blocked in xTaskNotifyWait(), a notification also wakes it
+    bool notifyPending;
+    uint32_t notifyValue;
+    SimTaskStats_t stats;
+    struct SimTask *next;
+};
+
+/* esp_timer */
+struct SimEspTimer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    bool active;
+    int64_t expiryUs;
+    struct SimEspTimer *next;
+};
+
+int64_t SimTimeUs = 0;
+time_t SimEpoch = 0;
+
+struct SimTask *Tasks = NULL;
+struct SimTask *CurrentTask = NULL;
+ucontext_t SchedulerContext;
+
+StaticTimer_t *Timers = NULL;
+struct SimEspTimer *EspTimers = NULL;
+
+static double cpuNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static inline int64_t ticksToUs(TickType_t ticks)
+{
+    return (int64_t)ticks * SIM_TICK_US;
+}
+
+/**
+ * @brief Start of the tick the simulation is in, timeouts count whole ticks from it as on FreeRTOS
+ */
+static inline int64_t tickStartUs()
+{
+    return (SimTimeUs / SIM_TICK_US) * SIM_TICK_US;
+}
+
+/**
+ * @brief Entry point of a task context
+ */
+static void taskEntry()
+{
+    CurrentTask->function(CurrentTask->parameters);
+
+    // FreeRTOS tasks must not return, treat it as deleting itself
+    CurrentTask->wakeUs = SIM_FOREVER;
+    CurrentTask->waitingNotify = false;
+    swapcontext(&CurrentTask->context, &SchedulerContext);
+}
+
+/**
+ * @brief Blocks the running task until wakeUs or, when waitNotify is set, a notification
+ */
+static void blockCurrentTask(int64_t wakeUs, bool waitNotify)
+{
+    struct SimTask *task = CurrentTask;
+
+    if(task == NULL)
+    {
+        fprintf(stderr, "Blocking call outside of a task\n");
+        abort();
+    }
+
+    task->wakeUs = wakeUs;
+    task->waitingNotify = waitNotify;
+    swapcontext(&task->context, &SchedulerContext);
+}
+
+static inline bool taskReady(const struct SimTask *task)
+{
+    return (task->wakeUs <= SimTimeUs) || (task->waitingNotify && task->notifyPending);
+}
+
+/**
+ * @brief Ready task with the highest priority, the longest waiting one among equals
+ */
+static struct SimTask *nextReadyTask()
+{
+    struct SimTask *best = NULL;
+
+    for(struct SimTask *task = Tasks; task != NULL; task = task->next)
+    {
+        if(taskReady(task) &&
+           ((best == NULL) || (task->priority > best->priority) ||
+            ((task->priority == best->priority) && (task->wakeUs < best->wakeUs))))
+        {
+            best = task;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Earliest time a task wakes or a timer expires
+ */
+static int64_t nextEventUs()
+{
+    int64_t next = SIM_FOREVER;
+
+    for(struct SimTask *task = Tasks; task != NULL; task = task->next)
+    {
+        next = (task->wakeUs < next) ? task->wakeUs : next;
+    }
+    for(StaticTimer_t *timer = Timers; timer != NULL; timer = timer->next)
+    {
+        next = (timer->active && (timer->expiryUs < next)) ? timer->expiryUs : next;
+    }
+    for(struct SimEspTimer *timer = EspTimers; timer != NULL; timer = timer->next)
+    {
+        next = (timer->active && (timer->expiryUs < next)) ? timer->expiryUs : next;
+    }
+
+    return next;
+}
+
+/**
+ * @brief Runs the callbacks of the timers that have expired
+ */
+static void runExpiredTimers()
+{
+    for(StaticTimer_t *timer = Timers; timer != NULL; timer = timer->next)
+    {
+        if(timer->active && (timer->expiryUs <= SimTimeUs))
+        {
+            timer->active = timer->autoReload;
+            timer->expiryUs += ticksToUs(timer->period);
+            timer->callback(timer);
+        }
+    }
+    for(struct SimEspTimer *timer = EspTimers; timer != NULL; timer = timer->next)
+    {
+        if(timer->active && (timer->expiryUs <= SimTimeUs))
+        {
+            timer->active = false;
+            timer->callback(timer->arg);
+        }
+    }
+}
+
+/**
+ * @brief
+ * Runs the tasks until the simulated time reaches endUs
+ *
+ * @param endUs Simulated time since boot to stop at
+ */
+void simRun(int64_t endUs)
+{
+    struct SimTask *task;
+    double startNs;
+    int64_t next;
+
+    while(true)
+    {
+        task = nextReadyTask();
+        if(task != NULL)
+        {
+            task->wakeUs = SIM_FOREVER;
+            CurrentTask = task;
+            startNs = cpuNs();
+            swapcontext(&SchedulerContext, &task->context);
+            task->stats.cpuNs += cpuNs() - startNs;
+            task->stats.activations++;
+            CurrentTask = NULL;
+            continue;
+        }
+
+        next = nextEventUs();
+        if(next > endUs)
+        {
+            SimTimeUs = endUs;
+            return;
+        }
+
+        SimTimeUs = (next > SimTimeUs) ? next : SimTimeUs;
+        runExpiredTimers();
+    }
+}
+
+/**
+ * @brief
+ * Gets the CPU use of a task
+ *
+ * @param name Task name
+ * @param stats Filled with the task's statistics
+ * @return true if the task exists
+ */
+bool simGetTaskStats(const char *name, SimTaskStats_t *stats)
+{
+    for(struct SimTask *task = Tasks; task != NULL; task = task->next)
+    {
+        if(strcmp(task->name, name) == 0)
+        {
+            *stats = task->stats;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief
+ * Calls a function for each task, in creation order
+ */
+void simForEachTask(void (*function)(const char *name, const SimTaskStats_t *stats, void *arg), void *arg)
+{
+    for(struct SimTask *task = Tasks; task != NULL; task = task->next)
+    {
+        function(task->name, &task->stats, arg);
+    }
+}
+
+/*
+ * FreeRTOS tasks
+ */
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    struct SimTask *task = calloc(1, sizeof(struct SimTask));
+    struct SimTask **tail = &Tasks;
+
+    (void)stackDepth;   // Host code needs far more stack than the firmware, all tasks get the same
+
+    if(task == NULL)
+    {
+        return pdFAIL;
+    }
+
+    task->stack = malloc(SIM_TASK_STACK_BYTES);
+    if(task->stack == NULL)
+    {
+        free(task);
+        return pdFAIL;
+    }
+
+    task->function = function;
+    task->parameters = parameters;
+    task->priority = priority;
+    task->wakeUs = SimTimeUs;
+    snprintf(task->name, sizeof(task->name), "%s", name);
+
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = SIM_TASK_STACK_BYTES;
+    task->context.uc_link = NULL;
+    makecontext(&task->context, taskEntry, 0);
+
+    while(*tail != NULL)
+    {
+        tail = &(*tail)->next;
+    }
+    *tail = task;
+
+    if(handle != NULL)
+    {
+        *handle = task;
+    }
+
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return CurrentTask;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(SimTimeUs / SIM_TICK_US);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    blockCurrentTask(tickStartUs() + ticksToUs(ticks), false);
+}
+
+void vTaskDelayUntil(TickType_t *previousWakeTime, TickType_t increment)
+{
+    int32_t ahead;
+
+    *previousWakeTime += increment;
+    ahead = (int32_t)(*previousWakeTime - xTaskGetTickCount());
+
+    // A wake time already passed only yields, as on FreeRTOS
+    blockCurrentTask((ahead > 0) ? (tickStartUs() + ticksToUs(ahead)) : SimTimeUs, false);
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t result = pdPASS;
+
+    switch(action)
+    {
+        case eNoAction:
+            break;
+        case eSetBits:
+            task->notifyValue |= value;
+            break;
+        case eIncrement:
+            task->notifyValue++;
+            break;
+        case eSetValueWithOverwrite:
+            task->notifyValue = value;
+            break;
+        case eSetValueWithoutOverwrite:
+            if(task->notifyPending)
+            {
+                result = pdFAIL;
+            }
+            else
+            {
+                task->notifyValue = value;
+            }
+            break;
+    }
+
+    task->notifyPending = true;
+    return result;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t ticksToWait)
+{
+    struct SimTask *task = CurrentTask;
+
+    if(!task->notifyPending)
+    {
+        task->notifyValue &= ~clearOnEntry;
+        if(ticksToWait != 0)
+        {
+            blockCurrentTask((ticksToWait == portMAX_DELAY) ? SIM_FOREVER : (tickStartUs() + ticksToUs(ticksToWait)), true);
+        }
+    }
+
+    task->waitingNotify = false;
+    if(value != NULL)
+    {
+        *value = task->notifyValue;
+    }
+    if(!task->notifyPending)
+    {
+        return pdFALSE;
+    }
+
+    task->notifyValue &= ~clearOnExit;
+    task->notifyPending = false;
+    return pdTRUE;
+}
+
+/*
+ * FreeRTOS software timers
+ */
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t autoReload, void *id,
+                                 TimerCallbackFunction_t callback, StaticTimer_t *buffer)
+{
+    memset(buffer, 0, sizeof(StaticTimer_t));
+    buffer->name = name;
+    buffer->period = period;
+    buffer->autoReload = autoReload;
+    buffer->id = id;
+    buffer->callback = callback;
+
+    buffer->next = Timers;
+    Timers = buffer;
+    return buffer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    (void)ticksToWait;
+    timer->expiryUs = tickStartUs() + ticksToUs(timer->period);
+    timer->active = true;
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticksToWait)
+{
+    (void)ticksToWait;
+    timer->active = false;
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticksToWait)
+{
+    timer->period = period;
+    return xTimerStart(timer, ticksToWait);
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
+
+/*
+ * esp_timer
+ */
+
+int64_t esp_timer_get_time(void)
+{
+    return SimTimeUs;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    struct SimEspTimer *timer = calloc(1, sizeof(struct SimEspTimer));
+
+    if(timer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    timer->next = EspTimers;
+    EspTimers = timer;
+
+    *handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs)
+{
+    if(timer->active)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->expiryUs = SimTimeUs + (int64_t)timeoutUs;
+    timer->active = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if(!timer->active)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->active = false;
+    return ESP_OK;
+}
+
+/*
+ * Wall clock. The firmware's time() and gettimeofday() calls see the simulated time, offset
+ * by the start of the trace.
+ */
+
+time_t time(time_t *t)
+{
+    time_t now = SimEpoch + (time_t)(SimTimeUs / 1000000);
+
+    if(t != NULL)
+    {
+        *t = now;
+    }
+    return now;
+}
+
+int gettimeofday(struct timeval *restrict tv, void *restrict tz)
+{
+    (void)tz;
+    tv->tv_sec = SimEpoch + (time_t)(SimTimeUs / 1000000);
+    tv->tv_usec = (suseconds_t)(SimTimeUs % 1000000);
+    return 0;
+}
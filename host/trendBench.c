@@ -0,0 +1,321 @@
+/**
+ * @file trendBench.c
+ *
+ * @brief
+ * Host replay benchmark of the temperature trend predictor. Runs the ambient freeze protection
+ * of pumpControl.c over night time temperature traces, reactive and with prediction, and
+ * reports the pump cycles saved, the time spent below the minimum with the pump off and how often
+ * the pump was already running when the temperature first dropped below the minimum. Build
+ * and run from the repository root with:
+ *
+ *      gcc -O2 -Imain host/trendBench.c main/trend.c -lm -o trendBench && ./trendBench [trace.csv]
+ *
+ * A trace file has one "seconds,temperature" sample per line, or is a host/sim trace with a
+ * "seconds,ambient,..." header, of which the ambient column is replayed. Without one, synthetic
+ * nights are generated: a falling baseline with slow cloud/wind swings, sensor noise and the 0.5 step
+ * of a 9 bit reading, bottoming out around the minimum.
+ */
+
+#include "trend.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FIXED_SCALE 128
+#define FIXED(x) ((int32_t)((x) * FIXED_SCALE))
+
+/* pumpControl.c defaults */
+#define MIN_AMBIENT FIXED(38.0)
+#define AMBIENT_HYSTERESIS FIXED(2.0)
+#define MIN_RUN_SEC (15 * 60)
+#define MIN_OFF_SEC (2 * 60)
+
+/* Prediction horizon compared with reactive control, PUMP_PREDICT_HORIZON_SEC is off by default */
+#define HORIZON_SEC (10 * 60)
+
+/* TEMP_SAMPLE_PERIOD_MS */
+#define SAMPLE_PERIOD_SEC 5
+#define NIGHT_SEC (14 * 3600)
+#define NIGHTS 60
+#define MAX_SAMPLES (NIGHT_SEC / SAMPLE_PERIOD_SEC)
+#define LINE_LEN 512
+
+typedef struct
+{
+    uint32_t starts;
+    uint32_t runSec;
+    uint32_t unprotectedSec;    // Below the minimum with the pump off
+    uint32_t crossings;         // Nights the temperature dropped below the minimum
+    uint32_t earlyCrossings;    // Of them, the pump was already running when it did
+    uint64_t predictNs;
+    uint32_t predictions;
+} ReplayResult_t;
+
+static int32_t *Trace;
+static int TraceCapacity;
+
+static double nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static double gaussian()
+{
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/**
+ * @brief Generates a night: cooling from dusk to a low before dawn, then warming
+ */
+static int generateNight(int night)
+{
+    double low = 34.0 + (night % 10);               // Lows from well below to above the minimum
+    double start = low + 10.0 + (rand() % 5);
+    double swing = 0.5 + ((rand() % 20) / 10.0);    // Cloud and wind swings
+    double swingPeriod = 1800.0 + (rand() % 3600);
+    double dawn = NIGHT_SEC - (3 * 3600);
+    double t;
+    double c;
+
+    for(int i = 0; i < MAX_SAMPLES; i++)
+    {
+        t = i * SAMPLE_PERIOD_SEC;
+        c = (t < dawn) ? low + ((start - low) * exp(-t / (0.3 * dawn))) : low + (3.0 * (t - dawn) / 3600.0);
+        c += swing * sin(2.0 * M_PI * t / swingPeriod);
+        c += 0.1 * gaussian();
+        Trace[i] = (int32_t)(floor(c * 2.0) * (FIXED_SCALE / 2));
+    }
+
+    return MAX_SAMPLES;
+}
+
+/**
+ * @brief Grows the trace to hold count samples
+ */
+static bool reserveTrace(int count)
+{
+    int32_t *grown;
+    int capacity = (TraceCapacity > 0) ? TraceCapacity : MAX_SAMPLES;
+
+    if(count <= TraceCapacity)
+    {
+        return true;
+    }
+
+    while(capacity < count)
+    {
+        capacity *= 2;
+    }
+
+    grown = realloc(Trace, capacity * sizeof(int32_t));
+    if(grown == NULL)
+    {
+        return false;
+    }
+
+    Trace = grown;
+    TraceCapacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Finds the column to replay from a header line, the ambient column or else the first
+ * after the time
+ */
+static int traceColumn(char *header)
+{
+    int column = 0;
+
+    for(char *field = strtok(header, ",\r\n"); field != NULL; field = strtok(NULL, ",\r\n"))
+    {
+        if(strcmp(field, "ambient") == 0)
+        {
+            return column;
+        }
+        column++;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Loads a trace, resampled to the sample period. An empty value, a disconnected sensor,
+ * holds the previous temperature.
+ */
+static int loadTrace(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    char line[LINE_LEN];
+    char *field;
+    char *end;
+    double seconds;
+    double temperature = NAN;
+    double value;
+    int column = 1;
+    int count = 0;
+
+    if(file == NULL)
+    {
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        seconds = strtod(line, &end);
+        if(end == line)
+        {
+            if(count == 0)
+            {
+                column = traceColumn(line);
+            }
+            continue;
+        }
+
+        field = line;
+        for(int c = 0; (c < column) && (field != NULL); c++)
+        {
+            field = strchr(field, ',');
+            field = (field != NULL) ? field + 1 : NULL;
+        }
+
+        if(field != NULL)
+        {
+            value = strtod(field, &end);
+            temperature = (end != field) ? value : temperature;
+        }
+
+        // Nothing to replay until the first temperature
+        if(isnan(temperature))
+        {
+            continue;
+        }
+
+        while((count * SAMPLE_PERIOD_SEC) <= seconds)
+        {
+            if(!reserveTrace(count + 1))
+            {
+                fclose(file);
+                return count;
+            }
+            Trace[count++] = FIXED(temperature);
+        }
+    }
+
+    fclose(file);
+    return count;
+}
+
+/**
+ * @brief Runs the ambient logic of temperatureControlLogic() and the pump's minimum times over a trace
+ */
+static void replay(int count, uint32_t horizonSec, ReplayResult_t *result)
+{
+    TempTrend_t trend;
+    bool pump = false;
+    bool commanded = false;
+    int32_t stateSec = MIN_OFF_SEC;
+    int32_t temperature;
+    int32_t predicted;
+    int16_t projected;
+    int16_t fitted;
+    bool falling;
+    bool crossed = false;
+    double startNs;
+
+    trendReset(&trend);
+
+    for(int i = 0; i < count; i++)
+    {
+        temperature = Trace[i];
+        predicted = temperature;
+        falling = false;
+
+        startNs = nowNs();
+        trendAddSample(&trend, (int64_t)i * SAMPLE_PERIOD_SEC * 1000000, temperature);
+        if((horizonSec != 0) && trendProject(&trend, horizonSec, &projected))
+        {
+            trendProject(&trend, 0, &fitted);
+            falling = (projected < fitted);
+            predicted = (projected < temperature) ? projected : temperature;
+        }
+        result->predictNs += nowNs() - startNs;
+        result->predictions++;
+
+        if(!crossed && (temperature < MIN_AMBIENT))
+        {
+            crossed = true;
+            result->crossings++;
+            result->earlyCrossings += pump;
+        }
+
+        if(!pump && ((temperature < MIN_AMBIENT) ||
+                     ((predicted < MIN_AMBIENT) && (temperature < (MIN_AMBIENT + AMBIENT_HYSTERESIS)))))
+        {
+            commanded = true;
+        }
+        else if(pump && (temperature > (MIN_AMBIENT + AMBIENT_HYSTERESIS)) && !falling)
+        {
+            commanded = false;
+        }
+
+        if((commanded != pump) && (stateSec >= (pump ? MIN_RUN_SEC : MIN_OFF_SEC)))
+        {
+            pump = commanded;
+            stateSec = 0;
+            result->starts += pump;
+        }
+
+        stateSec += SAMPLE_PERIOD_SEC;
+        result->runSec += pump ? SAMPLE_PERIOD_SEC : 0;
+        result->unprotectedSec += (!pump && (temperature < MIN_AMBIENT)) ? SAMPLE_PERIOD_SEC : 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    ReplayResult_t reactive = { 0 };
+    ReplayResult_t predictive = { 0 };
+    int nights = (argc > 1) ? 1 : NIGHTS;
+    int count;
+
+    srand(1);
+
+    if(!reserveTrace(MAX_SAMPLES))
+    {
+        printf("No memory for the trace\n");
+        return 1;
+    }
+
+    for(int night = 0; night < nights; night++)
+    {
+        count = (argc > 1) ? loadTrace(argv[1]) : generateNight(night);
+        if(count == 0)
+        {
+            printf("No samples in %s\n", argv[1]);
+            return 1;
+        }
+
+        replay(count, 0, &reactive);
+        replay(count, HORIZON_SEC, &predictive);
+    }
+
+    printf("%d night(s), minimum %.1f, hysteresis %.1f, %d min horizon\n", nights,
+           (double)MIN_AMBIENT / FIXED_SCALE, (double)AMBIENT_HYSTERESIS / FIXED_SCALE, HORIZON_SEC / 60);
+    printf("%-12s %8s %10s %16s %14s\n", "", "Starts", "Run (h)", "Unprotected (m)", "Early starts");
+    printf("%-12s %8u %10.1f %16.1f %8u / %u\n", "Reactive", reactive.starts, reactive.runSec / 3600.0,
+           reactive.unprotectedSec / 60.0, reactive.earlyCrossings, reactive.crossings);
+    printf("%-12s %8u %10.1f %16.1f %8u / %u\n", "Predictive", predictive.starts, predictive.runSec / 3600.0,
+           predictive.unprotectedSec / 60.0, predictive.earlyCrossings, predictive.crossings);
+    printf("Cycles saved: %d (%.0f%%)\n", (int)reactive.starts - (int)predictive.starts,
+           (reactive.starts > 0) ? (100.0 * ((int)reactive.starts - (int)predictive.starts)) / reactive.starts : 0.0);
+    printf("Predictor: %.0f ns per sample\n", (double)predictive.predictNs / predictive.predictions);
+
+    return 0;
+}
@@ -18,14 +18,35 @@
 // Time
 #define TIMEZONE "EST5EDT,M3.2.0/2,M11.1.0"
 
+// Pump Control, start the pump early when a temperature is projected to drop below its minimum
+// within this horizon. 0 disables prediction. Off until it is tuned on recorded traces, on the
+// synthetic nights of host/trendBench.c a 10 minute horizon saves 8% of starts but runs the pump
+// 11% longer, with no time unprotected either way.
+#define PUMP_PREDICT_HORIZON_SEC 0
+
+// Pump Rules, the pump runs while any rule is true. See rules.h for the syntax and an example.
+// Rules can use the temperature sensor names (C), hour, minute, weekday (0 = Sunday), pump (1 while
+// running) and the minAmbient, ambientHyst, minWater and waterHyst settings. Empty runs no rules.
+#define PUMP_RULES { }
+
+// Pump Schedule, the pump runs during each window as { days, start, end } in minutes after local
+// midnight. Days are SCHEDULE_* masks from schedule.h, a window ending at or before its start
+// runs past midnight. For example { { SCHEDULE_EVERY_DAY, 10 * 60, 14 * 60 } } runs the pump
+// from 10:00 to 14:00 every day. Empty never runs it.
+#define PUMP_SCHEDULE { }
+
 // IO
-#define TEMP_SENSOR_ONE_WIRE_GPIO 26
+// 1-Wire temperature sensor buses as { GPIO, UART }, each bus is acquired by its own task.
+// The UART backend needs a different UART for each bus, UART0 is used by the console.
+#define TEMP_SENSOR_BUSES { { 26, 2 } }
 #define LED_GPIO 2
 #define PUMP_GPIO 4
 
 // Debug
 #define DEBUG_PRINT_TEMPS 1
+#define DEBUG_PRINT_PUMP_STATS 1
 #define DEBUG_PRINT_TASK_LIST 1
 #define DEBUG_PRINT_RUNTIME_STATS 0
 #define DEBUG_PRINT_TIME 1
-#define DEBUG_PRINT_FREE_HEAP 1
\ No newline at end of file
+#define DEBUG_PRINT_FREE_HEAP 1
+#define DEBUG_PRINT_WS_POOL 1
\ No newline at end of file
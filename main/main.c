@@ -9,125 +9,23 @@
 #include "mdns.h"
 #include "lwip/apps/netbiosns.h"
 #include "esp_spiffs.h"
-#include "esp_wifi.h"
 #include "driver/gpio.h"
 
 // Project Inclues
 #include "ProjectConfig.h"
-#include "WifiConfig.h"
 #include "webServer.h"
 #include "temperature.h"
 #include "ds18b20.h"
 #include "projectLog.h"
 #include "sysTime.h"
 #include "pumpControl.h"
+#include "wifiManager.h"
 
 #include "esp_log.h"
 
 // FreeRTOS Includes
 #include "freertos/task.h"
 
-/**
- * @brief 
- * Attempts to re connect to WiFi when it disconnects.
- */
-static void on_wifi_disconnect(void *arg, esp_event_base_t event_base,
-                               int32_t event_id, void *event_data)
-{
-    LOGI("Wi-Fi disconnected, trying to reconnect...");
-    esp_err_t err = esp_wifi_connect();
-    if (err == ESP_ERR_WIFI_NOT_STARTED) {
-        return;
-    }
-    ESP_ERROR_CHECK(err);
-}
-
-#ifdef CONFIG_EXAMPLE_CONNECT_IPV6
-/**
- * @brief 
- * For future IPv6 support
- */
-static void on_wifi_connect(void *esp_netif, esp_event_base_t event_base,
-                            int32_t event_id, void *event_data)
-{
-    esp_netif_create_ip6_linklocal(esp_netif);
-}
-#endif
-
-/**
- * @brief 
- * Logs IP Address
- */
-static void on_got_ip(void *arg, esp_event_base_t event_base,
-                      int32_t event_id, void *event_data)
-{
-    ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-    LOGI("Got IPv4 event: Interface \"%s\" address: " IPSTR, esp_netif_get_desc(event->esp_netif), IP2STR(&event->ip_info.ip));
-}
-
-#ifdef CONFIG_EXAMPLE_CONNECT_IPV6
-/**
- * @brief 
- * Logs IPv6 Address
- */
-static void on_got_ipv6(void *arg, esp_event_base_t event_base,
-                        int32_t event_id, void *event_data)
-{
-    ip_event_got_ip6_t *event = (ip_event_got_ip6_t *)event_data;
-
-    LOGI("Got IPv6 event: Interface \"%s\" address: " IPV6STR "", esp_netif_get_desc(event->esp_netif),
-             IPV62STR(event->ip6_info.ip));
-}
-#endif
-
-/**
- * @brief 
- * Starts WiFi Connection
- * 
- * @return esp_netif_t* 
- */
-static esp_netif_t *wifi_start(void)
-{
-    char *desc;
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-    esp_netif_inherent_config_t esp_netif_config = ESP_NETIF_INHERENT_DEFAULT_WIFI_STA();
-    // Prefix the interface description with the module TAG
-    // Warning: the interface desc is used in tests to capture actual connection details (IP, gw, mask)
-    asprintf(&desc, "%s: %s", "wifi_start", esp_netif_config.if_desc);
-    esp_netif_config.if_desc = desc;
-    esp_netif_config.route_prio = 128;
-    esp_netif_t *netif = esp_netif_create_wifi(WIFI_IF_STA, &esp_netif_config);
-    free(desc);
-    esp_wifi_set_default_wifi_sta_handlers();
-
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_got_ip, NULL));
-#ifdef CONFIG_EXAMPLE_CONNECT_IPV6
-    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &on_wifi_connect, netif));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_GOT_IP6, &on_got_ipv6, NULL));
-#endif
-
-    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASSWORD,
-            .scan_method = WIFI_ALL_CHANNEL_SCAN,
-            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
-            .threshold.rssi = -127,
-            .threshold.authmode = WIFI_AUTH_OPEN,
-        },
-    };
-    LOGI("Connecting to %s...", wifi_config.sta.ssid);
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-    esp_wifi_connect();
-    return netif;
-}
-
 /**
  * @brief 
  * Configures MDNS
@@ -201,9 +99,17 @@ void Periodic5SecFuncs(void * parameters)
     TickType_t LastWakeTime;
     const TickType_t FunctionPeriod = 5 * xPortGetTickRateHz();      // 5 Second Delay
 
-    bool temp = false;
-
-    data32_t temperatures[TEMP_SENSOR_COUNT];
+    TempFixed_t temperatures[TEMP_SENSOR_MAX];
+#if(DEBUG_PRINT_TEMPS)
+    ds18b20_busStats_t busStats;
+    TempSensorHealth_t health;
+#endif
+#if(DEBUG_PRINT_PUMP_STATS)
+    PumpStats_t pumpStats;
+#endif
+#if(DEBUG_PRINT_WS_POOL)
+    wsPoolStats_t poolStats;
+#endif
 
     static char buffer[500];
 
@@ -216,23 +122,35 @@ void Periodic5SecFuncs(void * parameters)
         vTaskDelayUntil( &LastWakeTime, FunctionPeriod );
 
         // Actions
-        getTemperatures((float *)temperatures);
+        getTemperatures(temperatures);
 
 #if(DEBUG_PRINT_TEMPS)
-        snprintf(buffer, 100, "Temperatures:\nAmbient: %0.1fC\n  Water: %0.1fC", temperatures[AMBIENT_TEMP_SENSOR].f, temperatures[WATER_TEMP_SENSOR].f);
-        LOGI("%s", buffer);
-#endif
+        LOGI("Temperatures:");
+        for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+        {
+            if(getTempSensorHealth(i, &health) == ESP_OK)
+            {
+                snprintf(buffer, 100, "%16s: %0.1fC (Health %d, CRC %u, Presence %u, Zeros %u)", getTempSensorName(i), tempFixedToC(temperatures[i]),
+                         health.state, health.crcErrors, health.presenceErrors, health.allZerosErrors);
+                LOGI("%s", buffer);
+            }
+        }
 
-        // Send Temperature Data to connected clients
-        sendData(WS_DATA_WATER_TEMP, temperatures[WATER_TEMP_SENSOR].i, WS_ALL_CLIENTS);
-        sendData(WS_DATA_AMB_TEMP, temperatures[AMBIENT_TEMP_SENSOR].i, WS_ALL_CLIENTS);
+        getTempBusStats(&busStats);
+        LOGI("1-Wire Sweep: %dus on bus, %dus saved", busStats.busTimeUs, busStats.savedUs);
+#endif
 
-        if(temp)
-            sendData(WS_DATA_PUMP_STATE, 1, WS_ALL_CLIENTS);
-        else
-            sendData(WS_DATA_PUMP_STATE, 0, WS_ALL_CLIENTS);
+        // Send Temperature Data and Pump State to connected clients, in one frame of the changes
+        updateStateField(WS_DATA_WATER_TEMP, temperatures[WATER_TEMP_SENSOR]);
+        updateStateField(WS_DATA_AMB_TEMP, temperatures[AMBIENT_TEMP_SENSOR]);
+        updateStateField(WS_DATA_PUMP_STATE, PumpRunning());
+        broadcastState();
 
-        temp = !temp;
+#if(DEBUG_PRINT_PUMP_STATS)
+        GetPumpStats(&pumpStats);
+        LOGI("Pump: %u starts, %us run, %u.%u%% duty, %us in state", pumpStats.startCount, pumpStats.runTimeSecs,
+             pumpStats.dutyCyclePermille / 10, pumpStats.dutyCyclePermille % 10, pumpStats.stateTimeSecs);
+#endif
 
 #if(DEBUG_PRINT_TASK_LIST)
         vTaskList(buffer);
@@ -259,6 +177,13 @@ void Periodic5SecFuncs(void * parameters)
 #if(DEBUG_PRINT_FREE_HEAP)
         LOGI("Free Heap: %d", xPortGetFreeHeapSize());
 #endif
+
+#if(DEBUG_PRINT_WS_POOL)
+        getWsPoolStats(&poolStats);
+        LOGI("WS Pool: %u/%u frames (peak %u, %u dropped), %u/%u payloads (peak %u, %u dropped)",
+             poolStats.framesInUse, poolStats.framesTotal, poolStats.framesPeak, poolStats.framesExhausted,
+             poolStats.payloadsInUse, poolStats.payloadsTotal, poolStats.payloadsPeak, poolStats.payloadsExhausted);
+#endif
     }
 }
 
@@ -288,30 +213,30 @@ void app_main(void)
 {
     initGpio();
 
+    ESP_ERROR_CHECK(nvs_flash_init());
+
     configureTempSensors();
 
-    ESP_ERROR_CHECK(nvs_flash_init());
+    // Pump control starts before networking, so a warm reboot resumes it without waiting for Wi-Fi
+    PumpControlInit();
+    xTaskCreate(&PumpControlTask, "Pump Ctrl", ESP_TASK_MAIN_STACK, NULL, 0, NULL);
+
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     initialise_mdns();
     netbiosns_init();
     netbiosns_set_name(MDNS_HOST_NAME);
 
-    wifi_start();
+    wifiManagerStart();
     ESP_ERROR_CHECK(init_fs());
 
     ESP_ERROR_CHECK(start_web_server(WEB_MOUNT_POINT));
 
     timeInit(TIMEZONE);
 
-    PumpControlInit();
-
     // Start testing task
     xTaskCreate(&Periodic5SecFuncs, "5SecFuncs", ESP_TASK_MAIN_STACK, NULL, 10, NULL);
 
     // Start LED task
     xTaskCreate(&LedTaskvoid, "LED", 512, NULL, 0, NULL);
-
-    // Start Pump Control Task
-    xTaskCreate(&PumpControlTask, "Pump Ctrl", ESP_TASK_MAIN_STACK, NULL, 0, NULL);
 }
@@ -9,117 +9,565 @@
 #include "temperature.h"
 #include "ProjectConfig.h"
 #include "projectLog.h"
+#include "rules.h"
+#include "schedule.h"
+#include "trend.h"
+#include "sysTime.h"
 
 // FreeRTOS Includes
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include "freertos/timers.h"
 
 // ESP SDK Includes
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
 #include "driver/gpio.h"
 
 // Standard Library Includes
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include <sys/time.h>
 
 #define USE_DEBUG_TIMES 1
 
-#define TIMER_QUEUE_LEN 10
+/* Task notification bits that wake the pump control task */
+#define PUMP_EVENT_SAMPLE   (1 << 0)    // New temperature sample published
+#define PUMP_EVENT_SETTINGS (1 << 1)    // Control setting changed
+#define PUMP_EVENT_SCHEDULE (1 << 2)    // Schedule transition reached
+#define PUMP_EVENT_MIN_TIME (1 << 3)    // Minimum run or off time elapsed
+#define PUMP_EVENT_SAVE     (1 << 4)    // Settings save delay elapsed
 
-#define PUMP_TASK_PERIOD_SEC 10         // 10 Second Period
-#define PUMP_TASK_TICKS pdMS_TO_TICKS(PUMP_TASK_PERIOD_SEC*1000)
+#define SCHEDULE_TIMER_MAX_SEC 3600     // Re-arm at least hourly to follow clock corrections
+
+/* NVS location of the saved settings */
+#define PUMP_NVS_NAMESPACE "pump"
+#define PUMP_NVS_SETTINGS_KEY "settings"
+
+/* Layout of the saved settings blob, change it when PumpSettings_t changes so old blobs are ignored */
+#define PUMP_SETTINGS_LAYOUT 1
+
+/**
+ * Settings changes are saved this long after the first unsaved change, so a burst of changes
+ * (a slider being dragged) costs one flash write.
+ */
+#define PUMP_SETTINGS_SAVE_DELAY_MS 5000
+
+/* Marks PumpRetained as written by this firmware, together with its CRC */
+#define PUMP_RETAINED_MAGIC 0x504D5052
+
+/* Settings as saved to NVS */
+typedef struct
+{
+    uint32_t layout;            // PUMP_SETTINGS_LAYOUT
+    PumpSettings_t settings;
+    uint32_t crc;               // CRC32 of the fields before it
+} PumpSettingsBlob_t;
 
 // Private function prototypes
 void pumpTimerCallback( TimerHandle_t xTimer );
+void minTimeTimerCallback(void * arg);
+void settingsSaveTimerCallback(void * arg);
+void pumpSampleCallback(void * arg);
+void notifyPumpControl(uint32_t events);
 void pumpOn();
 void pumpOff();
-void updatePumpStateTime();
-PumpState_t temperatureControlLogic();
+void setPumpState(PumpState_t state);
+TempFixed_t predictTemperature(TempTrend_t *trend, const TempSnapshot_t *snapshot, TempSensorId sensorId, uint32_t horizonSec, bool *falling);
+PumpState_t temperatureControlLogic(const PumpSettings_t *settings);
 PumpState_t scheduleControlLogic();
+PumpState_t rulesControlLogic(const PumpSettings_t *settings);
+void compilePumpRules();
+void compilePumpSchedule();
+bool armScheduleTimer();
+void armMinTimeTimer(PumpState_t commandedPumpState);
+void updateTempAlarmThresholds(const PumpSettings_t *settings);
 void pumpStateControlLogic();
+void loadPumpSettings();
+void savePumpSettings();
+bool restorePumpState();
+void retainPumpState();
 
-// Statically allocated timer
+// Statically allocated timers
 StaticTimer_t taskProcessTimerBuffer;
 TimerHandle_t taskProcessTimer;
+esp_timer_handle_t minTimeTimer;
+esp_timer_handle_t settingsSaveTimer = NULL;
 
-// Statically allocated queue
-StaticQueue_t timerQueueBuffer;
-QueueHandle_t timerQueue;
-uint8_t timerQueueStorage[TIMER_QUEUE_LEN];
+// Pump control task, notified of events that can change the pump state
+TaskHandle_t PumpControlTaskHandle = NULL;
 
-// Temperature Control variables
-float MinAmbientTemperature = 38.0f;
-float AmbientTempHysteresis = 2.0f;
-float MinWaterTemperature = 35.0f;
-float WaterTempHysteresis = 4.0f;
+/**
+ * Pump settings snapshots. A published snapshot is never written again while it can be read:
+ * the pump control task marks the snapshot it runs a pass on in PumpSettingsInUse, and writers
+ * fill a buffer that is neither published nor in use. With three buffers one is always free, so
+ * neither side waits for the other. Writers are serialized by PumpSettingsLock, which readers
+ * other than the pump control task also take to copy the published snapshot.
+ */
+#define PUMP_SETTINGS_BUFFERS 3
+PumpSettings_t PumpSettingsBuffers[PUMP_SETTINGS_BUFFERS] =
+{
+    {
+        .version = 1,
+        .minAmbientTemperature = TEMP_FIXED(38.0f),
+        .ambientTempHysteresis = TEMP_FIXED(2.0f),
+        .minWaterTemperature = TEMP_FIXED(35.0f),
+        .waterTempHysteresis = TEMP_FIXED(4.0f),
+        .predictHorizonSec = PUMP_PREDICT_HORIZON_SEC,
+    },
+};
+PumpSettings_t *PumpSettingsActive = &PumpSettingsBuffers[0];
+const PumpSettings_t *PumpSettingsInUse = NULL;
+portMUX_TYPE PumpSettingsLock = portMUX_INITIALIZER_UNLOCKED;
+uint32_t PumpSettingsSavedVersion = 1;  // Version of the settings in NVS, only used by the pump control task
+
+// Temperature Prediction
+TempTrend_t AmbientTrend;
+TempTrend_t WaterTrend;
+
+/* Variables pump rules can use, after one for each temperature sensor slot */
+typedef enum
+{
+    RULE_VAR_HOUR = TEMP_SENSOR_MAX,
+    RULE_VAR_MINUTE,
+    RULE_VAR_WEEKDAY,
+    RULE_VAR_PUMP,
+    RULE_VAR_MIN_AMBIENT,
+    RULE_VAR_AMBIENT_HYST,
+    RULE_VAR_MIN_WATER,
+    RULE_VAR_WATER_HYST,
+    RULE_VAR_COUNT
+} PumpRuleVar_t;
+
+// Pump Rules
+const char * const PumpRuleSources[] = PUMP_RULES;
+RuleProgram_t PumpRules;
+char PumpRuleSensorNames[TEMP_SENSOR_MAX][TEMP_SENSOR_NAME_LEN];
+const char * PumpRuleVarNames[RULE_VAR_COUNT];
+
+// Pump Schedule
+const ScheduleWindow_t PumpScheduleWindows[] = PUMP_SCHEDULE;
+Schedule_t PumpSchedule;
 
 // Pump Control Variables
 PumpState_t PumpState = PUMP_STATE_OFF;
-uint32_t PumpStateTimeSecs = 0;
 uint32_t MinPumpRunTimeSec = 15 * 60;   // 15 Minute Default
 uint32_t MinPumpOffTimeSec = 2 * 60;    // 2 Minute Default
 
-float GetMinAmbientTemperature()
+// Pump State Timing, esp_timer microseconds since boot
+int64_t PumpStateChangeUs = 0;          // Time of the last pump state change, before boot if resumed
+int64_t PumpChangeAllowedUs = 0;        // Deadline for the minimum run or off time of the current state
+
+/**
+ * Temperature decisions, remembered across passes. In the event that a temperature sensor is
+ * disconnected (or its readings are stale) its last decision is reused. For instance if the pump
+ * was turned on due to low temperature and the sensor is disconnected, it will continue to assume
+ * that the temperature is low until the sensor is reconnected.
+ */
+PumpState_t AmbientTempPumpState = PUMP_STATE_OFF;
+PumpState_t WaterTempPumpState = PUMP_STATE_OFF;
+
+/**
+ * Pump state kept in RTC slow memory, which holds its contents through every reset but power on,
+ * so a warm reboot carries on where control left off. esp_timer restarts from zero at boot, so
+ * times are kept relative to the end of the last pass. Only the pump control task writes it.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t pumpState;
+    uint32_t ambientTempPumpState;
+    uint32_t waterTempPumpState;
+    int64_t stateTimeUs;                // Time in the current state
+    int64_t changeAllowedInUs;          // Minimum run or off time left, 0 once a change is allowed
+    uint32_t crc;                       // Of everything before it
+} PumpRetained_t;
+
+RTC_NOINIT_ATTR PumpRetained_t PumpRetained;
+
+// Pump Statistics, updated on each state change. Guarded by PumpStatsLock.
+portMUX_TYPE PumpStatsLock = portMUX_INITIALIZER_UNLOCKED;
+int64_t PumpRunTimeUs = 0;              // Run time of completed runs
+uint32_t PumpStartCount = 0;
+
+/**
+ * @brief Checks if two settings snapshots hold the same settings, whatever their versions
+ */
+static bool pumpSettingsEqual(const PumpSettings_t *a, const PumpSettings_t *b)
 {
-    return MinAmbientTemperature;
+    return (a->minAmbientTemperature == b->minAmbientTemperature) &&
+           (a->ambientTempHysteresis == b->ambientTempHysteresis) &&
+           (a->minWaterTemperature == b->minWaterTemperature) &&
+           (a->waterTempHysteresis == b->waterTempHysteresis) &&
+           (a->predictHorizonSec == b->predictHorizonSec);
 }
 
-float GetAmbientTempHysteresis()
+/**
+ * @brief Checks every setting is in range
+ */
+static bool pumpSettingsValid(const PumpSettings_t *settings)
 {
-    return AmbientTempHysteresis;
+    // Don't allow minimums at freezing or below, or hysteresis bands too narrow to hold the pump.
+    // The top of each band must be a temperature the sensors can report, summed wide so it can't
+    // overflow TempFixed_t.
+    return (settings->minAmbientTemperature > TEMP_FIXED(1.0f)) &&
+           (settings->ambientTempHysteresis > TEMP_FIXED(1.0f)) &&
+           (settings->minWaterTemperature > TEMP_FIXED(1.0f)) &&
+           (settings->waterTempHysteresis > TEMP_FIXED(1.0f)) &&
+           (((int32_t)settings->minAmbientTemperature + settings->ambientTempHysteresis) < TEMP_ALARM_NONE_HIGH) &&
+           (((int32_t)settings->minWaterTemperature + settings->waterTempHysteresis) < TEMP_ALARM_NONE_HIGH);
 }
 
-float GetMinWaterTemperature()
+/**
+ * @brief Gets a copy of the published pump settings
+ *
+ * @param settings Filled with the current settings snapshot
+ */
+void GetPumpSettings(PumpSettings_t *settings)
 {
-    return MinWaterTemperature;
+    portENTER_CRITICAL(&PumpSettingsLock);
+    *settings = *PumpSettingsActive;
+    portEXIT_CRITICAL(&PumpSettingsLock);
 }
 
-float GetWaterTempHysteresis()
+/**
+ * @brief
+ * Validates a complete set of pump settings and publishes them as a new snapshot. Nothing is
+ * applied unless every setting is valid.
+ *
+ * @param settings New settings, the version is ignored
+ * @return ESP_OK if published or unchanged, ESP_ERR_INVALID_ARG if a setting is out of range
+ */
+esp_err_t SetPumpSettings(const PumpSettings_t *settings)
 {
-    return WaterTempHysteresis;
+    PumpSettings_t *active;
+    const PumpSettings_t *inUse;
+    PumpSettings_t *next = NULL;
+
+    if(!pumpSettingsValid(settings))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&PumpSettingsLock);
+    active = PumpSettingsActive;
+    if(pumpSettingsEqual(settings, active))
+    {
+        portEXIT_CRITICAL(&PumpSettingsLock);
+        return ESP_OK;
+    }
+
+    inUse = __atomic_load_n(&PumpSettingsInUse, __ATOMIC_SEQ_CST);
+    for(uint8_t i = 0; i < PUMP_SETTINGS_BUFFERS; i++)
+    {
+        if((&PumpSettingsBuffers[i] != active) && (&PumpSettingsBuffers[i] != inUse))
+        {
+            next = &PumpSettingsBuffers[i];
+            break;
+        }
+    }
+
+    *next = *settings;
+    next->version = active->version + 1;
+    __atomic_store_n(&PumpSettingsActive, next, __ATOMIC_SEQ_CST);
+    portEXIT_CRITICAL(&PumpSettingsLock);
+
+    // Save once the changes settle, a save already pending will pick this change up
+    if(settingsSaveTimer != NULL)
+    {
+        esp_timer_start_once(settingsSaveTimer, (uint64_t)PUMP_SETTINGS_SAVE_DELAY_MS * 1000);
+    }
+
+    notifyPumpControl(PUMP_EVENT_SETTINGS);
+    return ESP_OK;
 }
 
-void SetMinAmbientTemperature(float temp)
+/**
+ * @brief
+ * Gets the published settings snapshot for a pass of the pump control task. The snapshot stays
+ * unchanged until the next call.
+ *
+ * @return Settings snapshot
+ */
+static const PumpSettings_t *acquirePumpSettings()
 {
-    // Don't allow setting of temperature at freezing or below
-    if(temp > 1.0)
+    const PumpSettings_t *settings = __atomic_load_n(&PumpSettingsActive, __ATOMIC_SEQ_CST);
+    const PumpSettings_t *published;
+
+    // Mark the snapshot in use, then make sure it wasn't replaced before a writer could see the mark
+    while(true)
     {
-        MinAmbientTemperature = temp;
+        __atomic_store_n(&PumpSettingsInUse, settings, __ATOMIC_SEQ_CST);
+        published = __atomic_load_n(&PumpSettingsActive, __ATOMIC_SEQ_CST);
+        if(published == settings)
+        {
+            return settings;
+        }
+        settings = published;
     }
 }
 
-void SetAmbientTempHysteresis(float hysteresis)
+/**
+ * @brief Loads the settings saved to NVS, keeping the defaults if there are none or the saved
+ * blob is from another layout, corrupt or out of range. Called before the pump control task runs.
+ */
+void loadPumpSettings()
 {
-    if(hysteresis > 1.0f)
+    PumpSettingsBlob_t blob;
+    size_t len = sizeof(blob);
+    nvs_handle_t nvsHandle;
+    esp_err_t err;
+
+    err = nvs_open(PUMP_NVS_NAMESPACE, NVS_READONLY, &nvsHandle);
+    if(err != ESP_OK)
+    {
+        LOGI("No Saved Pump Settings, Using Defaults");
+        return;
+    }
+
+    err = nvs_get_blob(nvsHandle, PUMP_NVS_SETTINGS_KEY, &blob, &len);
+    nvs_close(nvsHandle);
+
+    if((err == ESP_OK) &&
+       ((len != sizeof(blob)) || (blob.layout != PUMP_SETTINGS_LAYOUT) ||
+        (esp_rom_crc32_le(0, (const uint8_t *)&blob, offsetof(PumpSettingsBlob_t, crc)) != blob.crc) ||
+        !pumpSettingsValid(&blob.settings)))
     {
-        AmbientTempHysteresis = hysteresis;
+        err = ESP_ERR_INVALID_CRC;
     }
+
+    if(err != ESP_OK)
+    {
+        LOGW("Saved Pump Settings Not Loaded, Using Defaults: %s", esp_err_to_name(err));
+        return;
+    }
+
+    // Versions carry on from the saved settings so clients see them keep increasing
+    portENTER_CRITICAL(&PumpSettingsLock);
+    *PumpSettingsActive = blob.settings;
+    portEXIT_CRITICAL(&PumpSettingsLock);
+    PumpSettingsSavedVersion = blob.settings.version;
+
+    LOGI("Loaded Pump Settings Version %u", blob.settings.version);
 }
 
-void SetMinWaterTemperature(float temp)
+/**
+ * @brief Saves the published settings to NVS if they changed since the last save. Runs in the
+ * pump control task.
+ */
+void savePumpSettings()
 {
-    // Don't allow setting of temperature at freezing or below
-    if(temp > 1.0)
+    PumpSettingsBlob_t blob;
+    nvs_handle_t nvsHandle;
+    esp_err_t err;
+
+    memset(&blob, 0, sizeof(blob));
+    blob.layout = PUMP_SETTINGS_LAYOUT;
+    GetPumpSettings(&blob.settings);
+
+    if(blob.settings.version == PumpSettingsSavedVersion)
     {
-        MinWaterTemperature = temp;
+        return;
     }
+
+    blob.crc = esp_rom_crc32_le(0, (const uint8_t *)&blob, offsetof(PumpSettingsBlob_t, crc));
+
+    err = nvs_open(PUMP_NVS_NAMESPACE, NVS_READWRITE, &nvsHandle);
+    if(err == ESP_OK)
+    {
+        err = nvs_set_blob(nvsHandle, PUMP_NVS_SETTINGS_KEY, &blob, sizeof(blob));
+        if(err == ESP_OK)
+        {
+            err = nvs_commit(nvsHandle);
+        }
+        nvs_close(nvsHandle);
+    }
+
+    if(err != ESP_OK)
+    {
+        LOGE("Pump Settings Not Saved: %s", esp_err_to_name(err));
+        return;
+    }
+
+    PumpSettingsSavedVersion = blob.settings.version;
+    LOGI("Saved Pump Settings Version %u", blob.settings.version);
 }
 
-void SetWaterTempHysteresis(float hysteresis)
+/**
+ * @brief Resumes the pump state kept in RTC memory through a warm reboot. Time spent in reset is
+ * not counted, so the minimum run or off time left is, if anything, longer than before.
+ *
+ * @return true if the pump state was restored, false after power on or if the kept state is
+ * invalid
+ */
+bool restorePumpState()
 {
-    if(hysteresis > 1.0f)
+    int64_t now = esp_timer_get_time();
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    if((reason == ESP_RST_POWERON) || (PumpRetained.magic != PUMP_RETAINED_MAGIC) ||
+       (esp_rom_crc32_le(0, (const uint8_t *)&PumpRetained, offsetof(PumpRetained_t, crc)) != PumpRetained.crc))
     {
-        WaterTempHysteresis = hysteresis;
+        return false;
     }
+
+    AmbientTempPumpState = PumpRetained.ambientTempPumpState ? PUMP_STATE_ON : PUMP_STATE_OFF;
+    WaterTempPumpState = PumpRetained.waterTempPumpState ? PUMP_STATE_ON : PUMP_STATE_OFF;
+
+    // The relay output was released by the reset, drive it again without counting a new start
+    PumpState = PumpRetained.pumpState ? PUMP_STATE_ON : PUMP_STATE_OFF;
+    gpio_set_level(PUMP_GPIO, PumpState);
+    PumpStateChangeUs = now - PumpRetained.stateTimeUs;
+    PumpChangeAllowedUs = now + PumpRetained.changeAllowedInUs;
+
+    LOGI("Resumed Pump %s After Reset Reason %d, %us in State, %us Until Change Allowed", PumpState ? "On" : "Off", reason,
+         (uint32_t)(PumpRetained.stateTimeUs / 1000000), (uint32_t)(PumpRetained.changeAllowedInUs / 1000000));
+    return true;
+}
+
+/**
+ * @brief Keeps the pump state in RTC memory for restorePumpState(), called after every pass
+ */
+void retainPumpState()
+{
+    int64_t now = esp_timer_get_time();
+
+    PumpRetained.magic = PUMP_RETAINED_MAGIC;
+    PumpRetained.pumpState = PumpState;
+    PumpRetained.ambientTempPumpState = AmbientTempPumpState;
+    PumpRetained.waterTempPumpState = WaterTempPumpState;
+    PumpRetained.stateTimeUs = now - PumpStateChangeUs;
+    PumpRetained.changeAllowedInUs = (PumpChangeAllowedUs > now) ? (PumpChangeAllowedUs - now) : 0;
+    PumpRetained.crc = esp_rom_crc32_le(0, (const uint8_t *)&PumpRetained, offsetof(PumpRetained_t, crc));
+}
+
+TempFixed_t GetMinAmbientTemperature()
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    return settings.minAmbientTemperature;
+}
+
+TempFixed_t GetAmbientTempHysteresis()
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    return settings.ambientTempHysteresis;
+}
+
+TempFixed_t GetMinWaterTemperature()
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    return settings.minWaterTemperature;
+}
+
+TempFixed_t GetWaterTempHysteresis()
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    return settings.waterTempHysteresis;
+}
+
+uint32_t GetPredictHorizonSec()
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    return settings.predictHorizonSec;
+}
+
+void SetMinAmbientTemperature(TempFixed_t temp)
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    settings.minAmbientTemperature = temp;
+    SetPumpSettings(&settings);
+}
+
+void SetAmbientTempHysteresis(TempFixed_t hysteresis)
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    settings.ambientTempHysteresis = hysteresis;
+    SetPumpSettings(&settings);
+}
+
+void SetMinWaterTemperature(TempFixed_t temp)
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    settings.minWaterTemperature = temp;
+    SetPumpSettings(&settings);
 }
 
+void SetWaterTempHysteresis(TempFixed_t hysteresis)
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    settings.waterTempHysteresis = hysteresis;
+    SetPumpSettings(&settings);
+}
+
+void SetPredictHorizonSec(uint32_t horizonSec)
+{
+    PumpSettings_t settings;
+    GetPumpSettings(&settings);
+    settings.predictHorizonSec = horizonSec;
+    SetPumpSettings(&settings);
+}
+
+/**
+ * @brief Wakes the pump control task with events that can change the pump state
+ *
+ * @param events PUMP_EVENT_* bits
+ */
+void notifyPumpControl(uint32_t events)
+{
+    if(PumpControlTaskHandle != NULL)
+    {
+        xTaskNotify(PumpControlTaskHandle, events, eSetBits);
+    }
+}
 
+/**
+ * @brief Wakes the pump control task at a schedule transition
+ */
 void pumpTimerCallback( TimerHandle_t timerHandle )
 {
-    uint8_t queueData = 4;
-    xTimerStop(taskProcessTimer, 0);
-    xQueueSend(timerQueue, &queueData, 0);
+    notifyPumpControl(PUMP_EVENT_SCHEDULE);
+}
+
+/**
+ * @brief Wakes the pump control task when a pump state change held back by the minimum run or
+ * off time is allowed
+ */
+void minTimeTimerCallback(void * arg)
+{
+    notifyPumpControl(PUMP_EVENT_MIN_TIME);
+}
+
+/**
+ * @brief Wakes the pump control task to save settings changes, NVS writes are kept out of the
+ * timer task and the tasks that changed the settings
+ */
+void settingsSaveTimerCallback(void * arg)
+{
+    notifyPumpControl(PUMP_EVENT_SAVE);
+}
+
+/**
+ * @brief Wakes the pump control task when a new temperature sample is published
+ */
+void pumpSampleCallback(void * arg)
+{
+    notifyPumpControl(PUMP_EVENT_SAMPLE);
 }
 
 /**
@@ -137,9 +585,65 @@ void PumpControlInit()
     gpio_pad_select_gpio(PUMP_GPIO);
     gpio_set_direction(PUMP_GPIO, GPIO_MODE_OUTPUT);
 
-    // Init Task Timer and Queue
+    compilePumpRules();
+    compilePumpSchedule();
+
+    // Init Schedule and Minimum Time Timers
     taskProcessTimer = xTimerCreateStatic("PumpTimer", pdMS_TO_TICKS(100000), false, (void*)0, pumpTimerCallback, &taskProcessTimerBuffer);
-    timerQueue = xQueueCreateStatic(TIMER_QUEUE_LEN, sizeof(uint8_t), timerQueueStorage, &timerQueueBuffer);
+    const esp_timer_create_args_t minTimeTimerArgs = {
+        .callback = minTimeTimerCallback,
+        .name = "PumpMinTimer"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&minTimeTimerArgs, &minTimeTimer));
+
+    // Settings saved before the reboot, then save changes from here on
+    loadPumpSettings();
+    const esp_timer_create_args_t settingsSaveTimerArgs = {
+        .callback = settingsSaveTimerCallback,
+        .name = "PumpSettingsSave"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&settingsSaveTimerArgs, &settingsSaveTimer));
+
+    // Resume the pump state kept through a warm reboot, otherwise the pump is off at boot and
+    // held off for the minimum off time
+    if(!restorePumpState())
+    {
+        PumpChangeAllowedUs = (int64_t)MinPumpOffTimeSec * 1000000;
+    }
+
+    // Reevaluate on every new temperature sample
+    if(registerTempSampleCallback(pumpSampleCallback, NULL) != ESP_OK)
+    {
+        LOGE("Pump Control Sample Callback Not Registered");
+    }
+}
+
+/**
+ * @brief Changes the pump state, stamps the change and updates the run statistics
+ *
+ * @param state new pump state
+ */
+void setPumpState(PumpState_t state)
+{
+    int64_t now = esp_timer_get_time();
+
+    gpio_set_level(PUMP_GPIO, state);
+
+    portENTER_CRITICAL(&PumpStatsLock);
+    if(state == PUMP_STATE_ON)
+    {
+        PumpStartCount++;
+    }
+    else
+    {
+        // Statistics are since boot, a run resumed after a warm reboot counts from boot
+        PumpRunTimeUs += now - MAX(PumpStateChangeUs, 0);
+    }
+    PumpState = state;
+    PumpStateChangeUs = now;
+    portEXIT_CRITICAL(&PumpStatsLock);
+
+    PumpChangeAllowedUs = now + ((int64_t)((state == PUMP_STATE_ON) ? MinPumpRunTimeSec : MinPumpOffTimeSec) * 1000000);
 }
 
 /**
@@ -147,16 +651,10 @@ void PumpControlInit()
  */
 void pumpOn()
 {
-    // Enforce Minimum On Time
-    if(PumpStateTimeSecs >= MinPumpOffTimeSec)
+    // Enforce Minimum Off Time
+    if(!PumpRunning() && (esp_timer_get_time() >= PumpChangeAllowedUs))
     {
-        // Reset State Time only if Pump was previously not running
-        if(!PumpRunning())
-        {
-            PumpStateTimeSecs = 0;
-            gpio_set_level(PUMP_GPIO, 1);
-            PumpState = true;
-        }
+        setPumpState(PUMP_STATE_ON);
     }
 }
 
@@ -165,16 +663,10 @@ void pumpOn()
  */
 void pumpOff()
 {
-    // Enforce Minimum Off Time
-    if(PumpStateTimeSecs >= MinPumpRunTimeSec)
+    // Enforce Minimum Run Time
+    if(PumpRunning() && (esp_timer_get_time() >= PumpChangeAllowedUs))
     {
-        // Reset State Time only if Pump was previously running
-        if(PumpRunning())
-        {
-            PumpStateTimeSecs = 0;
-            gpio_set_level(PUMP_GPIO, 0);
-            PumpState = false;
-        }
+        setPumpState(PUMP_STATE_OFF);
     }
 }
 
@@ -190,43 +682,123 @@ bool PumpRunning()
 }
 
 /**
- * @brief Logic for pump control based on temperature
+ * @brief Get the pump run statistics, including the run in progress
+ *
+ * @param stats statistics output
+ */
+void GetPumpStats(PumpStats_t *stats)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t runTimeUs;
+    int64_t stateTimeUs;
+
+    portENTER_CRITICAL(&PumpStatsLock);
+    stateTimeUs = now - PumpStateChangeUs;
+    runTimeUs = PumpRunTimeUs + (PumpState ? (now - MAX(PumpStateChangeUs, 0)) : 0);
+    stats->startCount = PumpStartCount;
+    portEXIT_CRITICAL(&PumpStatsLock);
+
+    stats->runTimeSecs = runTimeUs / 1000000;
+    stats->stateTimeSecs = stateTimeUs / 1000000;
+    stats->dutyCyclePermille = (now > 0) ? (uint16_t)MIN((runTimeUs * 1000) / now, 1000) : 0;
+}
+
+/**
+ * @brief Feeds a sensor's new samples to its trend and projects the temperature horizonSec ahead
+ *
+ * @param trend Trend of the sensor
+ * @param snapshot Snapshot with the sensor's latest sample
+ * @param sensorId Sensor to predict
+ * @param horizonSec Time ahead to project, 0 disables prediction
+ * @param falling Set true if the fitted trend is falling
+ * @return Lower of the current and projected temperature, the current temperature until the
+ * trend has enough samples. TEMP_FIXED_DISCONNECTED if the sensor is disconnected or stale.
+ */
+TempFixed_t predictTemperature(TempTrend_t *trend, const TempSnapshot_t *snapshot, TempSensorId sensorId, uint32_t horizonSec, bool *falling)
+{
+    TempFixed_t temperature;
+    TempFixed_t projected;
+    TempFixed_t fitted;
+
+    *falling = false;
+
+    if(!tempSnapshotFresh(snapshot, sensorId, TEMP_MAX_SAMPLE_AGE_MS))
+    {
+        trendReset(trend);
+        return TEMP_FIXED_DISCONNECTED;
+    }
+
+    temperature = snapshot->temperatures[sensorId];
+
+    // Several buses publish to the snapshot, only add samples this sensor hasn't given yet
+    if(snapshot->sampleTimeUs[sensorId] != trend->lastSampleUs)
+    {
+        trendAddSample(trend, snapshot->sampleTimeUs[sensorId], temperature);
+    }
+
+    if((horizonSec == 0) || !trendProject(trend, horizonSec, &projected))
+    {
+        return temperature;
+    }
+
+    trendProject(trend, 0, &fitted);
+    *falling = (projected < fitted);
+
+    // Only used to act earlier on a falling temperature, never below the sensor's range
+    if(projected < temperature)
+    {
+        temperature = (projected > TEMP_ALARM_NONE_LOW) ? projected : TEMP_ALARM_NONE_LOW;
+    }
+
+    return temperature;
+}
+
+/**
+ * @brief Logic for pump control based on temperature. Each temperature keeps its own decision,
+ * switched by its own hysteresis whether or not the pump is running for another reason, so a
+ * temperature that drops below its minimum while the schedule or rules run the pump keeps it
+ * running when they stop. Within the hysteresis band the pump is also started when a temperature
+ * is projected to drop below its minimum within the prediction horizon, and it isn't stopped
+ * while the temperature's trend is still falling.
  * 
+ * @param settings Settings snapshot of this pass
  * @return PumpState_t state to put pump in based on temperature
  */
-PumpState_t temperatureControlLogic()
+PumpState_t temperatureControlLogic(const PumpSettings_t *settings)
 {
-    float waterTemperature;
-    float ambientTemperature;
+    TempFixed_t waterTemperature;
+    TempFixed_t ambientTemperature;
+    TempFixed_t waterPredicted;
+    TempFixed_t ambientPredicted;
+    bool waterFalling;
+    bool ambientFalling;
+    TempSnapshot_t snapshot;
 
-    /**
-     * These Pump State variables are static so that the last decisions are remembered across
-     * subsequent calls to this function. In the event that a temperature sensor is disconnected
-     * it's last state will be reused. For instance if the pump was turned on due to low temperature
-     * and the sensor is disconnected, it will continue to assume that the temperature is low
-     * until the sensor is reconnected.
-     */
-    static PumpState_t ambientTempPumpState = PUMP_STATE_OFF;
-    static PumpState_t waterTempPumpState = PUMP_STATE_OFF;
-
-    waterTemperature = getLastTemperatureRead(WATER_TEMP_SENSOR);
-    ambientTemperature = getLastTemperatureRead(AMBIENT_TEMP_SENSOR);
+    // Both temperatures come from one consistent snapshot, stale readings count as disconnected
+    getTempSnapshot(&snapshot);
+    waterTemperature = tempSnapshotFresh(&snapshot, WATER_TEMP_SENSOR, TEMP_MAX_SAMPLE_AGE_MS) ? 
+                       snapshot.temperatures[WATER_TEMP_SENSOR] : TEMP_FIXED_DISCONNECTED;
+    ambientTemperature = tempSnapshotFresh(&snapshot, AMBIENT_TEMP_SENSOR, TEMP_MAX_SAMPLE_AGE_MS) ? 
+                         snapshot.temperatures[AMBIENT_TEMP_SENSOR] : TEMP_FIXED_DISCONNECTED;
+    waterPredicted = predictTemperature(&WaterTrend, &snapshot, WATER_TEMP_SENSOR, settings->predictHorizonSec, &waterFalling);
+    ambientPredicted = predictTemperature(&AmbientTrend, &snapshot, AMBIENT_TEMP_SENSOR, settings->predictHorizonSec, &ambientFalling);
 
     // Don't run ambient temperature logic if sensor is disconnected
     if(!tempIsDisconnected(ambientTemperature))
     {
-        if(!PumpRunning())
+        if(AmbientTempPumpState == PUMP_STATE_OFF)
         {
-            if(ambientTemperature < MinAmbientTemperature)
+            if((ambientTemperature < settings->minAmbientTemperature) ||
+               ((ambientPredicted < settings->minAmbientTemperature) && (ambientTemperature < (settings->minAmbientTemperature + settings->ambientTempHysteresis))))
             {
-                ambientTempPumpState = PUMP_STATE_ON;
+                AmbientTempPumpState = PUMP_STATE_ON;
             }
         }
-        else    // Pump is Running
+        else    // Running for ambient temperature
         {
-            if(ambientTemperature > (MinAmbientTemperature + AmbientTempHysteresis))
+            if((ambientTemperature > (settings->minAmbientTemperature + settings->ambientTempHysteresis)) && !ambientFalling)
             {
-                ambientTempPumpState = PUMP_STATE_OFF;
+                AmbientTempPumpState = PUMP_STATE_OFF;
             }
         }
     }
@@ -234,23 +806,24 @@ PumpState_t temperatureControlLogic()
     // Don't run water temperature logic if sensor is disconnected
     if(!tempIsDisconnected(waterTemperature))
     {
-        if(!PumpRunning())
+        if(WaterTempPumpState == PUMP_STATE_OFF)
         {
-            if(waterTemperature < MinWaterTemperature)
+            if((waterTemperature < settings->minWaterTemperature) ||
+               ((waterPredicted < settings->minWaterTemperature) && (waterTemperature < (settings->minWaterTemperature + settings->waterTempHysteresis))))
             {
-                waterTempPumpState = PUMP_STATE_ON;
+                WaterTempPumpState = PUMP_STATE_ON;
             }
         }
-        else    // Pump is Running
+        else    // Running for water temperature
         {
-            if(waterTemperature > (MinWaterTemperature + WaterTempHysteresis))
+            if((waterTemperature > (settings->minWaterTemperature + settings->waterTempHysteresis)) && !waterFalling)
             {
-                waterTempPumpState = PUMP_STATE_OFF;
+                WaterTempPumpState = PUMP_STATE_OFF;
             }
         }
     }
 
-    return waterTempPumpState || ambientTempPumpState;
+    return WaterTempPumpState || AmbientTempPumpState;
 }
 
 /**
@@ -260,15 +833,194 @@ PumpState_t temperatureControlLogic()
  */
 PumpState_t scheduleControlLogic()
 {
-    return false;   // Not implemented yet
+    // The schedule is in local time, it can't run until the time is set
+    if(!isTimeSet())
+    {
+        return PUMP_STATE_OFF;
+    }
+
+    return scheduleStateAt(&PumpSchedule, time(NULL)) ? PUMP_STATE_ON : PUMP_STATE_OFF;
+}
+
+/**
+ * @brief Compiles the PUMP_SCHEDULE run windows. A schedule that fails to compile is logged and
+ * never runs the pump.
+ */
+void compilePumpSchedule()
+{
+    if(!scheduleCompile(&PumpSchedule, PumpScheduleWindows, sizeof(PumpScheduleWindows) / sizeof(PumpScheduleWindows[0])))
+    {
+        LOGE("Pump Schedule Invalid");
+    }
+}
+
+/**
+ * @brief Arms taskProcessTimer for the next schedule transition so the pump switches on time
+ *
+ * @return true if the timer is running or the schedule never changes, false if the time isn't set yet
+ */
+bool armScheduleTimer()
+{
+    struct timeval now;
+    time_t nextTransition;
+    int64_t delayMs;
+
+    if(!isTimeSet())
+    {
+        xTimerStop(taskProcessTimer, 0);
+        return false;
+    }
+
+    gettimeofday(&now, NULL);
+    nextTransition = scheduleNextTransition(&PumpSchedule, now.tv_sec);
+    if(nextTransition == 0)
+    {
+        xTimerStop(taskProcessTimer, 0);
+        return true;
+    }
+
+    delayMs = ((int64_t)(nextTransition - now.tv_sec) * 1000) - (now.tv_usec / 1000);
+    if(delayMs > (SCHEDULE_TIMER_MAX_SEC * 1000))
+    {
+        delayMs = SCHEDULE_TIMER_MAX_SEC * 1000;
+    }
+
+    // Round up a tick so the timer never expires just before the transition
+    xTimerChangePeriod(taskProcessTimer, (delayMs / portTICK_PERIOD_MS) + 1, 0);
+    return true;
+}
+
+/**
+ * @brief Arms minTimeTimer for the minimum run or off time deadline, if it is holding the pump
+ * in its current state
+ *
+ * @param commandedPumpState state the control logic asked for
+ */
+void armMinTimeTimer(PumpState_t commandedPumpState)
+{
+    int64_t remainingUs = PumpChangeAllowedUs - esp_timer_get_time();
+
+    esp_timer_stop(minTimeTimer);
+
+    if((commandedPumpState != PumpState) && (remainingUs > 0))
+    {
+        esp_timer_start_once(minTimeTimer, remainingUs);
+    }
+}
+
+/**
+ * @brief Compiles PUMP_RULES against the sensor names, time and settings variables. Rules that fail
+ * to compile are logged and no rules are run.
+ */
+void compilePumpRules()
+{
+    RuleCompileError_t error;
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        getTempSensorDefaultName(i, PumpRuleSensorNames[i], TEMP_SENSOR_NAME_LEN);
+        PumpRuleVarNames[i] = PumpRuleSensorNames[i];
+    }
+
+    PumpRuleVarNames[RULE_VAR_HOUR]         = "hour";
+    PumpRuleVarNames[RULE_VAR_MINUTE]       = "minute";
+    PumpRuleVarNames[RULE_VAR_WEEKDAY]      = "weekday";
+    PumpRuleVarNames[RULE_VAR_PUMP]         = "pump";
+    PumpRuleVarNames[RULE_VAR_MIN_AMBIENT]  = "minAmbient";
+    PumpRuleVarNames[RULE_VAR_AMBIENT_HYST] = "ambientHyst";
+    PumpRuleVarNames[RULE_VAR_MIN_WATER]    = "minWater";
+    PumpRuleVarNames[RULE_VAR_WATER_HYST]   = "waterHyst";
+
+    if(!rulesCompile(&PumpRules, PumpRuleSources, sizeof(PumpRuleSources) / sizeof(PumpRuleSources[0]),
+                     PumpRuleVarNames, RULE_VAR_COUNT, &error))
+    {
+        LOGE("Pump Rule %d Error at %d: %s", error.rule, error.position, error.message);
+    }
+}
+
+/**
+ * @brief Logic for pump control based on the compiled pump rules
+ * 
+ * @param settings Settings snapshot of this pass
+ * @return PumpState_t state to put pump in, on while any rule is true
+ */
+PumpState_t rulesControlLogic(const PumpSettings_t *settings)
+{
+    static uint32_t lastActiveRules = 0;
+
+    int32_t vars[RULE_VAR_COUNT];
+    TempSnapshot_t snapshot;
+    uint32_t activeRules;
+    struct tm timeInfo;
+    time_t now;
+
+    getTempSnapshot(&snapshot);
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        vars[i] = tempSnapshotFresh(&snapshot, i, TEMP_MAX_SAMPLE_AGE_MS) ? snapshot.temperatures[i] : RULES_VALUE_INVALID;
+    }
+
+    // Rules using the time are false until it is set
+    if(isTimeSet())
+    {
+        time(&now);
+        localtime_r(&now, &timeInfo);
+        vars[RULE_VAR_HOUR]    = timeInfo.tm_hour * RULES_FIXED_SCALE;
+        vars[RULE_VAR_MINUTE]  = timeInfo.tm_min * RULES_FIXED_SCALE;
+        vars[RULE_VAR_WEEKDAY] = timeInfo.tm_wday * RULES_FIXED_SCALE;
+    }
+    else
+    {
+        vars[RULE_VAR_HOUR]    = RULES_VALUE_INVALID;
+        vars[RULE_VAR_MINUTE]  = RULES_VALUE_INVALID;
+        vars[RULE_VAR_WEEKDAY] = RULES_VALUE_INVALID;
+    }
+
+    vars[RULE_VAR_PUMP]         = PumpRunning() ? RULES_TRUE : 0;
+    vars[RULE_VAR_MIN_AMBIENT]  = settings->minAmbientTemperature;
+    vars[RULE_VAR_AMBIENT_HYST] = settings->ambientTempHysteresis;
+    vars[RULE_VAR_MIN_WATER]    = settings->minWaterTemperature;
+    vars[RULE_VAR_WATER_HYST]   = settings->waterTempHysteresis;
+
+    activeRules = rulesEvaluate(&PumpRules, vars);
+
+    if(activeRules != lastActiveRules)
+    {
+        LOGI("Active Pump Rules: 0x%x", activeRules);
+        lastActiveRules = activeRules;
+    }
+
+    return (activeRules != 0) ? PUMP_STATE_ON : PUMP_STATE_OFF;
 }
 
 /**
- * @brief Increments the Pump State Timer
+ * @brief Sets the temperature sensor alarm thresholds to the temperatures that would change the
+ * decisions made by temperatureControlLogic(). Sensors are then only read when their temperature
+ * crosses one of these.
+ *
+ * @param settings Settings snapshot of this pass
  */
-void updatePumpStateTime()
+void updateTempAlarmThresholds(const PumpSettings_t *settings)
 {
-    PumpStateTimeSecs += PUMP_TASK_PERIOD_SEC;
+    // Only dropping below the minimum can turn a decision on, only rising above the hysteresis
+    // band can turn it off
+    if(AmbientTempPumpState == PUMP_STATE_OFF)
+    {
+        setTempAlarmThresholds(AMBIENT_TEMP_SENSOR, settings->minAmbientTemperature, TEMP_ALARM_NONE_HIGH);
+    }
+    else
+    {
+        setTempAlarmThresholds(AMBIENT_TEMP_SENSOR, TEMP_ALARM_NONE_LOW, settings->minAmbientTemperature + settings->ambientTempHysteresis);
+    }
+
+    if(WaterTempPumpState == PUMP_STATE_OFF)
+    {
+        setTempAlarmThresholds(WATER_TEMP_SENSOR, settings->minWaterTemperature, TEMP_ALARM_NONE_HIGH);
+    }
+    else
+    {
+        setTempAlarmThresholds(WATER_TEMP_SENSOR, TEMP_ALARM_NONE_LOW, settings->minWaterTemperature + settings->waterTempHysteresis);
+    }
 }
 
 /**
@@ -278,12 +1030,17 @@ void pumpStateControlLogic()
 {
     PumpState_t temperaturePumpState;
     PumpState_t schedulePumpState;
+    PumpState_t rulesPumpState;
     PumpState_t commandedPumpState;
 
-    temperaturePumpState = temperatureControlLogic();
+    // The whole pass runs on one settings snapshot, however settings change meanwhile
+    const PumpSettings_t *settings = acquirePumpSettings();
+
+    temperaturePumpState = temperatureControlLogic(settings);
     schedulePumpState = scheduleControlLogic();
+    rulesPumpState = rulesControlLogic(settings);
 
-    commandedPumpState = temperaturePumpState | schedulePumpState;
+    commandedPumpState = temperaturePumpState | schedulePumpState | rulesPumpState;
 
     if(commandedPumpState == PUMP_STATE_ON)
     {
@@ -293,39 +1050,42 @@ void pumpStateControlLogic()
     {
         pumpOff();
     }
+
+    armMinTimeTimer(commandedPumpState);
+    updateTempAlarmThresholds(settings);
+    retainPumpState();
 }
 
 /**
  * @brief 
- * Main Pump Control Logic Task
+ * Main Pump Control Logic Task. Sleeps until notified of a new temperature sample, a setting
+ * change, a schedule transition or the minimum run/off time elapsing. Also saves settings
+ * changes to NVS once they settle.
  * 
  * @param parameters Unused
  */
 void PumpControlTask(void * parameters)
 {
-    TickType_t LastWakeTime;
-    const TickType_t FunctionPeriod = PUMP_TASK_TICKS;
-
-    uint8_t queueValue;
-
-    // Initialise the LastWakeTime variable with the current time.
-    LastWakeTime = xTaskGetTickCount();
+    uint32_t events = 0;
+    bool scheduleArmed = false;
 
-    xTimerChangePeriod(taskProcessTimer, pdMS_TO_TICKS(2000), 0);
+    PumpControlTaskHandle = xTaskGetCurrentTaskHandle();
 
     while(true)
     {
-        // Wait for the next execution cycle.
-        vTaskDelayUntil( &LastWakeTime, FunctionPeriod );
+        pumpStateControlLogic();
 
-        // Timer experation check
-        if(xQueueReceive(timerQueue, &queueValue, 0))
+        // The schedule timer is rearmed when it expires, or until the time is set
+        if(!scheduleArmed || (events & PUMP_EVENT_SCHEDULE))
         {
-            ESP_LOGI("test", "Timer Expired, queueValue: %d", queueValue);
-            xTimerChangePeriod(taskProcessTimer, pdMS_TO_TICKS(2000), 0);
+            scheduleArmed = armScheduleTimer();
         }
 
-        updatePumpStateTime();
-        pumpStateControlLogic();
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+
+        if(events & PUMP_EVENT_SAVE)
+        {
+            savePumpSettings();
+        }
     }
-}
\ No newline at end of file
+}
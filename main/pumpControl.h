@@ -5,24 +5,54 @@
  * Contains the main control logic for controlling the Pool Pump
  */
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "temperature.h"
 
 typedef enum {
     PUMP_STATE_ON = true,
     PUMP_STATE_OFF = false
 } PumpState_t;
 
+/* Pump run statistics, since boot */
+typedef struct {
+    uint32_t runTimeSecs;           // Cumulative run time
+    uint32_t startCount;            // Times the pump was turned on
+    uint32_t stateTimeSecs;         // Time in the current state, including before a warm reboot
+    uint16_t dutyCyclePermille;     // Run time per 1000 of uptime
+} PumpStats_t;
+
+/**
+ * Pump settings, temperatures in fixed point 1/128 C. Settings are published as immutable
+ * snapshots, each with a new version, so a reader never sees part of an update.
+ */
+typedef struct {
+    uint32_t version;               // Incremented each time new settings are published
+    TempFixed_t minAmbientTemperature;
+    TempFixed_t ambientTempHysteresis;
+    TempFixed_t minWaterTemperature;
+    TempFixed_t waterTempHysteresis;
+    uint32_t predictHorizonSec;     // 0 disables prediction
+} PumpSettings_t;
+
 // Main Public Functions
 void PumpControlInit();
 void PumpControlTask(void * parameters);
 bool PumpRunning();
+void GetPumpStats(PumpStats_t *stats);
+
+// Configuration Getters and Setters, temperatures in fixed point 1/128 C
+void GetPumpSettings(PumpSettings_t *settings);
+esp_err_t SetPumpSettings(const PumpSettings_t *settings);
 
-// Configuration Getters and Setters
-float GetMinAmbientTemperature();
-float GetAmbientTempHysteresis();
-float GetMinWaterTemperature();
-float GetWaterTempHysteresis();
+TempFixed_t GetMinAmbientTemperature();
+TempFixed_t GetAmbientTempHysteresis();
+TempFixed_t GetMinWaterTemperature();
+TempFixed_t GetWaterTempHysteresis();
+uint32_t GetPredictHorizonSec();
 
-void SetMinAmbientTemperature(float temp);
-void SetAmbientTempHysteresis(float hysteresis);
-void SetMinWaterTemperature(float temp);
-void SetWaterTempHysteresis(float hysteresis);
+void SetMinAmbientTemperature(TempFixed_t temp);
+void SetAmbientTempHysteresis(TempFixed_t hysteresis);
+void SetMinWaterTemperature(TempFixed_t temp);
+void SetWaterTempHysteresis(TempFixed_t hysteresis);
+void SetPredictHorizonSec(uint32_t horizonSec);
@@ -0,0 +1,543 @@
+/**
+ * @file rules.c
+ *
+ * @brief
+ * Compiles pump rule expressions to stack bytecode once and evaluates them each control tick.
+ * The compiler is a recursive descent parser emitting postfix code, so evaluation is a single
+ * pass over the code with a fixed size stack. There are no jumps, evaluation time is bounded
+ * by the length of the code.
+ *
+ */
+
+// Project Includes
+#include "rules.h"
+
+// Standard Library Includes
+#include <ctype.h>
+#include <string.h>
+
+/* Bytecode operations */
+typedef enum
+{
+    OP_END = 0,     // End of rule, result is on top of stack
+    OP_CONST,       // Push 4 byte little endian constant that follows
+    OP_VAR,         // Push variable, 1 byte index follows
+    OP_ADD,
+    OP_SUB,
+    OP_NEG,
+    OP_NOT,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_AND,
+    OP_OR,
+} RuleOp_t;
+
+/* Largest whole part of a number in a rule, keeps fixed point values well inside int32 */
+#define RULES_MAX_NUMBER 1000000
+
+/* Compiler state for one rule */
+typedef struct
+{
+    RuleProgram_t *program;
+    const char *src;
+    const char *pos;
+    const char * const *varNames;
+    uint8_t varCount;
+    uint8_t depth;              // Evaluation stack depth at the current point of the code
+    const char *error;
+} RuleCompiler_t;
+
+// Private function prototypes
+static bool parseOr(RuleCompiler_t *c);
+
+/**
+ * @brief Skips whitespace in the rule source
+ */
+static void skipSpace(RuleCompiler_t *c)
+{
+    while(isspace((unsigned char)*c->pos))
+    {
+        c->pos++;
+    }
+}
+
+/**
+ * @brief Consumes a token if it is next in the source
+ *
+ * @return true if the token was consumed
+ */
+static bool accept(RuleCompiler_t *c, const char *token)
+{
+    size_t len = strlen(token);
+
+    skipSpace(c);
+    if(strncmp(c->pos, token, len) == 0)
+    {
+        c->pos += len;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Fails compilation at the current position
+ *
+ * @return false, so callers can return the result directly
+ */
+static bool fail(RuleCompiler_t *c, const char *message)
+{
+    if(c->error == NULL)
+    {
+        c->error = message;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Appends one byte of code
+ */
+static bool emit(RuleCompiler_t *c, uint8_t byte)
+{
+    if(c->program->codeLen >= RULES_CODE_SIZE)
+    {
+        return fail(c, "Rules too long");
+    }
+
+    c->program->code[c->program->codeLen++] = byte;
+    return true;
+}
+
+/**
+ * @brief Appends an operation and tracks the stack depth it leaves
+ *
+ * @param op Operation
+ * @param pops Values the operation takes off the stack
+ * @param pushes Values the operation leaves on the stack
+ */
+static bool emitOp(RuleCompiler_t *c, RuleOp_t op, uint8_t pops, uint8_t pushes)
+{
+    c->depth = c->depth - pops + pushes;
+    if(c->depth > RULES_STACK_DEPTH)
+    {
+        return fail(c, "Rule too complex");
+    }
+
+    return emit(c, op);
+}
+
+/**
+ * @brief Parses a decimal number and emits it as a fixed point constant
+ */
+static bool parseNumber(RuleCompiler_t *c)
+{
+    int32_t whole = 0;
+    int32_t fraction = 0;
+    int32_t divisor = 1;
+    int32_t value;
+
+    while(isdigit((unsigned char)*c->pos))
+    {
+        whole = (whole * 10) + (*c->pos++ - '0');
+        if(whole > RULES_MAX_NUMBER)
+        {
+            return fail(c, "Number too large");
+        }
+    }
+
+    if(*c->pos == '.')
+    {
+        c->pos++;
+        while(isdigit((unsigned char)*c->pos))
+        {
+            // Digits past the fixed point resolution are ignored
+            if(divisor < 10000)
+            {
+                fraction = (fraction * 10) + (*c->pos - '0');
+                divisor *= 10;
+            }
+            c->pos++;
+        }
+    }
+
+    value = (whole * RULES_FIXED_SCALE) + (((fraction * RULES_FIXED_SCALE) + (divisor / 2)) / divisor);
+
+    if(!emitOp(c, OP_CONST, 0, 1))
+    {
+        return false;
+    }
+
+    for(uint8_t i = 0; i < sizeof(value); i++)
+    {
+        if(!emit(c, (uint8_t)((uint32_t)value >> (8 * i))))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Parses a variable name and emits a load of it
+ */
+static bool parseVariable(RuleCompiler_t *c)
+{
+    const char *start = c->pos;
+    size_t len;
+
+    while(isalnum((unsigned char)*c->pos) || (*c->pos == '_'))
+    {
+        c->pos++;
+    }
+    len = c->pos - start;
+
+    for(uint8_t i = 0; i < c->varCount; i++)
+    {
+        if((c->varNames[i] != NULL) && (strlen(c->varNames[i]) == len) && (strncmp(start, c->varNames[i], len) == 0))
+        {
+            return emitOp(c, OP_VAR, 0, 1) && emit(c, i);
+        }
+    }
+
+    c->pos = start;
+    return fail(c, "Unknown variable");
+}
+
+/**
+ * @brief unary := '!' unary | '-' unary | '(' or ')' | number | variable
+ */
+static bool parseUnary(RuleCompiler_t *c)
+{
+    if(accept(c, "!"))
+    {
+        return parseUnary(c) && emitOp(c, OP_NOT, 1, 1);
+    }
+
+    if(accept(c, "-"))
+    {
+        return parseUnary(c) && emitOp(c, OP_NEG, 1, 1);
+    }
+
+    if(accept(c, "("))
+    {
+        if(!parseOr(c))
+        {
+            return false;
+        }
+
+        return accept(c, ")") ? true : fail(c, "Expected )");
+    }
+
+    skipSpace(c);
+    if(isdigit((unsigned char)*c->pos) || (*c->pos == '.'))
+    {
+        return parseNumber(c);
+    }
+
+    if(isalpha((unsigned char)*c->pos) || (*c->pos == '_'))
+    {
+        return parseVariable(c);
+    }
+
+    return fail(c, "Expected value");
+}
+
+/**
+ * @brief sum := unary (('+' | '-') unary)*
+ */
+static bool parseSum(RuleCompiler_t *c)
+{
+    RuleOp_t op;
+
+    if(!parseUnary(c))
+    {
+        return false;
+    }
+
+    while(true)
+    {
+        if(accept(c, "+"))
+        {
+            op = OP_ADD;
+        }
+        else if(accept(c, "-"))
+        {
+            op = OP_SUB;
+        }
+        else
+        {
+            return true;
+        }
+
+        if(!parseUnary(c) || !emitOp(c, op, 2, 1))
+        {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief compare := sum (('==' | '!=' | '<=' | '>=' | '<' | '>') sum)?
+ */
+static bool parseCompare(RuleCompiler_t *c)
+{
+    RuleOp_t op;
+
+    if(!parseSum(c))
+    {
+        return false;
+    }
+
+    // Two character operators first so '<' doesn't match the start of '<='
+    if(accept(c, "=="))
+    {
+        op = OP_EQ;
+    }
+    else if(accept(c, "!="))
+    {
+        op = OP_NE;
+    }
+    else if(accept(c, "<="))
+    {
+        op = OP_LE;
+    }
+    else if(accept(c, ">="))
+    {
+        op = OP_GE;
+    }
+    else if(accept(c, "<"))
+    {
+        op = OP_LT;
+    }
+    else if(accept(c, ">"))
+    {
+        op = OP_GT;
+    }
+    else
+    {
+        return true;
+    }
+
+    return parseSum(c) && emitOp(c, op, 2, 1);
+}
+
+/**
+ * @brief and := compare ('&&' compare)*
+ */
+static bool parseAnd(RuleCompiler_t *c)
+{
+    if(!parseCompare(c))
+    {
+        return false;
+    }
+
+    while(accept(c, "&&"))
+    {
+        if(!parseCompare(c) || !emitOp(c, OP_AND, 2, 1))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief or := and ('||' and)*
+ */
+static bool parseOr(RuleCompiler_t *c)
+{
+    if(!parseAnd(c))
+    {
+        return false;
+    }
+
+    while(accept(c, "||"))
+    {
+        if(!parseAnd(c) || !emitOp(c, OP_OR, 2, 1))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief
+ * Compiles a set of rules. Nothing is allocated, all code is stored in the program.
+ *
+ * @param program Program to compile into
+ * @param rules Rule expressions
+ * @param ruleCount Number of rules, up to RULES_MAX
+ * @param varNames Names of the variables rules can use, indexed like the vars passed to rulesEvaluate()
+ * @param varCount Number of variables, up to 256
+ * @param error Set to the location of the first error when compilation fails, may be NULL
+ * @return true if all rules compiled, false leaves the program empty
+ */
+bool rulesCompile(RuleProgram_t *program, const char * const *rules, uint8_t ruleCount,
+                  const char * const *varNames, uint8_t varCount, RuleCompileError_t *error)
+{
+    RuleCompiler_t c;
+
+    memset(program, 0, sizeof(RuleProgram_t));
+
+    if(ruleCount > RULES_MAX)
+    {
+        if(error != NULL)
+        {
+            error->rule = RULES_MAX;
+            error->position = 0;
+            error->message = "Too many rules";
+        }
+        return false;
+    }
+
+    c.program = program;
+    c.varNames = varNames;
+    c.varCount = varCount;
+
+    for(uint8_t r = 0; r < ruleCount; r++)
+    {
+        c.src = rules[r];
+        c.pos = rules[r];
+        c.depth = 0;
+        c.error = NULL;
+
+        program->ruleStart[r] = program->codeLen;
+
+        if(parseOr(&c))
+        {
+            skipSpace(&c);
+            if(*c.pos != '\0')
+            {
+                fail(&c, "Unexpected character");
+            }
+        }
+
+        if((c.error == NULL) && !emit(&c, OP_END))
+        {
+            fail(&c, "Rules too long");
+        }
+
+        if(c.error != NULL)
+        {
+            if(error != NULL)
+            {
+                error->rule = r;
+                error->position = c.pos - c.src;
+                error->message = c.error;
+            }
+
+            memset(program, 0, sizeof(RuleProgram_t));
+            return false;
+        }
+    }
+
+    program->ruleCount = ruleCount;
+    program->varCount = varCount;
+
+    return true;
+}
+
+/**
+ * @brief Checks if a rule value counts as true. Invalid values are never true.
+ */
+static inline bool isTrue(int32_t value)
+{
+    return (value != 0) && (value != RULES_VALUE_INVALID);
+}
+
+/**
+ * @brief
+ * Evaluates every rule of a compiled program. Runs in time bounded by the code length and
+ * uses a fixed size stack.
+ *
+ * @param program Compiled rules
+ * @param vars Variable values, program->varCount entries in the order of the names compiled against
+ * @return Bit mask of rules that are true, bit 0 for the first rule
+ */
+uint32_t rulesEvaluate(const RuleProgram_t *program, const int32_t *vars)
+{
+    int32_t stack[RULES_STACK_DEPTH];
+    uint32_t result = 0;
+    const uint8_t *pc;
+    uint8_t sp;
+    int32_t a;
+    int32_t b;
+    bool invalid;
+
+    for(uint8_t r = 0; r < program->ruleCount; r++)
+    {
+        pc = &program->code[program->ruleStart[r]];
+        sp = 0;
+
+        while(*pc != OP_END)
+        {
+            switch(*pc++)
+            {
+                case OP_CONST:
+                    stack[sp++] = (int32_t)((uint32_t)pc[0] | ((uint32_t)pc[1] << 8) | ((uint32_t)pc[2] << 16) | ((uint32_t)pc[3] << 24));
+                    pc += 4;
+                    break;
+
+                case OP_VAR:
+                    stack[sp++] = vars[*pc++];
+                    break;
+
+                case OP_NEG:
+                    a = stack[sp - 1];
+                    stack[sp - 1] = (a == RULES_VALUE_INVALID) ? a : -a;
+                    break;
+
+                case OP_NOT:
+                    a = stack[sp - 1];
+                    stack[sp - 1] = (a == RULES_VALUE_INVALID) ? a : ((a != 0) ? 0 : RULES_TRUE);
+                    break;
+
+                default:
+                    // Binary operations
+                    b = stack[--sp];
+                    a = stack[sp - 1];
+                    invalid = (a == RULES_VALUE_INVALID) || (b == RULES_VALUE_INVALID);
+
+                    switch(pc[-1])
+                    {
+                        case OP_ADD:    a = invalid ? RULES_VALUE_INVALID : a + b;      break;
+                        case OP_SUB:    a = invalid ? RULES_VALUE_INVALID : a - b;      break;
+                        case OP_EQ:     a = invalid ? RULES_VALUE_INVALID : ((a == b) ? RULES_TRUE : 0);    break;
+                        case OP_NE:     a = invalid ? RULES_VALUE_INVALID : ((a != b) ? RULES_TRUE : 0);    break;
+                        case OP_LT:     a = invalid ? RULES_VALUE_INVALID : ((a < b) ? RULES_TRUE : 0);     break;
+                        case OP_LE:     a = invalid ? RULES_VALUE_INVALID : ((a <= b) ? RULES_TRUE : 0);    break;
+                        case OP_GT:     a = invalid ? RULES_VALUE_INVALID : ((a > b) ? RULES_TRUE : 0);     break;
+                        case OP_GE:     a = invalid ? RULES_VALUE_INVALID : ((a >= b) ? RULES_TRUE : 0);    break;
+
+                        // A false side decides &&, a true side decides ||, whatever the other side is
+                        case OP_AND:
+                            a = ((a == 0) || (b == 0)) ? 0 : (invalid ? RULES_VALUE_INVALID : RULES_TRUE);
+                            break;
+                        case OP_OR:
+                            a = (isTrue(a) || isTrue(b)) ? RULES_TRUE : (invalid ? RULES_VALUE_INVALID : 0);
+                            break;
+                        default:        a = RULES_VALUE_INVALID;                        break;
+                    }
+
+                    stack[sp - 1] = a;
+                    break;
+            }
+        }
+
+        if((sp != 0) && isTrue(stack[sp - 1]))
+        {
+            result |= (1UL << r);
+        }
+    }
+
+    return result;
+}
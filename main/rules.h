@@ -0,0 +1,70 @@
+#pragma once
+/**
+ * @file rules.h
+ *
+ * @brief
+ * Compiles pump rule expressions to bytecode once and evaluates them each control tick in
+ * bounded time without allocating.
+ *
+ * Rule syntax, C like with the usual precedence:
+ *      water < 35 || (ambient < 3 && hour >= 0 && hour < 6) || solar - water > 8
+ *
+ * The last rule would run the pump while a solar collector sensor named "solar" is more than
+ * 8C above the water.
+ *
+ *  Operators   : || && ! == != < <= > >= + - and parentheses
+ *  Numbers     : Decimal, in the unit of the variable they are compared with (C, hours, ...)
+ *  Variables   : Names passed to rulesCompile()
+ *
+ * All values are fixed point with RULES_FIXED_SCALE steps per unit, the same scale as TempFixed_t.
+ * Comparisons and logic operators give RULES_TRUE or 0. A variable set to RULES_VALUE_INVALID
+ * (e.g. a disconnected sensor) makes any comparison it takes part in invalid. ! keeps a value
+ * invalid, && is false if either side is false and || true if either side is true, otherwise
+ * they are invalid too. A rule that is invalid is false, so !(water > 30) doesn't run the pump
+ * while the water sensor is disconnected.
+ */
+
+// Standard Library Includes
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Max number of rules in a program */
+#define RULES_MAX 16
+
+/* Bytecode storage shared by all rules of a program */
+#define RULES_CODE_SIZE 1024
+
+/* Max evaluation stack depth of a rule, deeper expressions fail to compile */
+#define RULES_STACK_DEPTH 16
+
+/* Fixed point scale of all rule values */
+#define RULES_FIXED_SCALE 128
+
+/* Value of a true comparison */
+#define RULES_TRUE RULES_FIXED_SCALE
+
+/* Value of a variable that has no valid reading */
+#define RULES_VALUE_INVALID INT32_MIN
+
+/* Compiled rules */
+typedef struct
+{
+    uint8_t code[RULES_CODE_SIZE];
+    uint16_t ruleStart[RULES_MAX];  // Offset of each rule's code
+    uint16_t codeLen;
+    uint8_t ruleCount;
+    uint8_t varCount;               // Variables the rules were compiled against
+} RuleProgram_t;
+
+/* Where and why a rule failed to compile */
+typedef struct
+{
+    uint8_t rule;
+    uint16_t position;              // Character offset in the rule
+    const char *message;
+} RuleCompileError_t;
+
+/* Public Function Prototypes */
+bool rulesCompile(RuleProgram_t *program, const char * const *rules, uint8_t ruleCount,
+                  const char * const *varNames, uint8_t varCount, RuleCompileError_t *error);
+uint32_t rulesEvaluate(const RuleProgram_t *program, const int32_t *vars);
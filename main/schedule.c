@@ -0,0 +1,348 @@
+/**
+ * @file schedule.c
+ *
+ * @brief
+ * Weekly run schedule compiled to a transition table with an hour of week index.
+ *
+ */
+
+// Project Includes
+#include "schedule.h"
+
+// Standard Library Includes
+#include <string.h>
+
+#define MINUTES_PER_DAY (24 * 60)
+
+/* Window split at the end of the week, in minutes of the week */
+typedef struct
+{
+    uint16_t start;
+    uint16_t end;
+} ScheduleInterval_t;
+
+/**
+ * @brief Gets the local minute of the week of a time
+ */
+static uint16_t minuteOfWeek(const struct tm *timeInfo)
+{
+    return (timeInfo->tm_wday * MINUTES_PER_DAY) + (timeInfo->tm_hour * 60) + timeInfo->tm_min;
+}
+
+/**
+ * @brief Finds the first transition after a minute of the week. Only the transitions within
+ * the minute's hour are scanned, starting from the hour index.
+ *
+ * @param schedule Compiled schedule with at least one transition
+ * @param minute Minute of the week
+ * @param inclusive Include a transition at the minute
+ * @return Index of transition, schedule->count if there are none before the end of the week
+ */
+static uint8_t transitionAfter(const Schedule_t *schedule, uint16_t minute, bool inclusive)
+{
+    uint8_t i = schedule->hourIndex[minute / 60];
+
+    while((i < schedule->count) && ((schedule->transitions[i].minute < minute) ||
+                                    (!inclusive && (schedule->transitions[i].minute == minute))))
+    {
+        i++;
+    }
+
+    return i;
+}
+
+/**
+ * @brief Converts a local wall clock time to a time after now. A time in the hour repeated
+ * when DST ends is tried with both offsets.
+ *
+ * @return Converted time, or 0 if it is not after now
+ */
+static time_t wallClockToTime(const struct tm *wallClock, time_t now)
+{
+    struct tm target = *wallClock;
+    time_t converted;
+
+    target.tm_isdst = -1;
+    converted = mktime(&target);
+    if(converted > now)
+    {
+        return converted;
+    }
+
+    target = *wallClock;
+    target.tm_isdst = 0;
+    converted = mktime(&target);
+
+    return (converted > now) ? converted : 0;
+}
+
+/**
+ * @brief Finds the next transition by stepping the wall clock forward from a local time
+ *
+ * @param schedule Compiled schedule with at least one transition
+ * @param from Local time to step from
+ * @param inclusive Include a transition at from's minute
+ * @param now Transitions at or before now are skipped
+ * @return Time of the transition, or 0 if none maps after now
+ */
+static time_t nextTransitionFrom(const Schedule_t *schedule, const struct tm *from, bool inclusive, time_t now)
+{
+    struct tm target;
+    uint16_t minute = minuteOfWeek(from);
+    uint8_t next = transitionAfter(schedule, minute, inclusive);
+    uint32_t minutesAhead;
+    time_t transitionTime;
+
+    for(uint8_t attempt = 0; attempt <= schedule->count; attempt++)
+    {
+        if(next >= schedule->count)
+        {
+            next = 0;
+        }
+
+        minutesAhead = (schedule->transitions[next].minute + SCHEDULE_MINUTES_PER_WEEK - minute) % SCHEDULE_MINUTES_PER_WEEK;
+        if((minutesAhead == 0) && !inclusive)
+        {
+            minutesAhead = SCHEDULE_MINUTES_PER_WEEK;
+        }
+
+        // Step in wall clock time and let mktime() normalize it and pick the DST offset
+        target = *from;
+        target.tm_sec = 0;
+        target.tm_min += minutesAhead;
+        transitionTime = wallClockToTime(&target, now);
+
+        if(transitionTime != 0)
+        {
+            return transitionTime;
+        }
+
+        inclusive = false;
+        next++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief
+ * Compiles run windows into a schedule. Overlapping windows are merged.
+ *
+ * @param schedule Schedule to compile into
+ * @param windows Run windows
+ * @param windowCount Number of windows, up to SCHEDULE_MAX_WINDOWS
+ * @return true if compiled, false if there are too many windows or a time is past midnight
+ */
+bool scheduleCompile(Schedule_t *schedule, const ScheduleWindow_t *windows, uint8_t windowCount)
+{
+    ScheduleInterval_t intervals[SCHEDULE_MAX_TRANSITIONS];
+    ScheduleInterval_t interval;
+    uint8_t intervalCount = 0;
+    uint8_t merged = 0;
+    uint32_t start;
+    uint32_t end;
+    uint8_t t;
+
+    memset(schedule, 0, sizeof(Schedule_t));
+
+    if(windowCount > SCHEDULE_MAX_WINDOWS)
+    {
+        return false;
+    }
+
+    // Expand windows to intervals in minutes of the week, split at the end of the week
+    for(uint8_t w = 0; w < windowCount; w++)
+    {
+        if((windows[w].start >= MINUTES_PER_DAY) || (windows[w].end > MINUTES_PER_DAY))
+        {
+            return false;
+        }
+
+        for(uint8_t day = 0; day < 7; day++)
+        {
+            if(!(windows[w].days & (1 << day)))
+            {
+                continue;
+            }
+
+            start = (day * MINUTES_PER_DAY) + windows[w].start;
+            end = (day * MINUTES_PER_DAY) + windows[w].end;
+            if(windows[w].end <= windows[w].start)
+            {
+                end += MINUTES_PER_DAY;
+            }
+
+            if(end > SCHEDULE_MINUTES_PER_WEEK)
+            {
+                intervals[intervalCount++] = (ScheduleInterval_t){ 0, end - SCHEDULE_MINUTES_PER_WEEK };
+                end = SCHEDULE_MINUTES_PER_WEEK;
+            }
+            intervals[intervalCount++] = (ScheduleInterval_t){ start, end };
+        }
+    }
+
+    // Sort by start, there are few enough intervals for an insertion sort
+    for(uint8_t i = 1; i < intervalCount; i++)
+    {
+        interval = intervals[i];
+        for(t = i; (t > 0) && (intervals[t - 1].start > interval.start); t--)
+        {
+            intervals[t] = intervals[t - 1];
+        }
+        intervals[t] = interval;
+    }
+
+    // Merge overlapping and touching intervals
+    for(uint8_t i = 0; i < intervalCount; i++)
+    {
+        if((merged > 0) && (intervals[i].start <= intervals[merged - 1].end))
+        {
+            if(intervals[i].end > intervals[merged - 1].end)
+            {
+                intervals[merged - 1].end = intervals[i].end;
+            }
+        }
+        else
+        {
+            intervals[merged++] = intervals[i];
+        }
+    }
+
+    if((merged == 1) && (intervals[0].start == 0) && (intervals[0].end == SCHEDULE_MINUTES_PER_WEEK))
+    {
+        schedule->alwaysOn = true;
+        return true;
+    }
+
+    // Emit transitions. An interval running to the end of the week continues into one starting
+    // at minute 0, neither needs a transition at the week boundary.
+    for(uint8_t i = 0; i < merged; i++)
+    {
+        bool wrapsIn = (intervals[i].start == 0) && (intervals[merged - 1].end == SCHEDULE_MINUTES_PER_WEEK);
+        bool wrapsOut = (intervals[i].end == SCHEDULE_MINUTES_PER_WEEK) && (intervals[0].start == 0);
+
+        if(!wrapsIn)
+        {
+            schedule->transitions[schedule->count++] = (ScheduleTransition_t){ intervals[i].start, true };
+        }
+        if(!wrapsOut)
+        {
+            schedule->transitions[schedule->count++] = (ScheduleTransition_t){ intervals[i].end % SCHEDULE_MINUTES_PER_WEEK, false };
+        }
+    }
+
+    // A wrapped interval's off transition at the start of the week sorts before the on transitions
+    for(uint8_t i = 1; i < schedule->count; i++)
+    {
+        ScheduleTransition_t transition = schedule->transitions[i];
+        for(t = i; (t > 0) && (schedule->transitions[t - 1].minute > transition.minute); t--)
+        {
+            schedule->transitions[t] = schedule->transitions[t - 1];
+        }
+        schedule->transitions[t] = transition;
+    }
+
+    // Index the first transition at or after the start of each hour
+    t = 0;
+    for(uint16_t hour = 0; hour < SCHEDULE_HOURS_PER_WEEK; hour++)
+    {
+        while((t < schedule->count) && (schedule->transitions[t].minute < (hour * 60)))
+        {
+            t++;
+        }
+        schedule->hourIndex[hour] = t;
+    }
+
+    return true;
+}
+
+/**
+ * @brief
+ * Checks if the schedule is on at a time
+ *
+ * @param schedule Compiled schedule
+ * @param time Time to check, converted to local time with the current TZ
+ * @return true if a run window covers the time
+ */
+bool scheduleStateAt(const Schedule_t *schedule, time_t time)
+{
+    struct tm timeInfo;
+    uint8_t next;
+
+    if(schedule->alwaysOn || (schedule->count == 0))
+    {
+        return schedule->alwaysOn;
+    }
+
+    localtime_r(&time, &timeInfo);
+    next = transitionAfter(schedule, minuteOfWeek(&timeInfo), false);
+
+    // State set by the last transition at or before now, wrapping to the end of the previous week
+    return (next == 0) ? schedule->transitions[schedule->count - 1].on : schedule->transitions[next - 1].on;
+}
+
+/**
+ * @brief
+ * Calculates the time of the next transition after now. Transitions follow the wall clock, the
+ * wall clock time of the next transition is converted with mktime() so a DST change before it is
+ * accounted for. A transition in the hour skipped when DST starts happens when the clock jumps
+ * past it, transitions in the hour repeated when DST ends happen in both passes.
+ *
+ * @param schedule Compiled schedule
+ * @param now Current time
+ * @return Time of next transition, or 0 if the schedule never changes state
+ */
+time_t scheduleNextTransition(const Schedule_t *schedule, time_t now)
+{
+    struct tm nowInfo;
+    struct tm nextInfo;
+    struct tm changeInfo;
+    time_t next;
+    time_t repeated;
+    time_t low;
+    time_t high;
+    time_t mid;
+
+    if(schedule->alwaysOn || (schedule->count == 0))
+    {
+        return 0;
+    }
+
+    localtime_r(&now, &nowInfo);
+    next = nextTransitionFrom(schedule, &nowInfo, false, now);
+    if(next == 0)
+    {
+        return 0;
+    }
+
+    // If DST ends before the next transition the wall clock goes back, and transitions in the
+    // repeated hour come round again. Find when DST ends and look again from there.
+    localtime_r(&next, &nextInfo);
+    if((nowInfo.tm_isdst > 0) && (nextInfo.tm_isdst == 0))
+    {
+        low = now;
+        high = next;
+        while((high - low) > 1)
+        {
+            mid = low + ((high - low) / 2);
+            localtime_r(&mid, &changeInfo);
+            if(changeInfo.tm_isdst > 0)
+            {
+                low = mid;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+
+        localtime_r(&high, &changeInfo);
+        repeated = nextTransitionFrom(schedule, &changeInfo, true, now);
+        if((repeated != 0) && (repeated < next))
+        {
+            next = repeated;
+        }
+    }
+
+    return next;
+}
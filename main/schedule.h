@@ -0,0 +1,69 @@
+#pragma once
+/**
+ * @file schedule.h
+ *
+ * @brief
+ * Weekly run schedule. Run windows are compiled once into a sorted table of on/off transitions
+ * by minute of the week, with an index by hour of the week so the state at a time and the next
+ * transition are found without searching the table. Windows are in local time, transitions
+ * follow the wall clock across DST changes of the TZ in effect.
+ *
+ */
+
+// Standard Library Includes
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Day masks for ScheduleWindow_t, bit 0 is Sunday */
+#define SCHEDULE_SUNDAY     (1 << 0)
+#define SCHEDULE_MONDAY     (1 << 1)
+#define SCHEDULE_TUESDAY    (1 << 2)
+#define SCHEDULE_WEDNESDAY  (1 << 3)
+#define SCHEDULE_THURSDAY   (1 << 4)
+#define SCHEDULE_FRIDAY     (1 << 5)
+#define SCHEDULE_SATURDAY   (1 << 6)
+#define SCHEDULE_WEEKDAYS   0x3E
+#define SCHEDULE_WEEKENDS   0x41
+#define SCHEDULE_EVERY_DAY  0x7F
+
+/* Max run windows in a schedule */
+#define SCHEDULE_MAX_WINDOWS 8
+
+/* Each window can add an on and off transition for every day of the week */
+#define SCHEDULE_MAX_TRANSITIONS (SCHEDULE_MAX_WINDOWS * 7 * 2)
+
+#define SCHEDULE_MINUTES_PER_WEEK (7 * 24 * 60)
+#define SCHEDULE_HOURS_PER_WEEK (7 * 24)
+
+/**
+ * Run window. Runs from start until end minutes after local midnight on each day in days. A
+ * window whose end is at or before its start runs past midnight into the next day.
+ */
+typedef struct
+{
+    uint8_t days;
+    uint16_t start;
+    uint16_t end;
+} ScheduleWindow_t;
+
+/* State change at a minute of the week, minute 0 is Sunday 00:00 local time */
+typedef struct
+{
+    uint16_t minute;
+    bool on;
+} ScheduleTransition_t;
+
+/* Compiled schedule */
+typedef struct
+{
+    ScheduleTransition_t transitions[SCHEDULE_MAX_TRANSITIONS];    // Sorted by minute, alternating on and off
+    uint8_t hourIndex[SCHEDULE_HOURS_PER_WEEK];                     // First transition at or after each hour
+    uint8_t count;
+    bool alwaysOn;                                                  // Windows cover the whole week
+} Schedule_t;
+
+/* Public Function Prototypes */
+bool scheduleCompile(Schedule_t *schedule, const ScheduleWindow_t *windows, uint8_t windowCount);
+bool scheduleStateAt(const Schedule_t *schedule, time_t time);
+time_t scheduleNextTransition(const Schedule_t *schedule, time_t now);
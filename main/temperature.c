@@ -11,39 +11,452 @@
 #include "projectLog.h"
 #include "temperature.h"
 
+// ESP IDF Includes
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_task.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Standard Library Includes
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
 
 // DS18B20 Driver
 #include "ds18b20.h"
 
-/* List of Connected Device Addresses */
-DeviceAddress TempSensors[TEMP_SENSOR_COUNT];
+/* NVS location of the cached sensor registry */
+#define TEMP_NVS_NAMESPACE "temperature"
+#define TEMP_NVS_ROM_KEY "sensorRoms"
+
+/* Bus index of an unused registry slot */
+#define TEMP_BUS_NONE 0xFF
+
+/* Marks RetainedTemps as written by this firmware, together with its CRC */
+#define TEMP_RETAINED_MAGIC 0x544D5052
+
+/* Part of a registry entry persisted to NVS */
+typedef struct
+{
+    char name[TEMP_SENSOR_NAME_LEN];
+    uint8_t bus;                // Index into TempBusConfigs, TEMP_BUS_NONE if the slot is unused
+    DeviceAddress address;
+} TempSensorRom_t;
+
+/* Temperature sensor registry entry */
+typedef struct
+{
+    TempSensorRom_t rom;
+    bool missing;               // Did not respond at its known address and needs to be searched for
+    TempFixed_t thresholdLow;   // Thresholds the alarm registers were derived from
+    TempFixed_t thresholdHigh;
+    int8_t alarmLow;            // Alarm registers (TL/TH) requested for the sensor
+    int8_t alarmHigh;
+    bool alarmWritePending;     // Alarm registers waiting to be written by the acquisition task
+    bool alarmActive;           // Sensor holds the requested alarm registers and can be skipped while it doesn't report an alarm
+    uint8_t resolution;         // Resolution read back from the configuration register, 0 if unknown
+    TempFixed_t lastTemperature;    // Last reading published by the acquisition task
+    TempSensorHealth_t health;
+} TempSensor_t;
+
+/* Runtime state of a 1-Wire bus */
+typedef struct
+{
+    ds18b20_bus_t driver;
+    bool searchPending;                 // Acquisition task should search the bus for missing sensors
+    uint8_t sweepCount;
+    ds18b20_busStats_t lastSweepStats;  // Bus time used and saved during the last complete sweep
+} TempBus_t;
+
+/* Names of the sensor roles, indexed by TempSensorId */
+const char * const TempSensorRoleNames[TEMP_SENSOR_ROLE_COUNT] = 
+{
+    "ambient",
+    "water",
+    "solar",
+    "heaterReturn",
+    "filterOutlet",
+};
+
+/* Configured 1-Wire buses */
+const TempBusConfig_t TempBusConfigs[] = TEMP_SENSOR_BUSES;
+#define TEMP_BUS_COUNT (sizeof(TempBusConfigs) / sizeof(TempBusConfigs[0]))
+
+TempBus_t TempBuses[TEMP_BUS_COUNT];
+
+/** 
+ * Sensor registry, indexed by TempSensorId. Each sensor belongs to the acquisition task of its bus,
+ * slots are only assigned under RegistryLock as any bus task can take a free slot.
+ */
+TempSensor_t TempSensors[TEMP_SENSOR_MAX];
+
+/* Protects registry slot assignment and alarm thresholds set from other tasks */
+portMUX_TYPE RegistryLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Published temperatures, a seqlock. Bus tasks publish under SnapshotWriteLock with SnapshotSeq
+ * odd while the snapshot is being written. Readers copy without locking and retry if SnapshotSeq
+ * was odd or changed during the copy.
+ */
+TempSnapshot_t Snapshot;
+uint32_t SnapshotSeq = 0;
+portMUX_TYPE SnapshotWriteLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Last published temperatures in RTC slow memory, which holds its contents through every reset
+ * but power on. After a warm reboot they are published again until the first sample, so control
+ * doesn't wait for the buses. Written with the snapshot under SnapshotWriteLock.
+ */
+typedef struct
+{
+    uint32_t magic;
+    TempFixed_t temperatures[TEMP_SENSOR_MAX];
+    uint32_t crc;                   // Of everything before it
+} TempRetained_t;
+
+RTC_NOINIT_ATTR TempRetained_t RetainedTemps;
+
+/* Temperature acquisition states */
+typedef enum
+{
+    TEMP_ACQ_IDLE = 0,          // Conversion running, waiting for the next sample period
+    TEMP_ACQ_CONVERTING,        // Polling bus for conversion complete
+    TEMP_ACQ_READING,           // Reading scratchpads and publishing sample
+} TempAcqState_t;
+
+/* Callbacks to run when a new sample is published */
+TempSampleCallback_t SampleCallbacks[TEMP_MAX_SAMPLE_CALLBACKS];
+void * SampleCallbackArgs[TEMP_MAX_SAMPLE_CALLBACKS];
+uint8_t SampleCallbackCount = 0;
+
+// Private function prototypes
+void findAlarmedSensors(uint8_t busIndex, bool *alarmed);
+void writeAlarmThresholds(uint8_t busIndex);
+void readTemperatures(uint8_t busIndex, TempFixed_t *temperatures);
+void publishTemperatures(uint8_t busIndex, const TempFixed_t *temperatures);
+void updateResolutions(uint8_t busIndex, const TempFixed_t *temperatures);
+void tempAcquisitionTask(void * parameters);
+void restoreTemperatures();
+
+/**
+ * @brief Checks if a registry slot holds a sensor on a bus
+ * 
+ * @param id Registry slot
+ * @param busIndex Bus to check for
+ * @return true if the sensor belongs to the bus
+ */
+static inline bool sensorOnBus(uint8_t id, uint8_t busIndex)
+{
+    return TempSensors[id].rom.bus == busIndex;
+}
+
+/**
+ * @brief Frees every registry slot
+ */
+void clearSensorRegistry()
+{
+    memset(TempSensors, 0, sizeof(TempSensors));
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        TempSensors[i].rom.bus = TEMP_BUS_NONE;
+        TempSensors[i].thresholdLow = TEMP_ALARM_NONE_LOW;
+        TempSensors[i].thresholdHigh = TEMP_ALARM_NONE_HIGH;
+        TempSensors[i].lastTemperature = TEMP_FIXED_DISCONNECTED;
+    }
+}
+
+/**
+ * @brief Loads the sensor registry saved by the last search. Sensors on buses that are no
+ * longer configured are dropped.
+ * 
+ * @return ESP_OK if the registry was loaded
+ */
+esp_err_t loadSensorRoms()
+{
+    nvs_handle_t nvsHandle;
+    TempSensorRom_t roms[TEMP_SENSOR_MAX];
+    size_t len = sizeof(roms);
+    esp_err_t err;
+
+    clearSensorRegistry();
+
+    err = nvs_open(TEMP_NVS_NAMESPACE, NVS_READONLY, &nvsHandle);
+    if(err != ESP_OK)
+    {
+        return err;
+    }
+
+    err = nvs_get_blob(nvsHandle, TEMP_NVS_ROM_KEY, roms, &len);
+    nvs_close(nvsHandle);
+
+    // Blobs saved before the registry existed have a different size and are ignored
+    if((err == ESP_OK) && (len != sizeof(roms)))
+    {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+
+    if(err != ESP_OK)
+    {
+        return err;
+    }
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(roms[i].bus < TEMP_BUS_COUNT)
+        {
+            TempSensors[i].rom = roms[i];
+            TempSensors[i].rom.name[TEMP_SENSOR_NAME_LEN - 1] = '\0';
+        }
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Saves the sensor registry so the next boot doesn't need to search
+ * 
+ * @return ESP_OK if saved
+ */
+esp_err_t saveSensorRoms()
+{
+    nvs_handle_t nvsHandle;
+    TempSensorRom_t roms[TEMP_SENSOR_MAX];
+    esp_err_t err;
+
+    portENTER_CRITICAL(&RegistryLock);
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        roms[i] = TempSensors[i].rom;
+    }
+    portEXIT_CRITICAL(&RegistryLock);
+
+    err = nvs_open(TEMP_NVS_NAMESPACE, NVS_READWRITE, &nvsHandle);
+    if(err != ESP_OK)
+    {
+        return err;
+    }
+
+    err = nvs_set_blob(nvsHandle, TEMP_NVS_ROM_KEY, roms, sizeof(roms));
+    if(err == ESP_OK)
+    {
+        err = nvs_commit(nvsHandle);
+    }
+    nvs_close(nvsHandle);
+
+    return err;
+}
+
+/**
+ * @brief Checks every known sensor address on a bus with one addressed scratchpad read and
+ * records the resolution held in each configuration register.
+ * 
+ * @param busIndex Bus to verify
+ * @return true if every sensor responded and the bus has at least one sensor
+ */
+bool verifySensorRoms(uint8_t busIndex)
+{
+    TempBus_t *bus = &TempBuses[busIndex];
+    ScratchPad scratchPad;
+    bool allFound = true;
+    uint8_t sensorCount = 0;
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(!sensorOnBus(i, busIndex))
+        {
+            continue;
+        }
+
+        sensorCount++;
+        TempSensors[i].missing = !ds18b20_isConnected(&bus->driver, &TempSensors[i].rom.address, scratchPad);
+
+        if(TempSensors[i].missing)
+        {
+            allFound = false;
+        }
+        else
+        {
+            TempSensors[i].resolution = ds18b20_scratchPadResolution(scratchPad);
+        }
+    }
+
+    ds18b20_setKnownDeviceCount(&bus->driver, sensorCount);
+    if(!allFound)
+    {
+        ds18b20_forgetBusDeviceCount(&bus->driver);
+    }
+
+    // A bus without known sensors is searched in case sensors were added
+    return allFound && (sensorCount != 0);
+}
+
+/**
+ * @brief Finds the registry slot of a sensor address on any bus
+ * 
+ * @param address Sensor address
+ * @return Slot of sensor, or TEMP_SENSOR_NONE if unknown
+ */
+TempSensorId findSensorByAddress(const DeviceAddress address)
+{
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if((TempSensors[i].rom.bus != TEMP_BUS_NONE) &&
+           (memcmp(address, TempSensors[i].rom.address, sizeof(DeviceAddress)) == 0))
+        {
+            return i;
+        }
+    }
+
+    return TEMP_SENSOR_NONE;
+}
+
+/**
+ * @brief Assigns a registry slot to a new sensor. The sensor replaces a missing sensor on 
+ * the same bus and takes its role, otherwise it takes the first free slot.
+ * 
+ * @param busIndex Bus the sensor was found on
+ * @param address Sensor address
+ * @return Slot assigned, or TEMP_SENSOR_NONE if the registry is full
+ */
+TempSensorId assignSensor(uint8_t busIndex, const DeviceAddress address)
+{
+    uint8_t id;
+
+    portENTER_CRITICAL(&RegistryLock);
+
+    for(id = 0; id < TEMP_SENSOR_MAX; id++)
+    {
+        if(sensorOnBus(id, busIndex) && TempSensors[id].missing)
+        {
+            break;
+        }
+    }
+
+    if(id == TEMP_SENSOR_MAX)
+    {
+        for(id = 0; id < TEMP_SENSOR_MAX; id++)
+        {
+            if(TempSensors[id].rom.bus == TEMP_BUS_NONE)
+            {
+                getTempSensorDefaultName(id, TempSensors[id].rom.name, TEMP_SENSOR_NAME_LEN);
+                break;
+            }
+        }
+    }
+
+    if(id != TEMP_SENSOR_MAX)
+    {
+        memcpy(TempSensors[id].rom.address, address, sizeof(DeviceAddress));
+        TempSensors[id].rom.bus = busIndex;
+        TempSensors[id].missing = false;
+        TempSensors[id].alarmActive = false;
+        TempSensors[id].resolution = 0;
+        TempSensors[id].lastTemperature = TEMP_FIXED_DISCONNECTED;
+        memset(&TempSensors[id].health, 0, sizeof(TempSensorHealth_t));
+    }
 
-/* Current number of sensors known on bus */
-unsigned int SensorsFound = 0;
+    portEXIT_CRITICAL(&RegistryLock);
 
-/* Storage for last temperature reading */
-float LastTemperaturesRead[TEMP_SENSOR_COUNT] = { DEVICE_DISCONNECTED };
+    return id;
+}
 
 /**
- * @brief Searches bus for available temperature sensors
+ * @brief Searches a bus for missing temperature sensors. Sensors found at a known address keep 
+ * their role, even if they moved from another bus. Unknown addresses take the role of a missing 
+ * sensor on the bus or the first free slot in the registry.
  * 
- * @param tempSensorAddresses Array to store device addresses in
+ * @param busIndex Bus to search
  */
-void getTempAddresses(DeviceAddress *tempSensorAddresses) {
-	
-	reset_search();
+void searchForSensors(uint8_t busIndex)
+{
+    TempBus_t *bus = &TempBuses[busIndex];
+    DeviceAddress address;
+    bool rolesChanged = false;
+    uint8_t missingCount = 0;
+    uint8_t sensorCount = 0;
+    TempSensorId id;
+
+    reset_search(&bus->driver);
+
+    // Search through all addresses
+    while (search(&bus->driver, address, true))
+    {
+        id = findSensorByAddress(address);
+
+        if(id == TEMP_SENSOR_NONE)
+        {
+            id = assignSensor(busIndex, address);
+
+            if(id == TEMP_SENSOR_NONE)
+            {
+                LOGW("Temperature Sensor Registry Full");
+                continue;
+            }
+
+            rolesChanged = true;
+            LOGI("New Temperature Sensor %s on Bus %d", TempSensors[id].rom.name, busIndex);
+        }
+        else if(!sensorOnBus(id, busIndex))
+        {
+            portENTER_CRITICAL(&RegistryLock);
+            TempSensors[id].rom.bus = busIndex;
+            TempSensors[id].alarmActive = false;
+            portEXIT_CRITICAL(&RegistryLock);
+
+            rolesChanged = true;
+            LOGI("Temperature Sensor %s Moved to Bus %d", TempSensors[id].rom.name, busIndex);
+        }
+
+        // Probe a quarantined sensor on the next sweep now that it answered the search
+        TempSensors[id].missing = false;
+        TempSensors[id].health.sweepsUntilProbe = 0;
+    }
+
+    for(id = 0; id < TEMP_SENSOR_MAX; id++)
+    {
+        if(!sensorOnBus(id, busIndex))
+        {
+            continue;
+        }
+
+        sensorCount++;
+        if(TempSensors[id].missing)
+        {
+            missingCount++;
+        }
+        else
+        {
+            // Sensors that were missing may have been power cycled back to their default resolution
+            TempSensors[id].resolution = 0;
+        }
+    }
 
-    // Search through all addresses or until all sensors found
-    while (search(tempSensorAddresses[SensorsFound],true)) {
-		SensorsFound++;
-		if (SensorsFound == TEMP_SENSOR_COUNT) break;
-	}
+    ds18b20_setKnownDeviceCount(&bus->driver, sensorCount);
 
     // Got to End of search and didn't find expected number of sensors
-    if(SensorsFound != TEMP_SENSOR_COUNT)
+    if(missingCount != 0)
     {
-        LOGW("Expected %d Temperature Sensors. Only Found %d", TEMP_SENSOR_COUNT, SensorsFound);
+        LOGW("Expected %d Temperature Sensors on Bus %d. Only Found %d", sensorCount, busIndex, sensorCount - missingCount);
+    }
+
+    if(rolesChanged)
+    {
+        if(saveSensorRoms() != ESP_OK)
+        {
+            LOGW("Failed to Save Temperature Sensor Addresses");
+        }
     }
+
+    bus->searchPending = false;
 }
 
 /**
@@ -54,9 +467,9 @@ void getTempAddresses(DeviceAddress *tempSensorAddresses) {
  * 
  * @return true if device is considered disconnected, or false otherwise.
  */
-bool tempIsDisconnected(float temperature)
+bool tempIsDisconnected(TempFixed_t temperature)
 {
-    if(temperature < (DEVICE_DISCONNECTED + 1.0f))
+    if(temperature == TEMP_FIXED_DISCONNECTED)
     {
         return true;
     }
@@ -68,77 +481,837 @@ bool tempIsDisconnected(float temperature)
 
 /**
  * @brief 
- * Read temperatures from connected temperature sensors
+ * Sets the temperatures a sensor's reading must go below or above before it needs to be read
+ * again in alarm mode. The values are rounded outwards to the whole degrees compared by the 
+ * sensor so a reading is never missed, only read unnecessarily.
  * 
- * @param temperatures pointer to array of temperatures to be stored. This should be the 
- * same size as TEMP_SENSOR_COUNT
+ * @param sensorId Sensor to set thresholds for
+ * @param low Alarm when temperature is below this, TEMP_ALARM_NONE_LOW to disable
+ * @param high Alarm when temperature is above this, TEMP_ALARM_NONE_HIGH to disable
  */
-void getTemperatures(float *temperatures)
+void setTempAlarmThresholds(TempSensorId sensorId, TempFixed_t low, TempFixed_t high)
 {
-    uint8_t readAttempts = 0;
+    TempSensor_t *sensor;
+    int8_t lowAlarm;
+    int8_t highAlarm;
+
+    if(sensorId >= TEMP_SENSOR_MAX)
+    {
+        return;
+    }
+
+    sensor = &TempSensors[sensorId];
+
+    // Sensor alarms when whole degrees <= TL or >= TH
+    // Shifts round towards -infinity for negative temperatures too, giving floor() and ceil()
+    lowAlarm = (low <= TEMP_ALARM_NONE_LOW) ? (int8_t)(TEMP_ALARM_NONE_LOW >> 7) : (int8_t)(((low + (TEMP_FIXED_SCALE - 1)) >> 7) - 1);
+    highAlarm = (high >= TEMP_ALARM_NONE_HIGH) ? (int8_t)(TEMP_ALARM_NONE_HIGH >> 7) : (int8_t)(high >> 7);
 
-    ds18b20_requestTemperatures();
+    portENTER_CRITICAL(&RegistryLock);
+    sensor->thresholdLow = low;
+    sensor->thresholdHigh = high;
+    if((lowAlarm != sensor->alarmLow) || (highAlarm != sensor->alarmHigh) || !sensor->alarmActive)
+    {
+        sensor->alarmLow = lowAlarm;
+        sensor->alarmHigh = highAlarm;
+        sensor->alarmWritePending = true;
+    }
+    portEXIT_CRITICAL(&RegistryLock);
+}
+
+/**
+ * @brief 
+ * Writes alarm thresholds that changed since the last sweep to the sensors of a bus. Until they
+ * are written the sensor is read every sweep.
+ * 
+ * @param busIndex Bus to write alarm thresholds on
+ */
+void writeAlarmThresholds(uint8_t busIndex)
+{
+    TempBus_t *bus = &TempBuses[busIndex];
+    TempSensor_t *sensor;
+    int8_t lowAlarm;
+    int8_t highAlarm;
+    bool writePending;
 
-    for(uint8_t i = 0; i < TEMP_SENSOR_COUNT; i++)
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
     {
-        temperatures[i] = DEVICE_DISCONNECTED;
+        // Quarantined sensors are rewritten once they recover
+        if(!sensorOnBus(i, busIndex) || (TempSensors[i].health.state == TEMP_SENSOR_QUARANTINED))
+        {
+            continue;
+        }
+
+        sensor = &TempSensors[i];
 
-        while((readAttempts++ < MAX_READ_ATTEMPTS) && tempIsDisconnected(temperatures[i]))
+        // Take a consistent copy, thresholds are set from other tasks
+        portENTER_CRITICAL(&RegistryLock);
+        writePending = sensor->alarmWritePending;
+        lowAlarm = sensor->alarmLow;
+        highAlarm = sensor->alarmHigh;
+        sensor->alarmWritePending = false;
+        portEXIT_CRITICAL(&RegistryLock);
+
+        if(writePending)
         {
-            temperatures[i] = ds18b20_getTempC(&TempSensors[i]);
-            LastTemperaturesRead[i] = temperatures[i];
+            // Written before the next conversion starts so its alarm flag uses the new thresholds
+            sensor->alarmActive = ds18b20_setAlarms(&bus->driver, &sensor->rom.address, lowAlarm, highAlarm);
 
-            if(tempIsDisconnected(temperatures[i]))
-            {
-                LOGW("Error Reading Temperature %d Attempt %d", i, readAttempts);
-            }
-            else
+            if(!sensor->alarmActive)
             {
-                break;
+                sensor->alarmWritePending = true;
             }
         }
+    }
+}
+
+/**
+ * @brief 
+ * Finds sensors on a bus whose last conversion was outside their alarm thresholds with a single
+ * conditional search.
+ * 
+ * @param busIndex Bus to search
+ * @param alarmed Set true for each sensor that needs to be read, TEMP_SENSOR_MAX entries
+ */
+void findAlarmedSensors(uint8_t busIndex, bool *alarmed)
+{
+    TempBus_t *bus = &TempBuses[busIndex];
+    DeviceAddress address;
+    TempSensorId id;
 
-        readAttempts = 0;
+    // Sensors without thresholds are always read
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        alarmed[i] = !TempSensors[i].alarmActive;
+    }
+
+    reset_search(&bus->driver);
+
+    while(alarm_search(&bus->driver, address))
+    {
+        id = findSensorByAddress(address);
+        if(id != TEMP_SENSOR_NONE)
+        {
+            alarmed[id] = true;
+        }
     }
 }
 
 /**
- * @brief Get the last temperature read from a sensor
+ * @brief 
+ * Records the result of reading a sensor. Sensors that fail TEMP_QUARANTINE_FAILURES reads in a
+ * row are quarantined and marked missing so their bus is searched once for a replacement.
  * 
- * @param sensorId Index of sensor being requested
- * @return Last Temperature read from device
+ * @param busIndex Bus the sensor is on
+ * @param id Sensor that was read
+ * @param status Result of the read
  */
-float getLastTemperatureRead(TempSensorId sensorId)
+void recordSensorHealth(uint8_t busIndex, uint8_t id, ds18b20_status_t status)
 {
-    if(sensorId < TEMP_SENSOR_COUNT)
+    TempSensor_t *sensor = &TempSensors[id];
+    TempSensorHealth_t *health = &sensor->health;
+
+    if(status == DS18B20_OK)
+    {
+        if(health->state == TEMP_SENSOR_QUARANTINED)
+        {
+            LOGI("Temperature Sensor %s Recovered", sensor->rom.name);
+        }
+
+        health->state = TEMP_SENSOR_HEALTHY;
+        health->consecutiveFailures = 0;
+        health->backoffSweeps = 0;
+        sensor->missing = false;
+        return;
+    }
+
+    switch(status)
+    {
+        case DS18B20_CRC_ERROR:
+            health->crcErrors++;
+            break;
+
+        case DS18B20_ALL_ZEROS:
+            health->allZerosErrors++;
+            break;
+
+        default:
+            health->presenceErrors++;
+            break;
+    }
+
+    if(health->consecutiveFailures < UINT8_MAX)
+    {
+        health->consecutiveFailures++;
+    }
+
+    // Sensor may come back power cycled with its default alarm registers
+    if(sensor->alarmActive)
+    {
+        sensor->alarmWritePending = true;
+    }
+
+    if(health->state == TEMP_SENSOR_QUARANTINED)
+    {
+        // Failed probe, wait twice as long for the next one
+        health->backoffSweeps = (health->backoffSweeps >= (TEMP_QUARANTINE_MAX_SWEEPS / 2)) ? 
+                                TEMP_QUARANTINE_MAX_SWEEPS : (health->backoffSweeps * 2);
+        health->sweepsUntilProbe = health->backoffSweeps;
+    }
+    else if(health->consecutiveFailures >= TEMP_QUARANTINE_FAILURES)
     {
-        return LastTemperaturesRead[sensorId];
+        LOGW("Temperature Sensor %s Quarantined, Status %d", sensor->rom.name, status);
+
+        health->state = TEMP_SENSOR_QUARANTINED;
+        health->quarantines++;
+        health->backoffSweeps = TEMP_QUARANTINE_MIN_SWEEPS;
+        health->sweepsUntilProbe = health->backoffSweeps;
+
+        // It may have been replaced by a sensor with a different address. Until a search counts
+        // the bus again, a SKIP ROM read meant for it would be answered by another sensor.
+        sensor->missing = true;
+        ds18b20_forgetBusDeviceCount(&TempBuses[busIndex].driver);
+        TempBuses[busIndex].searchPending = true;
     }
     else
     {
-        return DEVICE_DISCONNECTED;
+        health->state = TEMP_SENSOR_DEGRADED;
     }
 }
 
 /**
  * @brief 
- * Configure One Wire Bus, search for and configure temperature sensors.
+ * Read scratchpads of the temperature sensors on a bus. A conversion must already be complete. 
+ * In alarm mode only sensors reporting an alarm are read between full sweeps, the rest keep 
+ * their last reading. Quarantined sensors are only probed, with a single CRC checked read, 
+ * when their backoff expires.
  * 
- * @return esp_err_t 
+ * @param busIndex Bus to read
+ * @param temperatures pointer to array of temperatures to be stored. This should be the 
+ * same size as TEMP_SENSOR_MAX, only entries of sensors on the bus are written.
  */
-esp_err_t configureTempSensors()
+void readTemperatures(uint8_t busIndex, TempFixed_t *temperatures)
 {
-    ds18b20_init(TEMP_SENSOR_ONE_WIRE_GPIO);
-	getTempAddresses(TempSensors);
-	ds18b20_setResolution(TempSensors, TEMP_SENSOR_COUNT, SENSOR_RESOLUTION);
+    TempBus_t *bus = &TempBuses[busIndex];
+    TempSensor_t *sensor;
+    bool validateAll = ((bus->sweepCount++ % TEMP_CRC_CHECK_SWEEPS) == 0);
+    bool validate;
+    uint8_t attempts;
+    bool readSensor[TEMP_SENSOR_MAX];
+    int16_t rawTemp;
+    ds18b20_status_t status;
 
-    for(uint8_t i = 0; i < TEMP_SENSOR_COUNT; i++)
+    if(TEMP_ALARM_MODE && !validateAll)
     {
-        LOGI("Temperature Address %d: 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x", i, TempSensors[i][0],TempSensors[i][1],TempSensors[i][2],TempSensors[i][3],TempSensors[i][4],TempSensors[i][5],TempSensors[i][6],TempSensors[i][7]);
+        findAlarmedSensors(busIndex, readSensor);
     }
-    
-    return ESP_OK;
-}
+    else
+    {
+        memset(readSensor, true, sizeof(readSensor));
+    }
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(!sensorOnBus(i, busIndex))
+        {
+            continue;
+        }
+
+        sensor = &TempSensors[i];
+        temperatures[i] = TEMP_FIXED_DISCONNECTED;
+
+        if(sensor->health.state == TEMP_SENSOR_QUARANTINED)
+        {
+            if(sensor->health.sweepsUntilProbe > 0)
+            {
+                sensor->health.sweepsUntilProbe--;
+                continue;
+            }
 
+            validate = true;
+            attempts = 1;
+        }
+        else
+        {
+            // Temperature hasn't crossed a threshold, last reading is still good enough
+            if(!readSensor[i] && !tempIsDisconnected(sensor->lastTemperature))
+            {
+                temperatures[i] = sensor->lastTemperature;
+                continue;
+            }
 
+            // Only read the full scratchpad when there is no known good reading to compare against
+            validate = validateAll || tempIsDisconnected(sensor->lastTemperature);
+            attempts = MAX_READ_ATTEMPTS;
+        }
 
+        status = ds18b20_readTemperature(&bus->driver, &sensor->rom.address, &rawTemp, validate, attempts, &sensor->resolution);
+
+        // Large jumps from an unchecked read could be bit errors, confirm with a CRC checked read
+        if((status == DS18B20_OK) && !validate &&
+           (abs(rawTemp - sensor->lastTemperature) > TEMP_UNVALIDATED_MAX_DELTA))
+        {
+            status = ds18b20_readTemperature(&bus->driver, &sensor->rom.address, &rawTemp, true, MAX_READ_ATTEMPTS, &sensor->resolution);
+        }
+
+        if((status == DS18B20_OK) && (rawTemp <= DEVICE_DISCONNECTED_RAW))
+        {
+            status = DS18B20_NO_DEVICE;
+        }
+
+        if(status == DS18B20_OK)
+        {
+            if(sensor->resolution != 0)
+            {
+                rawTemp = ds18b20_maskResolution(rawTemp, sensor->resolution);
+            }
+            temperatures[i] = rawTemp;
+        }
+
+        recordSensorHealth(busIndex, i, status);
+    }
+}
+
+/**
+ * @brief 
+ * Picks the resolution a sensor should convert at next
+ * 
+ * @param sensor Sensor to pick resolution for
+ * @param temperature Latest reading of the sensor
+ * @return Resolution in bits
+ */
+uint8_t targetResolution(const TempSensor_t *sensor, TempFixed_t temperature)
+{
+    int32_t distance = INT32_MAX;
+    int32_t near = TEMP_RESOLUTION_NEAR_C;
+
+    if(!TEMP_ADAPTIVE_RESOLUTION || tempIsDisconnected(temperature))
+    {
+        return SENSOR_RESOLUTION;
+    }
+
+    if(sensor->thresholdLow > TEMP_ALARM_NONE_LOW)
+    {
+        distance = abs(temperature - sensor->thresholdLow);
+    }
+
+    if(sensor->thresholdHigh < TEMP_ALARM_NONE_HIGH)
+    {
+        distance = MIN(distance, abs(temperature - sensor->thresholdHigh));
+    }
+
+    // Don't toggle between resolutions while hovering around the edge
+    if(sensor->resolution == TEMP_RESOLUTION_NEAR)
+    {
+        near += TEMP_RESOLUTION_HYSTERESIS_C;
+    }
+
+    return (distance < near) ? TEMP_RESOLUTION_NEAR : TEMP_RESOLUTION_FAR;
+}
+
+/**
+ * @brief 
+ * Writes the resolution for the next conversion to sensors on a bus that don't hold it yet,
+ * then times conversions on the bus by its slowest sensor.
+ * 
+ * @param busIndex Bus to update
+ * @param temperatures Latest readings, TEMP_SENSOR_MAX entries
+ */
+void updateResolutions(uint8_t busIndex, const TempFixed_t *temperatures)
+{
+    TempBus_t *bus = &TempBuses[busIndex];
+    TempSensor_t *sensor;
+    uint8_t target;
+    uint8_t slowest = TEMP_RESOLUTION_FAR;
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(!sensorOnBus(i, busIndex) || TempSensors[i].missing || 
+           (TempSensors[i].health.state == TEMP_SENSOR_QUARANTINED))
+        {
+            continue;
+        }
+
+        sensor = &TempSensors[i];
+        target = targetResolution(sensor, temperatures[i]);
+
+        if(sensor->resolution != target)
+        {
+            sensor->resolution = ds18b20_setResolution(&bus->driver, &sensor->rom.address, 1, target) ? target : 0;
+        }
+
+        // Unknown resolution could be anything up to 12 bit
+        if(sensor->resolution == 0)
+        {
+            slowest = 12;
+        }
+        else if(sensor->resolution > slowest)
+        {
+            slowest = sensor->resolution;
+        }
+    }
+
+    ds18b20_setBusResolution(&bus->driver, slowest);
+}
+
+/**
+ * @brief 
+ * Stores a new set of temperatures from a bus and notifies all registered consumers. Each bus
+ * publishes its own sensors, so consumers are notified once per bus each sample period.
+ * 
+ * @param busIndex Bus the temperatures were read from
+ * @param temperatures Array of TEMP_SENSOR_MAX temperatures to publish
+ */
+void publishTemperatures(uint8_t busIndex, const TempFixed_t *temperatures)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t seq;
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(sensorOnBus(i, busIndex))
+        {
+            TempSensors[i].lastTemperature = temperatures[i];
+        }
+    }
+
+    // Bus tasks can publish at the same time, only one may write the snapshot
+    portENTER_CRITICAL(&SnapshotWriteLock);
+    seq = SnapshotSeq + 1;
+    __atomic_store_n(&SnapshotSeq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(sensorOnBus(i, busIndex))
+        {
+            Snapshot.temperatures[i] = temperatures[i];
+            Snapshot.valid[i] = !tempIsDisconnected(temperatures[i]);
+            Snapshot.sampleTimeUs[i] = now;
+        }
+    }
+    Snapshot.sequence++;
+    Snapshot.timestampUs = now;
+
+    __atomic_store_n(&SnapshotSeq, seq + 1, __ATOMIC_RELEASE);
+
+    memcpy(RetainedTemps.temperatures, Snapshot.temperatures, sizeof(RetainedTemps.temperatures));
+    RetainedTemps.magic = TEMP_RETAINED_MAGIC;
+    RetainedTemps.crc = esp_rom_crc32_le(0, (const uint8_t *)&RetainedTemps, offsetof(TempRetained_t, crc));
+    portEXIT_CRITICAL(&SnapshotWriteLock);
+
+    for(uint8_t i = 0; i < SampleCallbackCount; i++)
+    {
+        SampleCallbacks[i](SampleCallbackArgs[i]);
+    }
+}
+
+/**
+ * @brief 
+ * Get a consistent copy of the most recently published temperatures without locking. Only
+ * retries while a bus task is publishing, which takes a few microseconds.
+ * 
+ * @param snapshot Copy of the published temperatures
+ */
+void getTempSnapshot(TempSnapshot_t *snapshot)
+{
+    uint32_t seq;
+
+    while(true)
+    {
+        seq = __atomic_load_n(&SnapshotSeq, __ATOMIC_ACQUIRE);
+        if(seq & 1)
+        {
+            continue;
+        }
+
+        memcpy(snapshot, &Snapshot, sizeof(TempSnapshot_t));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&SnapshotSeq, __ATOMIC_RELAXED) == seq)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 
+ * Checks that a sensor's temperature in a snapshot was read successfully and recently enough
+ * to act on
+ * 
+ * @param snapshot Snapshot from getTempSnapshot()
+ * @param sensorId Sensor to check
+ * @param maxAgeMs Oldest acceptable sample, e.g. TEMP_MAX_SAMPLE_AGE_MS
+ * @return true if the temperature can be used
+ */
+bool tempSnapshotFresh(const TempSnapshot_t *snapshot, TempSensorId sensorId, uint32_t maxAgeMs)
+{
+    if((sensorId >= TEMP_SENSOR_MAX) || !snapshot->valid[sensorId])
+    {
+        return false;
+    }
+
+    return (esp_timer_get_time() - snapshot->sampleTimeUs[sensorId]) <= ((int64_t)maxAgeMs * 1000);
+}
+
+/**
+ * @brief 
+ * Get the most recently published temperatures. Does not access the bus.
+ * 
+ * @param temperatures pointer to array of temperatures to be stored. This should be the 
+ * same size as TEMP_SENSOR_MAX
+ */
+void getTemperatures(TempFixed_t *temperatures)
+{
+    TempSnapshot_t snapshot;
+
+    getTempSnapshot(&snapshot);
+    memcpy(temperatures, snapshot.temperatures, sizeof(snapshot.temperatures));
+}
+
+/**
+ * @brief 
+ * Get the bus time used and saved during the last complete sweep, summed over all buses
+ * 
+ * @param stats Bus statistics of last sweep
+ */
+void getTempBusStats(ds18b20_busStats_t *stats)
+{
+    stats->busTimeUs = 0;
+    stats->savedUs = 0;
+
+    for(uint8_t b = 0; b < TEMP_BUS_COUNT; b++)
+    {
+        stats->busTimeUs += TempBuses[b].lastSweepStats.busTimeUs;
+        stats->savedUs += TempBuses[b].lastSweepStats.savedUs;
+    }
+}
+
+/**
+ * @brief 
+ * Registers a function to be called each time a new set of temperatures is published
+ * 
+ * @param callback Function to call. Runs in the acquisition task of the bus that published.
+ * @param arg Argument passed to callback
+ * @return ESP_OK if registered, ESP_ERR_NO_MEM if all callback slots are in use
+ */
+esp_err_t registerTempSampleCallback(TempSampleCallback_t callback, void * arg)
+{
+    esp_err_t err = ESP_OK;
+
+    // Bus tasks may already be walking the list
+    portENTER_CRITICAL(&RegistryLock);
+    if(SampleCallbackCount >= TEMP_MAX_SAMPLE_CALLBACKS)
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        SampleCallbackArgs[SampleCallbackCount] = arg;
+        SampleCallbacks[SampleCallbackCount] = callback;
+        SampleCallbackCount++;
+    }
+    portEXIT_CRITICAL(&RegistryLock);
+
+    return err;
+}
+
+/**
+ * @brief 
+ * Temperature acquisition task, one runs for each bus so the buses convert and are read in
+ * parallel. The next conversion is started as soon as the scratchpads of the previous one are
+ * read so it completes while the task waits for the next sample period. Completion is detected
+ * by polling the bus rather than waiting the worst case conversion time.
+ * 
+ * @param parameters Index of bus to acquire
+ */
+void tempAcquisitionTask(void * parameters)
+{
+    uint8_t busIndex = (uint8_t)(uintptr_t)parameters;
+    TempBus_t *bus = &TempBuses[busIndex];
+    TempAcqState_t state = TEMP_ACQ_CONVERTING;
+    TickType_t lastSampleTime;
+    TickType_t conversionStartTime;
+    TempFixed_t temperatures[TEMP_SENSOR_MAX];
+
+    if(bus->searchPending)
+    {
+        searchForSensors(busIndex);
+    }
+
+    ds18b20_startConversion(&bus->driver);
+    conversionStartTime = xTaskGetTickCount();
+    lastSampleTime = conversionStartTime;
+
+    while(true)
+    {
+        switch(state)
+        {
+            case TEMP_ACQ_IDLE:
+                vTaskDelayUntil(&lastSampleTime, pdMS_TO_TICKS(TEMP_SAMPLE_PERIOD_MS));
+                state = TEMP_ACQ_CONVERTING;
+                break;
+
+            case TEMP_ACQ_CONVERTING:
+                // Give up polling after the worst case conversion time and try to read anyway
+                if(isConversionComplete(&bus->driver) ||
+                   ((xTaskGetTickCount() - conversionStartTime) >= pdMS_TO_TICKS(millisToWaitForConversion(&bus->driver))))
+                {
+                    state = TEMP_ACQ_READING;
+                }
+                else
+                {
+                    vTaskDelay(pdMS_TO_TICKS(TEMP_CONVERSION_POLL_MS));
+                }
+                break;
+
+            case TEMP_ACQ_READING:
+                readTemperatures(busIndex, temperatures);
+
+                // A sweep covers the conversion, its polling and the reads
+                ds18b20_getBusStats(&bus->driver, &bus->lastSweepStats);
+                ds18b20_resetBusStats(&bus->driver);
+
+                if(bus->searchPending)
+                {
+                    searchForSensors(busIndex);
+                }
+
+                if(TEMP_ALARM_MODE)
+                {
+                    writeAlarmThresholds(busIndex);
+                }
+
+                updateResolutions(busIndex, temperatures);
+
+                // Start next conversion right away so it is ready for the next period
+                ds18b20_startConversion(&bus->driver);
+                conversionStartTime = xTaskGetTickCount();
+
+                publishTemperatures(busIndex, temperatures);
+                state = TEMP_ACQ_IDLE;
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Get the last temperature read from a sensor
+ * 
+ * @param sensorId Index of sensor being requested
+ * @return Last Temperature read from device
+ */
+TempFixed_t getLastTemperatureRead(TempSensorId sensorId)
+{
+    TempSnapshot_t snapshot;
+
+    getTempSnapshot(&snapshot);
+    if((sensorId < TEMP_SENSOR_MAX) && snapshot.valid[sensorId])
+    {
+        return snapshot.temperatures[sensorId];
+    }
+    else
+    {
+        return TEMP_FIXED_DISCONNECTED;
+    }
+}
+
+/**
+ * @brief Checks if a sensor has been found on a bus and holds a registry slot
+ * 
+ * @param sensorId Sensor to check
+ * @return true if registered
+ */
+bool tempSensorRegistered(TempSensorId sensorId)
+{
+    return (sensorId < TEMP_SENSOR_MAX) && (TempSensors[sensorId].rom.bus != TEMP_BUS_NONE);
+}
+
+/**
+ * @brief Get the name of a sensor's role
+ * 
+ * @param sensorId Sensor to get name of
+ * @return Name of sensor, or NULL if the sensor isn't registered
+ */
+const char * getTempSensorName(TempSensorId sensorId)
+{
+    if(!tempSensorRegistered(sensorId))
+    {
+        return NULL;
+    }
+
+    return TempSensors[sensorId].rom.name;
+}
+
+/**
+ * @brief Get the name a sensor slot is given when a sensor is first assigned to it, its role
+ * name or sensorN for slots without a role. Doesn't need the sensor to be registered.
+ * 
+ * @param sensorId Sensor slot
+ * @param name Buffer for name
+ * @param len Length of buffer, TEMP_SENSOR_NAME_LEN is always enough
+ */
+void getTempSensorDefaultName(TempSensorId sensorId, char *name, size_t len)
+{
+    if(sensorId < TEMP_SENSOR_ROLE_COUNT)
+    {
+        strlcpy(name, TempSensorRoleNames[sensorId], len);
+    }
+    else
+    {
+        snprintf(name, len, "sensor%d", sensorId);
+    }
+}
+
+/**
+ * @brief Find a registered sensor by the name of its role
+ * 
+ * @param name Name of sensor
+ * @return ID of sensor, or TEMP_SENSOR_NONE if no sensor has the name
+ */
+TempSensorId findTempSensor(const char *name)
+{
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(tempSensorRegistered(i) && (strncmp(name, TempSensors[i].rom.name, TEMP_SENSOR_NAME_LEN) == 0))
+        {
+            return i;
+        }
+    }
+
+    return TEMP_SENSOR_NONE;
+}
+
+/**
+ * @brief Get the health of a sensor
+ * 
+ * @param sensorId Sensor to get health of
+ * @param health Copy of sensor health
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if the sensor isn't registered
+ */
+esp_err_t getTempSensorHealth(TempSensorId sensorId, TempSensorHealth_t *health)
+{
+    if(!tempSensorRegistered(sensorId))
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    *health = TempSensors[sensorId].health;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Get the number of registered sensors across all buses
+ * 
+ * @return Number of sensors
+ */
+uint8_t getTempSensorCount()
+{
+    uint8_t count = 0;
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(tempSensorRegistered(i))
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief 
+ * Publishes the temperatures kept in RTC memory through a warm reboot, aged by one sample period
+ * since the time spent in reset is unknown. They go stale before long if a sensor doesn't answer.
+ */
+void restoreTemperatures()
+{
+    int64_t sampleTimeUs = esp_timer_get_time() - ((int64_t)TEMP_SAMPLE_PERIOD_MS * 1000);
+
+    if((esp_reset_reason() == ESP_RST_POWERON) || (RetainedTemps.magic != TEMP_RETAINED_MAGIC) ||
+       (esp_rom_crc32_le(0, (const uint8_t *)&RetainedTemps, offsetof(TempRetained_t, crc)) != RetainedTemps.crc))
+    {
+        return;
+    }
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        Snapshot.temperatures[i] = RetainedTemps.temperatures[i];
+        Snapshot.valid[i] = !tempIsDisconnected(RetainedTemps.temperatures[i]);
+        Snapshot.sampleTimeUs[i] = sampleTimeUs;
+    }
+    Snapshot.timestampUs = sampleTimeUs;
+
+    LOGI("Restored Temperatures Kept Through Reset");
+}
+
+/**
+ * @brief 
+ * Configure the One Wire Buses and temperature sensors, then start an acquisition task for each
+ * bus. Sensor addresses saved by a previous search are verified with one read each. A bus is
+ * only searched, in its acquisition task, when a sensor doesn't respond at its saved address.
+ * NVS must be initialized before calling.
+ * 
+ * @return esp_err_t 
+ */
+esp_err_t configureTempSensors()
+{
+    char taskName[configMAX_TASK_NAME_LEN];
+    bool romsLoaded;
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        Snapshot.temperatures[i] = TEMP_FIXED_DISCONNECTED;
+        Snapshot.valid[i] = false;
+    }
+
+    restoreTemperatures();
+
+    romsLoaded = (loadSensorRoms() == ESP_OK);
+    if(!romsLoaded)
+    {
+        LOGI("No Saved Temperature Sensor Addresses");
+    }
+
+    for(uint8_t b = 0; b < TEMP_BUS_COUNT; b++)
+    {
+        ds18b20_init(&TempBuses[b].driver, TempBusConfigs[b].gpio, TempBusConfigs[b].uart);
+
+        if(!TempBuses[b].driver.init)
+        {
+            LOGE("Failed to Initialize 1-Wire Bus %d", b);
+            continue;
+        }
+
+        TempBuses[b].searchPending = !(romsLoaded && verifySensorRoms(b));
+
+        if(TempBuses[b].searchPending)
+        {
+            LOGI("Temperature Sensor Missing on Bus %d, Searching in Background", b);
+        }
+    }
+
+    for(uint8_t i = 0; i < TEMP_SENSOR_MAX; i++)
+    {
+        if(tempSensorRegistered(i))
+        {
+            DeviceAddress *address = &TempSensors[i].rom.address;
+            LOGI("Temperature Sensor %s Bus %d: 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x", TempSensors[i].rom.name, TempSensors[i].rom.bus, (*address)[0],(*address)[1],(*address)[2],(*address)[3],(*address)[4],(*address)[5],(*address)[6],(*address)[7]);
+        }
+    }
+
+    // Start acquiring temperatures in the background, one task per bus
+    for(uint8_t b = 0; b < TEMP_BUS_COUNT; b++)
+    {
+        if(TempBuses[b].driver.init)
+        {
+            snprintf(taskName, sizeof(taskName), "TempAcq%d", b);
+            xTaskCreate(&tempAcquisitionTask, taskName, ESP_TASK_MAIN_STACK, (void *)(uintptr_t)b, 5, NULL);
+        }
+    }
+    
+    return ESP_OK;
+}
@@ -12,24 +12,187 @@
 
 // Standard Library Includes
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+// DS18B20 Driver
+#include "ds18b20.h"
+
+/**
+ * Temperature in fixed point 1/128 C, the format calculateTemperature() produces from a scratchpad.
+ * Temperatures stay in this format through control logic and on the wire, they are only converted
+ * to float for display.
+ */
+typedef int16_t TempFixed_t;
+
+#define TEMP_FIXED_SCALE 128
+
+/* Converts a constant in C to fixed point at compile time, use tempCToFixed() for variables */
+#define TEMP_FIXED(c) ((TempFixed_t)((c) * TEMP_FIXED_SCALE))
+
+/* Temperature of a sensor without a valid reading */
+#define TEMP_FIXED_DISCONNECTED INT16_MIN
 
 /* Max attempts to make at reading temperature sensor when an error occurs before reporting Device Disconnected */
 #define MAX_READ_ATTEMPTS 5
 
+/* Every Nth sweep reads full scratchpads so the CRC is checked even when readings are steady */
+#define TEMP_CRC_CHECK_SWEEPS 10
+
+/* Largest change (C) accepted from a read without CRC before it is repeated with a CRC check */
+#define TEMP_UNVALIDATED_MAX_DELTA TEMP_FIXED(1.0f)
+
+/**
+ * When set, sweeps between the full CRC checked sweeps only read sensors that report an alarm
+ * (temperature outside the thresholds set with setTempAlarmThresholds()) in a conditional search.
+ */
+#define TEMP_ALARM_MODE 1
+
+/* Thresholds that disable the low or high alarm of a sensor */
+#define TEMP_ALARM_NONE_LOW TEMP_FIXED(-55.0f)
+#define TEMP_ALARM_NONE_HIGH TEMP_FIXED(125.0f)
+
 /* Number of bits resolution for temperature sensors */
 #define SENSOR_RESOLUTION 10
 
-/* Temperature Sensor ID Enumeration */
+/**
+ * When set, each sensor's resolution follows its distance from the thresholds set with 
+ * setTempAlarmThresholds(). Sensors far from both convert at TEMP_RESOLUTION_FAR, sensors 
+ * within TEMP_RESOLUTION_NEAR of one convert at TEMP_RESOLUTION_NEAR. Sensors without a 
+ * valid reading use SENSOR_RESOLUTION.
+ */
+#define TEMP_ADAPTIVE_RESOLUTION 1
+#define TEMP_RESOLUTION_FAR 9
+#define TEMP_RESOLUTION_NEAR 12
+#define TEMP_RESOLUTION_NEAR_C TEMP_FIXED(2.0f)
+
+/* Extra distance (C) a sensor must move away from a threshold before dropping back to TEMP_RESOLUTION_FAR */
+#define TEMP_RESOLUTION_HYSTERESIS_C TEMP_FIXED(0.5f)
+
+/* Consecutive failed reads before a sensor is quarantined */
+#define TEMP_QUARANTINE_FAILURES 3
+
+/**
+ * A quarantined sensor is not read, it is probed with a single CRC checked read after a number
+ * of sweeps that doubles after each failed probe, from TEMP_QUARANTINE_MIN_SWEEPS up to
+ * TEMP_QUARANTINE_MAX_SWEEPS.
+ */
+#define TEMP_QUARANTINE_MIN_SWEEPS 2
+#define TEMP_QUARANTINE_MAX_SWEEPS 64
+
+/* Period between temperature samples published by the acquisition task */
+#define TEMP_SAMPLE_PERIOD_MS 5000
+
+/* Age after which a published temperature is too old to control on */
+#define TEMP_MAX_SAMPLE_AGE_MS (3 * TEMP_SAMPLE_PERIOD_MS)
+
+/* How often a running conversion is polled for completion */
+#define TEMP_CONVERSION_POLL_MS 10
+
+/* Max number of callbacks that can be registered for new temperature samples */
+#define TEMP_MAX_SAMPLE_CALLBACKS 4
+
+/* Max number of temperature sensors across all buses */
+#define TEMP_SENSOR_MAX 8
+
+/* Max length of a temperature sensor name, including the terminator */
+#define TEMP_SENSOR_NAME_LEN 16
+
+/**
+ * Temperature Sensor ID Enumeration. The first IDs are sensors with a fixed role, new sensors 
+ * found on a bus take the first free role. IDs from TEMP_SENSOR_ROLE_COUNT up to TEMP_SENSOR_MAX 
+ * are extra sensors without a role.
+ */
 typedef enum 
 {
     AMBIENT_TEMP_SENSOR = 0,
     WATER_TEMP_SENSOR,
-    TEMP_SENSOR_COUNT
+    SOLAR_TEMP_SENSOR,
+    HEATER_RETURN_TEMP_SENSOR,
+    FILTER_OUTLET_TEMP_SENSOR,
+    TEMP_SENSOR_ROLE_COUNT
 } TempSensorId;
 
+/* Returned by findTempSensor() when no sensor has the name */
+#define TEMP_SENSOR_NONE TEMP_SENSOR_MAX
+
+/* 1-Wire bus configuration, see TEMP_SENSOR_BUSES */
+typedef struct
+{
+    int gpio;
+    int uart;       // Only used by the UART 1-Wire backend
+} TempBusConfig_t;
+
+/* Temperature sensor health states */
+typedef enum
+{
+    TEMP_SENSOR_HEALTHY = 0,        // Last read succeeded
+    TEMP_SENSOR_DEGRADED,           // Recent reads failed, still read every sweep
+    TEMP_SENSOR_QUARANTINED,        // Too many failed reads, only probed with backoff
+} TempSensorHealthState_t;
+
+/* Temperature sensor health, failure counts are totals since boot */
+typedef struct
+{
+    TempSensorHealthState_t state;
+    uint32_t crcErrors;             // Scratchpad CRC mismatch after all retries
+    uint32_t presenceErrors;        // No presence pulse or sensor didn't drive the bus
+    uint32_t allZerosErrors;        // Scratchpad read back as all zeros
+    uint32_t quarantines;           // Times the sensor was quarantined
+    uint8_t consecutiveFailures;
+    uint8_t backoffSweeps;          // Sweeps between probes while quarantined
+    uint8_t sweepsUntilProbe;
+} TempSensorHealth_t;
+
+/**
+ * Published temperatures of all sensors. getTempSnapshot() returns a consistent copy without
+ * taking a lock, so it can be called from any task on either core.
+ */
+typedef struct
+{
+    uint32_t sequence;                      // Incremented by every publish
+    int64_t timestampUs;                    // esp_timer time of the latest publish
+    TempFixed_t temperatures[TEMP_SENSOR_MAX];  // TEMP_FIXED_DISCONNECTED when not valid
+    int64_t sampleTimeUs[TEMP_SENSOR_MAX];  // esp_timer time each temperature was published
+    bool valid[TEMP_SENSOR_MAX];            // Temperature was read successfully
+} TempSnapshot_t;
+
+/**
+ * Callback for new temperature samples. Called from the acquisition task so it should
+ * return quickly, e.g. by notifying the task that consumes the sample.
+ */
+typedef void (*TempSampleCallback_t)(void * arg);
+
 /* Public Function Prototypes */
 esp_err_t configureTempSensors();
-void getTemperatures(float *temperatures);
-bool tempIsDisconnected(float temperature);
-float getLastTemperatureRead(TempSensorId sensorId);
+void getTemperatures(TempFixed_t *temperatures);
+void getTempSnapshot(TempSnapshot_t *snapshot);
+bool tempSnapshotFresh(const TempSnapshot_t *snapshot, TempSensorId sensorId, uint32_t maxAgeMs);
+bool tempIsDisconnected(TempFixed_t temperature);
+TempFixed_t getLastTemperatureRead(TempSensorId sensorId);
+esp_err_t registerTempSampleCallback(TempSampleCallback_t callback, void * arg);
+void getTempBusStats(ds18b20_busStats_t *stats);
+void setTempAlarmThresholds(TempSensorId sensorId, TempFixed_t low, TempFixed_t high);
+bool tempSensorRegistered(TempSensorId sensorId);
+const char * getTempSensorName(TempSensorId sensorId);
+void getTempSensorDefaultName(TempSensorId sensorId, char *name, size_t len);
+TempSensorId findTempSensor(const char *name);
+uint8_t getTempSensorCount();
+esp_err_t getTempSensorHealth(TempSensorId sensorId, TempSensorHealth_t *health);
+
+/**
+ * @brief Converts a fixed point temperature to C for display
+ */
+static inline float tempFixedToC(TempFixed_t temperature)
+{
+    return (float)temperature / TEMP_FIXED_SCALE;
+}
 
+/**
+ * @brief Converts a temperature in C entered by a user to fixed point, rounded to the nearest step
+ */
+static inline TempFixed_t tempCToFixed(float temperature)
+{
+    return (TempFixed_t)lroundf(temperature * TEMP_FIXED_SCALE);
+}
@@ -0,0 +1,140 @@
+/**
+ * @file trend.c
+ *
+ * @brief
+ * Rolling least squares fit over bucketed samples.
+ *
+ * With the n points of the window at x = 0 .. n-1 the x sums are fixed, only sum(y) and
+ * sum(x*y) change. Sliding the window drops the oldest point and moves every other point down
+ * one x, which takes sum(y) of the remaining points off sum(x*y). All sums are integers so
+ * they never drift however long the window slides.
+ *
+ * The projection is integer too. With TREND_POINTS of 60 and 16 bit values the slope numerator
+ * is below 2^33, and times the scaled distance ahead (at most TREND_MAX_HORIZON_SEC) and n
+ * it stays below 2^63.
+ */
+
+// Project Includes
+#include "trend.h"
+
+// Standard Library Includes
+#include <string.h>
+
+/**
+ * @brief Adds a bucket average to the window, dropping the oldest once it is full
+ */
+static void addPoint(TempTrend_t *trend, int32_t value)
+{
+    int32_t oldest;
+
+    if(trend->count < TREND_POINTS)
+    {
+        trend->points[(trend->head + trend->count) % TREND_POINTS] = value;
+        trend->sumXY += (int64_t)trend->count * value;
+        trend->sumY += value;
+        trend->count++;
+    }
+    else
+    {
+        oldest = trend->points[trend->head];
+        trend->points[trend->head] = value;
+        trend->head = (trend->head + 1) % TREND_POINTS;
+
+        trend->sumXY += ((int64_t)(TREND_POINTS - 1) * value) - (trend->sumY - oldest);
+        trend->sumY += value - oldest;
+    }
+}
+
+/**
+ * @brief
+ * Clears the fit, e.g. after the sensor was disconnected
+ *
+ * @param trend Trend to reset
+ */
+void trendReset(TempTrend_t *trend)
+{
+    memset(trend, 0, sizeof(TempTrend_t));
+}
+
+/**
+ * @brief
+ * Adds a sample. A gap of more than a bucket without samples restarts the fit, points in the
+ * window must be evenly spaced.
+ *
+ * @param trend Trend to update
+ * @param timeUs Time of the sample
+ * @param value Sample value
+ */
+void trendAddSample(TempTrend_t *trend, int64_t timeUs, int32_t value)
+{
+    if((trend->bucketSamples == 0) && (trend->count == 0))
+    {
+        trend->bucketStartUs = timeUs;
+    }
+
+    // Close the bucket when the sample is past its end
+    if(timeUs >= (trend->bucketStartUs + TREND_BUCKET_US))
+    {
+        if((trend->bucketSamples == 0) || (timeUs >= (trend->bucketStartUs + (2 * TREND_BUCKET_US))))
+        {
+            trendReset(trend);
+            trend->bucketStartUs = timeUs;
+        }
+        else
+        {
+            addPoint(trend, (int32_t)(trend->bucketSum / (int64_t)trend->bucketSamples));
+            trend->bucketStartUs += TREND_BUCKET_US;
+            trend->bucketSum = 0;
+            trend->bucketSamples = 0;
+        }
+    }
+
+    trend->bucketSum += value;
+    trend->bucketSamples++;
+    trend->lastSampleUs = timeUs;
+}
+
+/**
+ * @brief
+ * Projects the fitted line ahead of the latest sample, in integers only so the control task
+ * never touches the FPU
+ *
+ * @param trend Trend to project
+ * @param horizonSec Time after the latest sample to project to, at most TREND_MAX_HORIZON_SEC
+ * @param projected Projected value, saturated to the range of TempFixed_t above its disconnected value
+ * @return true if projected, false if the window doesn't have TREND_MIN_POINTS yet
+ */
+bool trendProject(const TempTrend_t *trend, uint32_t horizonSec, int16_t *projected)
+{
+    int64_t n = trend->count;
+    int64_t sumX;
+    int64_t denominator;
+    int64_t slopeNumerator;
+    int64_t aheadUs;
+    int64_t ahead;
+    int64_t value;
+
+    if(n < TREND_MIN_POINTS)
+    {
+        return false;
+    }
+
+    // x is the bucket index, sum(x) = n(n-1)/2 and n*sum(x^2) - sum(x)^2 = n^2(n^2-1)/12.
+    // The slope per bucket is slopeNumerator / denominator.
+    sumX = (n * (n - 1)) / 2;
+    denominator = (n * n * ((n * n) - 1)) / 12;
+    slopeNumerator = (n * trend->sumXY) - (sumX * trend->sumY);
+
+    // Buckets from the newest point (its bucket centre) to the horizon, in 1/TREND_AHEAD_SCALE buckets
+    horizonSec = (horizonSec < TREND_MAX_HORIZON_SEC) ? horizonSec : TREND_MAX_HORIZON_SEC;
+    aheadUs = (trend->lastSampleUs - (trend->bucketStartUs - (TREND_BUCKET_US / 2))) + ((int64_t)horizonSec * 1000000);
+    ahead = (aheadUs * TREND_AHEAD_SCALE) / TREND_BUCKET_US;
+
+    // mean(y) + slope * ((n-1)/2 + ahead), over the common denominator TREND_AHEAD_SCALE * n * denominator
+    value = ((TREND_AHEAD_SCALE * trend->sumY * denominator) +
+             (n * slopeNumerator * (((n - 1) * (TREND_AHEAD_SCALE / 2)) + ahead))) /
+            (TREND_AHEAD_SCALE * n * denominator);
+
+    *projected = (int16_t)((value > INT16_MAX) ? INT16_MAX : ((value < -INT16_MAX) ? -INT16_MAX : value));
+    return true;
+}
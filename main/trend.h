@@ -0,0 +1,51 @@
+#pragma once
+/**
+ * @file trend.h
+ *
+ * @brief
+ * Rolling linear fit of a temperature used to project where it will be a while ahead. Samples
+ * are averaged into fixed length buckets and a least squares line is kept over the last
+ * TREND_POINTS buckets. Each sample is O(1): the fit's sums are updated as buckets enter and
+ * leave the window instead of being recomputed.
+ *
+ * Values are fixed point with the same scale as TempFixed_t, times are esp_timer microseconds.
+ * Everything is integer, no FPU use.
+ */
+
+// Standard Library Includes
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Length of a bucket of averaged samples */
+#define TREND_BUCKET_US (60LL * 1000000)
+
+/* Buckets in the fit window, long enough to average out cloud and wind swings */
+#define TREND_POINTS 60
+
+/* Buckets needed before a projection is made */
+#define TREND_MIN_POINTS 5
+
+/* Longest projection, keeps the fixed point projection inside int64_t */
+#define TREND_MAX_HORIZON_SEC (24 * 3600)
+
+/* Resolution of the projection distance, 1/TREND_AHEAD_SCALE of a bucket */
+#define TREND_AHEAD_SCALE 1024
+
+/* Rolling fit state */
+typedef struct
+{
+    int32_t points[TREND_POINTS];   // Bucket averages, oldest at head
+    uint8_t head;
+    uint8_t count;
+    int64_t sumY;                   // Sum of points
+    int64_t sumXY;                  // Sum of points weighted by their index from the oldest
+    int64_t bucketStartUs;          // Start of the bucket being filled
+    int64_t bucketSum;
+    uint32_t bucketSamples;
+    int64_t lastSampleUs;
+} TempTrend_t;
+
+/* Public Function Prototypes */
+void trendReset(TempTrend_t *trend);
+void trendAddSample(TempTrend_t *trend, int64_t timeUs, int32_t value);
+bool trendProject(const TempTrend_t *trend, uint32_t horizonSec, int16_t *projected);
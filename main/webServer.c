@@ -13,19 +13,52 @@
 #include "esp_vfs.h"
 #include <fcntl.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
 
 // Project Incudes
 #include "projectLog.h"
 #include "pumpControl.h"
+#include "wifiManager.h"
 
 
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
 #define SCRATCH_BUFSIZE (10240)
 
-#define DATA_QUEUE_LEN (32)
+/* Most open connections. The server uses 3 lwIP sockets itself, the reserve is left for mDNS,
+ * SNTP, NetBIOS and anything else opening sockets while every connection is in use. */
+#define WS_SOCKET_RESERVE (4)
+#define WS_CLIENT_MAX (CONFIG_LWIP_MAX_SOCKETS - 3 - WS_SOCKET_RESERVE)
+
+/* Per client send queues, drained in httpd context. A slow client only fills its own queue. */
+#define WS_CLIENT_QUEUE_LEN (8)
+#define WS_DATA_QUEUE_POLICY WS_QUEUE_COALESCE_LATEST
+#define WS_DEBUG_QUEUE_POLICY WS_QUEUE_DROP_OLDEST
+
+/* A data client with nothing new is still sent an empty state frame this often, well within the
+ * web page's 20s receive timeout */
+#define WS_HEARTBEAT_US (10 * 1000 * 1000)
+
+/* Payloads a broadcast builds for distinct sets of fields, clients beyond them get their own */
+#define WS_STATE_PAYLOADS_SHARED (4)
+
+/* Websocket send pools. A frame sends a payload to one client, a payload is shared by the frames
+ * sending it to every client. Every queue can be full with one more frame being sent. */
+#define WS_FRAME_POOL_LEN (WS_CLIENT_MAX * (WS_CLIENT_QUEUE_LEN + 1))
+#define WS_PAYLOAD_POOL_LEN (24)
+#define WS_PAYLOAD_MAX_LEN (128)
+
+#define WS_STATS_JSON_BUFSIZE (2560)    // Fits the pool and every client's statistics
+
+#define WIFI_JSON_BUFSIZE (2048)    // Fits the Wi-Fi statistics JSON with every counter at its largest
 
 #define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
 
@@ -34,19 +67,35 @@ typedef struct server_context {
     char           scratch[SCRATCH_BUFSIZE];
 } server_context_t;
 
+/**
+ * Websocket payload, serialized once and shared by the frames sending it. Returned to its pool
+ * when the last reference is released.
+ */
+typedef struct
+{
+    uint8_t data[WS_PAYLOAD_MAX_LEN];
+    uint32_t refs;
+} ws_payload_t;
+
 /**
  * Stuct for queued websocket packets
  */
 typedef struct
 {
-    httpd_ws_frame_t ws_pkt;    // Packet to send
+    httpd_ws_frame_t ws_pkt;    // Packet to send, payload points into payload->data
+    ws_payload_t *payload;      // Reference held until the frame is sent
     int fd;                     // Websocket file descriptor to send with
+    int64_t queuedUs;           // esp_timer time the frame was queued
 } queued_ws_frame_t;
 
 /**
- * Server Handle
+ * What a client queue does with a new frame when it is full
  */
-httpd_handle_t server;
+typedef enum
+{
+    WS_QUEUE_DROP_OLDEST = 0,   // Drop the oldest queued frame
+    WS_QUEUE_COALESCE_LATEST,   // Drop every queued frame and send the client the full state instead
+} ws_queue_policy_t;
 
 /**
  * Enumeration for Websocket Types
@@ -58,13 +107,126 @@ typedef enum
     WS_DATA = 222
 } socketType_t;
 
+/**
+ * State fields a data client is sent, set by its subscription packet
+ */
+typedef struct
+{
+    uint16_t fields;            // Bitmask of wsDataType_t fields
+    int16_t tempDeadband;       // Least temperature change sent, TempFixed_t
+    int64_t minIntervalUs;      // Least time between frames with changes
+} ws_subscription_t;
+
+/**
+ * Copy of the state values taken under wsStateLock, so frames are built without holding it
+ */
+typedef struct
+{
+    int16_t values[WS_STATE_FIELD_LAST + 1];
+    uint16_t validFields;
+    uint32_t sequence;
+} ws_state_snapshot_t;
+
+/**
+ * Websocket client with a bounded queue of frames to send. Any task queues frames, the httpd
+ * task drains them with httpd_queue_work(), so sends never race the server or wait on a client.
+ */
+typedef struct
+{
+    int fd;                     // -1 when the slot is free
+    socketType_t socketType;
+    ws_queue_policy_t policy;
+    queued_ws_frame_t *queue[WS_CLIENT_QUEUE_LEN];
+    uint8_t head;               // Oldest queued frame
+    bool drainQueued;           // Drain work queued and not run yet
+    bool fullStatePending;      // Queued frames were coalesced, send the full state
+    ws_subscription_t subscription;
+    int16_t sentValues[WS_STATE_FIELD_LAST + 1];    // Value of each field last queued to the client
+    uint16_t sentFields;        // Fields in sentValues, a cleared bit is sent at the next broadcast
+    int64_t lastFrameUs;        // esp_timer time the last state frame was queued
+    wsClientStats_t stats;
+} ws_client_t;
+
+_Static_assert(WS_CLIENT_MAX > 0, "CONFIG_LWIP_MAX_SOCKETS leaves no sockets for connections");
+_Static_assert(WS_CLIENT_MAX <= 32, "Subscriber bitmaps hold 32 clients");
+
+/**
+ * Fixed size pool, a stack of free item indexes. Pool functions don't log, as logs are sent to
+ * the remote debugger through the pools.
+ */
+typedef struct
+{
+    uint8_t *items;
+    size_t itemSize;
+    uint8_t length;
+    uint8_t freeCount;
+    uint8_t peakUsed;
+    uint32_t exhausted;         // Allocations that found the pool empty
+    uint8_t *freeIndexes;
+} ws_pool_t;
+
+/**
+ * Server Handle
+ */
+httpd_handle_t server;
+
+// Send pools, guarded by wsPoolLock
+queued_ws_frame_t wsFrames[WS_FRAME_POOL_LEN];
+uint8_t wsFrameFreeIndexes[WS_FRAME_POOL_LEN];
+ws_payload_t wsPayloads[WS_PAYLOAD_POOL_LEN];
+uint8_t wsPayloadFreeIndexes[WS_PAYLOAD_POOL_LEN];
+
+ws_pool_t wsFramePool = {
+    .items = (uint8_t *)wsFrames,
+    .itemSize = sizeof(queued_ws_frame_t),
+    .length = WS_FRAME_POOL_LEN,
+    .freeIndexes = wsFrameFreeIndexes
+};
+ws_pool_t wsPayloadPool = {
+    .items = (uint8_t *)wsPayloads,
+    .itemSize = sizeof(ws_payload_t),
+    .length = WS_PAYLOAD_POOL_LEN,
+    .freeIndexes = wsPayloadFreeIndexes
+};
+portMUX_TYPE wsPoolLock = portMUX_INITIALIZER_UNLOCKED;
+
+// Websocket clients, queues and statistics guarded by wsClientLock
+ws_client_t wsClients[WS_CLIENT_MAX];
+portMUX_TYPE wsClientLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Subscriber registry, a bitmap of wsClients indexes for each websocket type. Kept up to date by
+ * the handshake and the session close hook, so a broadcast only visits its subscribers.
+ * Guarded by wsClientLock.
+ */
+uint32_t wsDataSubscribers = 0;
+uint32_t wsDebugSubscribers = 0;
+
+// Latest state values indexed by wsDataType_t, guarded by wsStateLock
+int16_t wsStateValues[WS_STATE_FIELD_LAST + 1];
+uint16_t wsStateValidFields = 0;        // Fields with a value
+uint32_t wsStateSequence = 0;
+portMUX_TYPE wsStateLock = portMUX_INITIALIZER_UNLOCKED;
+
 // Function Prototypes
 void sendNewConnectionData(int clientFd);
+static void updateSettingsState();
+static void sendFullState(int clientFd);
+static int wsClientFind(int fd);
+static ws_payload_t *buildFullStatePayload(ws_client_t *client, size_t *len);
 
-
-void receiveSettingsData(data32_t* payload, uint32_t len)
+/**
+ * @brief 
+ * Applies a settings packet from a data websocket
+ * 
+ * @param payload Settings packet, SettingsData indexes
+ * @param len Length of the packet in int16_t
+ * @param clientFd Client that sent the packet
+ */
+void receiveSettingsData(const int16_t* payload, uint32_t len, int clientFd)
 {
     const uint32_t SettingsPacketLen = 5;
+    PumpSettings_t settings;
 
     if(len != SettingsPacketLen)
     {
@@ -72,171 +234,890 @@ void receiveSettingsData(data32_t* payload, uint32_t len)
         return;
     }
 
-    if(payload[SETTINGS_TYPE].i != WS_DATA_NEW_SETTING_DATA)
+    if(payload[SETTINGS_TYPE] != WS_DATA_NEW_SETTING_DATA)
     {
-        LOGW("Incorrect Settings Packet Type of %d", payload[SETTINGS_TYPE].i);
+        LOGW("Incorrect Settings Packet Type of %d", payload[SETTINGS_TYPE]);
+        return;
     }
 
-    // Length and type good. Apply settings.
-    SetMinAmbientTemperature(payload[SETTINGS_MIN_AMB_TEMP].f);
-    SetMinWaterTemperature(payload[SETTINGS_MIN_WATER_TEMP].f);
-    SetAmbientTempHysteresis(payload[SETTINGS_AMB_HYSTERESIS].f);
-    SetWaterTempHysteresis(payload[SETTINGS_WATER_HYSTERESIS].f);
+    // Length and type good. Apply the settings together, temperatures are already in fixed point.
+    GetPumpSettings(&settings);
+    settings.minAmbientTemperature = payload[SETTINGS_MIN_AMB_TEMP];
+    settings.minWaterTemperature = payload[SETTINGS_MIN_WATER_TEMP];
+    settings.ambientTempHysteresis = payload[SETTINGS_AMB_HYSTERESIS];
+    settings.waterTempHysteresis = payload[SETTINGS_WATER_HYSTERESIS];
+
+    if(SetPumpSettings(&settings) != ESP_OK)
+    {
+        LOGW("Settings Packet Rejected, Setting Out of Range");
 
-    // Resend Settings Data to All Active Clients
-    sendNewConnectionData(WS_ALL_CLIENTS);
+        // Only the sender shows the rejected settings, put the settings in effect back
+        sendFullState(clientFd);
+        return;
+    }
+
+    // Send the new settings to all active clients
+    updateSettingsState();
+    broadcastState();
 }
 
 /**
  * @brief 
- * Function meant to execute in httpd context due to calling httpd_queue_work() and send frame
+ * Applies a subscription packet from a data websocket and sends it every field it subscribed to
  * 
- * @param arg pointer to httpd_ws_frame_t to send over websocket
+ * @param payload Subscription packet, SubscribeData indexes
+ * @param len Length of the packet in int16_t
+ * @param clientFd Client that sent the packet
  */
-static void wsAsyncSend(void *arg)
+static void receiveSubscription(const int16_t* payload, uint32_t len, int clientFd)
 {
-    queued_ws_frame_t* queuedFrame = (queued_ws_frame_t*)arg;
+    const uint32_t SubscribePacketLen = 4;
+    int clientIndex = wsClientFind(clientFd);
+    ws_client_t *client;
 
-    httpd_ws_send_frame_async(server, queuedFrame->fd, &queuedFrame->ws_pkt);
+    if(len != SubscribePacketLen)
+    {
+        LOGW("Incorrect Subscribe Packet Length of %d", len);
+        return;
+    }
 
-    // Free Data that has been sent
-    free(queuedFrame->ws_pkt.payload);
+    // Only data websockets are sent state
+    if((clientIndex < 0) || (wsClients[clientIndex].socketType != WS_DATA))
+    {
+        return;
+    }
+    client = &wsClients[clientIndex];
+
+    portENTER_CRITICAL(&wsClientLock);
+    client->subscription.fields = (uint16_t)payload[SUBSCRIBE_FIELDS] & WS_STATE_ALL_FIELDS;
+    client->subscription.minIntervalUs = (int64_t)MAX(payload[SUBSCRIBE_MIN_INTERVAL], 0) * 100 * 1000;
+    client->subscription.tempDeadband = MAX(payload[SUBSCRIBE_TEMP_DEADBAND], 0);
+    portEXIT_CRITICAL(&wsClientLock);
+
+    LOGI("Client %d Subscribed to Fields 0x%04x, %dms Interval, %d Deadband", clientFd,
+         (uint16_t)payload[SUBSCRIBE_FIELDS], payload[SUBSCRIBE_MIN_INTERVAL] * 100, payload[SUBSCRIBE_TEMP_DEADBAND]);
 
-    // Free the frame data now that it is not needed
-    free(queuedFrame);
+    sendFullState(clientFd);
 }
 
 /**
  * @brief 
- * Sends string out to remote debugger websockets. Parameters work like standard printf()
+ * Fills a pool's free index stack, all items start free
  */
-void sendToRemoteDebugger(const char *format, ...)
+static void wsPoolInit(ws_pool_t *pool)
+{
+    for(uint8_t i = 0; i < pool->length; i++)
+    {
+        pool->freeIndexes[i] = i;
+    }
+    pool->freeCount = pool->length;
+    pool->peakUsed = 0;
+    pool->exhausted = 0;
+}
+
+/**
+ * @brief 
+ * Takes an item from a pool
+ * 
+ * @return Item, NULL if the pool is empty
+ */
+static void *wsPoolAlloc(ws_pool_t *pool)
+{
+    void *item = NULL;
+
+    portENTER_CRITICAL(&wsPoolLock);
+    if(pool->freeCount > 0)
+    {
+        pool->freeCount--;
+        item = &pool->items[pool->freeIndexes[pool->freeCount] * pool->itemSize];
+        pool->peakUsed = MAX(pool->peakUsed, pool->length - pool->freeCount);
+    }
+    else
+    {
+        pool->exhausted++;
+    }
+    portEXIT_CRITICAL(&wsPoolLock);
+
+    return item;
+}
+
+/**
+ * @brief 
+ * Returns an item to its pool
+ */
+static void wsPoolFree(ws_pool_t *pool, void *item)
+{
+    portENTER_CRITICAL(&wsPoolLock);
+    pool->freeIndexes[pool->freeCount] = ((uint8_t *)item - pool->items) / pool->itemSize;
+    pool->freeCount++;
+    portEXIT_CRITICAL(&wsPoolLock);
+}
+
+/**
+ * @brief 
+ * Takes a payload from the pool with one reference, held by the caller
+ * 
+ * @return Payload, NULL if the pool is empty
+ */
+static ws_payload_t *wsPayloadAlloc()
+{
+    ws_payload_t *payload = wsPoolAlloc(&wsPayloadPool);
+
+    if(payload != NULL)
+    {
+        payload->refs = 1;
+    }
+    return payload;
+}
+
+/**
+ * @brief 
+ * Releases a reference to a payload, the last returns it to the pool
+ */
+static void wsPayloadRelease(ws_payload_t *payload)
+{
+    if(__atomic_sub_fetch(&payload->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        wsPoolFree(&wsPayloadPool, payload);
+    }
+}
+
+/**
+ * @brief 
+ * Releases a frame's payload reference and returns the frame to its pool
+ */
+static void wsFrameRelease(queued_ws_frame_t *queuedFrame)
+{
+    wsPayloadRelease(queuedFrame->payload);
+    wsPoolFree(&wsFramePool, queuedFrame);
+}
+
+/**
+ * @brief 
+ * Removes the oldest frame from a client queue. Must be called under wsClientLock.
+ * 
+ * @return Frame, NULL if the queue is empty
+ */
+static queued_ws_frame_t *wsClientPop(ws_client_t *client)
+{
+    queued_ws_frame_t *queuedFrame;
+
+    if(client->stats.depth == 0)
+    {
+        return NULL;
+    }
+
+    queuedFrame = client->queue[client->head];
+    client->head = (client->head + 1) % WS_CLIENT_QUEUE_LEN;
+    client->stats.depth--;
+    return queuedFrame;
+}
+
+/**
+ * @brief 
+ * Subscriber bitmap of a websocket type. Must be called under wsClientLock.
+ */
+static uint32_t *wsSubscribers(socketType_t socketType)
+{
+    return (socketType == WS_DATA) ? &wsDataSubscribers : &wsDebugSubscribers;
+}
+
+/**
+ * @brief 
+ * Finds the client slot of a websocket
+ * 
+ * @param fd Websocket file descriptor
+ * @return Index in wsClients, -1 if the socket has no slot
+ */
+static int wsClientFind(int fd)
+{
+    int clientIndex = -1;
+
+    portENTER_CRITICAL(&wsClientLock);
+    for(uint8_t i = 0; (clientIndex < 0) && (i < WS_CLIENT_MAX); i++)
+    {
+        if(wsClients[i].fd == fd)
+        {
+            clientIndex = i;
+        }
+    }
+    portEXIT_CRITICAL(&wsClientLock);
+
+    return clientIndex;
+}
+
+/**
+ * @brief 
+ * Frees a client slot, unsubscribes it and releases the frames still queued for it
+ */
+static void wsClientClose(ws_client_t *client)
+{
+    queued_ws_frame_t *dropped[WS_CLIENT_QUEUE_LEN];
+    uint8_t droppedCount = 0;
+
+    portENTER_CRITICAL(&wsClientLock);
+    while(client->stats.depth > 0)
+    {
+        dropped[droppedCount++] = wsClientPop(client);
+    }
+    if(client->fd >= 0)
+    {
+        *wsSubscribers(client->socketType) &= ~(1UL << (client - wsClients));
+    }
+    client->fd = -1;
+    portEXIT_CRITICAL(&wsClientLock);
+
+    for(uint8_t i = 0; i < droppedCount; i++)
+    {
+        wsFrameRelease(dropped[i]);
+    }
+}
+
+/**
+ * @brief 
+ * Gives a new websocket a client slot with an empty queue and subscribes it to its type's
+ * broadcasts. Runs in httpd context at the end of the handshake.
+ * 
+ * @param fd Websocket file descriptor
+ * @param socketType Type of websocket
+ */
+static void wsClientOpen(int fd, socketType_t socketType)
+{
+    ws_client_t *client = NULL;
+    int previous = wsClientFind(fd);
+
+    // A handshake on a socket that already has a slot starts over
+    if(previous >= 0)
+    {
+        wsClientClose(&wsClients[previous]);
+    }
+
+    portENTER_CRITICAL(&wsClientLock);
+    for(uint8_t i = 0; (client == NULL) && (i < WS_CLIENT_MAX); i++)
+    {
+        if(wsClients[i].fd < 0)
+        {
+            client = &wsClients[i];
+            memset(client, 0, sizeof(ws_client_t));
+            client->fd = fd;
+            client->socketType = socketType;
+            client->policy = (socketType == WS_DATA) ? WS_DATA_QUEUE_POLICY : WS_DEBUG_QUEUE_POLICY;
+            client->stats.fd = fd;
+            client->subscription.fields = WS_STATE_ALL_FIELDS;
+            *wsSubscribers(socketType) |= (1UL << i);
+        }
+    }
+    portEXIT_CRITICAL(&wsClientLock);
+
+    if(client == NULL)
+    {
+        LOGE("No Websocket Client Slot for %d", fd);
+    }
+}
+
+/**
+ * @brief 
+ * Sends a frame to its client and records how long it was queued. Runs in httpd context.
+ * 
+ * @return esp_err_t from the send
+ */
+static esp_err_t wsClientSend(ws_client_t *client, httpd_ws_frame_t *ws_pkt, int64_t queuedUs)
+{
+    esp_err_t err = httpd_ws_send_frame_async(server, client->fd, ws_pkt);
+    uint32_t latencyUs = esp_timer_get_time() - queuedUs;
+
+    portENTER_CRITICAL(&wsClientLock);
+    client->stats.sent++;
+    client->stats.totalLatencyUs += latencyUs;
+    client->stats.maxLatencyUs = MAX(client->stats.maxLatencyUs, latencyUs);
+    portEXIT_CRITICAL(&wsClientLock);
+
+    return err;
+}
+
+/**
+ * @brief 
+ * Sends everything queued for a client. Function meant to execute in httpd context due to
+ * calling httpd_queue_work(). A failed send closes the client's slot.
+ * 
+ * @param arg Index of the client in wsClients
+ */
+static void wsDrainClient(void *arg)
+{
+    ws_client_t *client = &wsClients[(uint32_t)arg];
+    queued_ws_frame_t *queuedFrame;
+    ws_payload_t *payload;
+    httpd_ws_frame_t ws_pkt;
+    size_t len;
+    bool fullStatePending;
+    esp_err_t err = ESP_OK;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&wsClientLock);
+    client->drainQueued = false;
+    fullStatePending = client->fullStatePending;
+    client->fullStatePending = false;
+    portEXIT_CRITICAL(&wsClientLock);
+
+    if(client->fd < 0)
+    {
+        return;
+    }
+
+    // The queued frames were dropped, the full state brings the client up to date
+    if(fullStatePending)
+    {
+        payload = buildFullStatePayload(client, &len);
+        if(payload != NULL)
+        {
+            memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+            ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+            ws_pkt.payload = payload->data;
+            ws_pkt.len = len;
+            err = wsClientSend(client, &ws_pkt, now);
+            wsPayloadRelease(payload);
+        }
+    }
+
+    while(err == ESP_OK)
+    {
+        portENTER_CRITICAL(&wsClientLock);
+        queuedFrame = wsClientPop(client);
+        portEXIT_CRITICAL(&wsClientLock);
+
+        if(queuedFrame == NULL)
+        {
+            break;
+        }
+
+        err = wsClientSend(client, &queuedFrame->ws_pkt, queuedFrame->queuedUs);
+        wsFrameRelease(queuedFrame);
+    }
+
+    if(err != ESP_OK)
+    {
+        // The close hook frees the slot
+        httpd_sess_trigger_close(server, client->fd);
+        wsClientClose(client);
+    }
+}
+
+/**
+ * @brief 
+ * Queues a shared payload for one client, taking a reference for the frame. When the client's
+ * queue is full its policy drops the oldest frame, or coalesces everything queued into the
+ * full state. Never blocks, callable from any task.
+ * 
+ * @param payload Payload to send
+ * @param len Length of the payload
+ * @param type Websocket frame type
+ * @param clientIndex Client in wsClients to send to
+ * @return true if the frame was queued or coalesced, false if it was dropped
+ */
+static bool wsQueueSend(ws_payload_t *payload, size_t len, httpd_ws_type_t type, uint32_t clientIndex)
+{
+    queued_ws_frame_t *dropped[WS_CLIENT_QUEUE_LEN + 1];     // The whole queue and this frame
+    uint8_t droppedCount = 0;
+    queued_ws_frame_t *queuedFrame;
+    ws_client_t *client = &wsClients[clientIndex];
+    bool startDrain = false;
+    bool queued = true;
+
+    queuedFrame = wsPoolAlloc(&wsFramePool);
+    if(queuedFrame == NULL)
+    {
+        return false;   // Counted by the pool, the frame is dropped
+    }
+
+    __atomic_add_fetch(&payload->refs, 1, __ATOMIC_RELAXED);
+
+    memset(&queuedFrame->ws_pkt, 0, sizeof(httpd_ws_frame_t));
+    queuedFrame->ws_pkt.type = type;
+    queuedFrame->ws_pkt.len = len;
+    queuedFrame->ws_pkt.payload = payload->data;
+    queuedFrame->payload = payload;
+    queuedFrame->queuedUs = esp_timer_get_time();
+
+    portENTER_CRITICAL(&wsClientLock);
+    queuedFrame->fd = client->fd;
+
+    if(client->fd >= 0)
+    {
+        if(client->stats.depth == WS_CLIENT_QUEUE_LEN)
+        {
+            if(client->policy == WS_QUEUE_COALESCE_LATEST)
+            {
+                while(client->stats.depth > 0)
+                {
+                    dropped[droppedCount++] = wsClientPop(client);
+                }
+                client->fullStatePending = true;
+                client->stats.coalesced++;
+            }
+            else
+            {
+                dropped[droppedCount++] = wsClientPop(client);
+            }
+            client->stats.dropped += droppedCount;
+        }
+
+        if(client->fullStatePending)
+        {
+            // The full state sent at the next drain includes this frame's changes
+            dropped[droppedCount++] = queuedFrame;
+            client->stats.dropped++;
+        }
+        else
+        {
+            client->queue[(client->head + client->stats.depth) % WS_CLIENT_QUEUE_LEN] = queuedFrame;
+            client->stats.depth++;
+            client->stats.peakDepth = MAX(client->stats.peakDepth, client->stats.depth);
+        }
+
+        startDrain = !client->drainQueued;
+        client->drainQueued = true;
+    }
+    else
+    {
+        // Closed since the caller picked it
+        dropped[droppedCount++] = queuedFrame;
+        queued = false;
+    }
+    portEXIT_CRITICAL(&wsClientLock);
+
+    for(uint8_t i = 0; i < droppedCount; i++)
+    {
+        wsFrameRelease(dropped[i]);
+    }
+
+    if(startDrain && (httpd_queue_work(server, wsDrainClient, (void *)clientIndex) != ESP_OK))
+    {
+        // Retried by the next frame queued
+        portENTER_CRITICAL(&wsClientLock);
+        client->drainQueued = false;
+        portEXIT_CRITICAL(&wsClientLock);
+    }
+
+    return queued;
+}
+
+/**
+ * @brief 
+ * Sends a shared payload to every open websocket of a type
+ * 
+ * @param payload Payload to send
+ * @param len Length of the payload
+ * @param type Websocket frame type
+ * @param socketType Websockets to send to
+ */
+static void wsSendToAll(ws_payload_t *payload, size_t len, httpd_ws_type_t type, socketType_t socketType)
 {
-    int clientFds[7];
-    size_t clientCount;
+    uint32_t subscribers;
+
+    portENTER_CRITICAL(&wsClientLock);
+    subscribers = *wsSubscribers(socketType);
+    portEXIT_CRITICAL(&wsClientLock);
 
-    char buffer[128];   // Buffer for building string
-    uint16_t len;
+    // Visit each set bit, lowest first
+    while(subscribers != 0)
+    {
+        wsQueueSend(payload, len, type, __builtin_ctz(subscribers));
+        subscribers &= subscribers - 1;
+    }
+}
 
+/**
+ * @brief 
+ * Session close hook, unsubscribes a websocket and frees its client slot. Replaces the server's
+ * own close, so it closes the socket too.
+ * 
+ * @param hd Server handle
+ * @param sockfd Socket being closed
+ */
+static void wsSessionClose(httpd_handle_t hd, int sockfd)
+{
+    int clientIndex = wsClientFind(sockfd);
+
+    if(clientIndex >= 0)
+    {
+        wsClientClose(&wsClients[clientIndex]);
+    }
+
+    close(sockfd);
+}
+
+/**
+ * @brief 
+ * Sends string out to remote debugger websockets. Parameters work like standard printf()
+ */
+void sendToRemoteDebugger(const char *format, ...)
+{
+    ws_payload_t *payload;
     va_list arg;
 
     // Make sure server is running
     if(server != NULL)
     {
-        // Get Client list. Return immediately if there is an error with the list.
-        if(httpd_get_client_list(server, &clientCount, clientFds) != ESP_OK)
+        // Create string from variable arg list, once for all clients
+        payload = wsPayloadAlloc();
+        if(payload == NULL)
             return;
 
-        // Create string from variable arg list
         va_start(arg, format);
-        vsnprintf(buffer, 128, format, arg);
+        vsnprintf((char *)payload->data, WS_PAYLOAD_MAX_LEN, format, arg);
         va_end(arg);
 
-        len = strlen(buffer);
+        wsSendToAll(payload, strlen((char *)payload->data), HTTPD_WS_TYPE_TEXT, WS_DEBUG);
+
+        wsPayloadRelease(payload);
+    }
+}
+
+/**
+ * @brief 
+ * Sets a state field to be sent by the next broadcastState(). Each client is only sent the
+ * fields that moved past its deadband since it was last sent them.
+ * 
+ * @param field Field to set, WS_STATE_FIELD_FIRST to WS_STATE_FIELD_LAST
+ * @param value New value
+ */
+void updateStateField(wsDataType_t field, int16_t value)
+{
+    if((field < WS_STATE_FIELD_FIRST) || (field > WS_STATE_FIELD_LAST))
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&wsStateLock);
+    wsStateValues[field] = value;
+    wsStateValidFields |= (1 << field);
+    portEXIT_CRITICAL(&wsStateLock);
+}
+
+/**
+ * @brief 
+ * Copies the state values
+ * 
+ * @param state Snapshot output
+ * @param newBroadcast Start a new broadcast sequence
+ */
+static void wsStateSnapshot(ws_state_snapshot_t *state, bool newBroadcast)
+{
+    portENTER_CRITICAL(&wsStateLock);
+    if(newBroadcast)
+    {
+        wsStateSequence++;
+    }
+    memcpy(state->values, wsStateValues, sizeof(state->values));
+    state->validFields = wsStateValidFields;
+    state->sequence = wsStateSequence;
+    portEXIT_CRITICAL(&wsStateLock);
+}
+
+/**
+ * @brief 
+ * Serializes a state frame into a payload
+ * 
+ * @param payload Payload to write the frame to
+ * @param state Values to send
+ * @param fields Fields to include
+ * @return Length of the frame
+ */
+static size_t buildStateFrame(ws_payload_t *payload, const ws_state_snapshot_t *state, uint16_t fields)
+{
+    wsStateFrame_t *frame = (wsStateFrame_t *)payload->data;
+    uint8_t *value = payload->data + sizeof(wsStateFrame_t);
 
-        // Send to all open debugger Websockets
-        for(uint i = 0; i < clientCount; i++)
+    frame->type = WS_DATA_STATE;
+    frame->version = WS_STATE_FRAME_VERSION;
+    frame->reserved = 0;
+    frame->fields = fields;
+    frame->sequence = state->sequence;
+    frame->timestampMs = esp_timer_get_time() / 1000;
+
+    for(uint8_t field = WS_STATE_FIELD_FIRST; field <= WS_STATE_FIELD_LAST; field++)
+    {
+        if(fields & (1 << field))
         {
-            // Check that this connection is a Debug Websocket
-            if((uint32_t)httpd_sess_get_ctx(server, clientFds[i]) == WS_DEBUG)
-            {
-                // Create Websocket packet
-                queued_ws_frame_t * queuedData = calloc(1, sizeof(queued_ws_frame_t));
+            memcpy(value, &state->values[field], sizeof(int16_t));
+            value += sizeof(int16_t);
+        }
+    }
 
-                // Copy Data to be sent so that is persists after this function ends
-                char* dataCopy = malloc(len);
-                memcpy(dataCopy, buffer, len); 
+    return value - payload->data;
+}
 
-                queuedData->ws_pkt.type = HTTPD_WS_TYPE_TEXT;
-                queuedData->ws_pkt.len = len;
-                queuedData->ws_pkt.payload = (uint8_t*)dataCopy;
+/**
+ * @brief 
+ * Picks the fields of a state frame for a data client and records them as sent. A broadcast sends
+ * the subscribed fields that moved past the client's deadband, once its rate limit allows, or an
+ * empty frame when nothing was sent for WS_HEARTBEAT_US. Must be called under wsClientLock.
+ * 
+ * @param client Data client
+ * @param state Values to send
+ * @param full Send every subscribed field now, not only the changes
+ * @param fields Fields for the frame
+ * @return true to send the client a frame
+ */
+static bool wsClientStateFields(ws_client_t *client, const ws_state_snapshot_t *state, bool full, uint16_t *fields)
+{
+    uint16_t candidates = client->subscription.fields & state->validFields;
+    int64_t now = esp_timer_get_time();
+    int64_t sinceFrameUs = now - client->lastFrameUs;
+    int32_t deadband;
+    int32_t change;
+
+    *fields = 0;
+    for(uint8_t field = WS_STATE_FIELD_FIRST; field <= WS_STATE_FIELD_LAST; field++)
+    {
+        if(!(candidates & (1 << field)))
+        {
+            continue;
+        }
 
-                queuedData->fd = clientFds[i];
+        // Settings and the pump state are sent on any change
+        deadband = ((field == WS_DATA_WATER_TEMP) || (field == WS_DATA_AMB_TEMP)) ? client->subscription.tempDeadband : 0;
+        change = abs((int32_t)state->values[field] - client->sentValues[field]);
 
-                //httpd_queue_work(server, wsAsyncSend, queuedData);
-                wsAsyncSend(queuedData);
-            }
+        if(full || !(client->sentFields & (1 << field)) || (change > deadband))
+        {
+            *fields |= (1 << field);
         }
     }
+
+    if(!full && (sinceFrameUs < WS_HEARTBEAT_US) &&
+       ((*fields == 0) || (sinceFrameUs < client->subscription.minIntervalUs)))
+    {
+        client->stats.skipped++;
+        return false;
+    }
+
+    for(uint8_t field = WS_STATE_FIELD_FIRST; field <= WS_STATE_FIELD_LAST; field++)
+    {
+        if(*fields & (1 << field))
+        {
+            client->sentValues[field] = state->values[field];
+        }
+    }
+    client->sentFields |= *fields;
+    client->lastFrameUs = now;
+    return true;
 }
 
 /**
  * @brief 
- * Sends Data out on all open Data Websockets
+ * Marks fields as not sent to a client, after their frame was dropped, so the next broadcast
+ * sends them again
  * 
- * @param dataType Data Type Specifier to add to packet
- * @param data Data to be sent
- * @param clientFd Specific Client to Send Data too, set to -1 to send to all clients
+ * @param client Data client
+ * @param fields Fields of the dropped frame
+ */
+static void wsClientForgetFields(ws_client_t *client, uint16_t fields)
+{
+    portENTER_CRITICAL(&wsClientLock);
+    client->sentFields &= ~fields;
+    portEXIT_CRITICAL(&wsClientLock);
+}
+
+/**
+ * @brief 
+ * Sends each open data websocket the state fields it subscribed to that changed past its
+ * deadband, within its rate limit. Clients needing the same fields share one payload.
  */
-void sendData(wsDataType_t dataType, uint32_t data, int clientFd)
+void broadcastState()
 {
-    int allClientFds[7];
-    size_t clientCount;
+    ws_state_snapshot_t state;
+    uint32_t subscribers;
+    uint8_t clientIndexes[WS_CLIENT_MAX];
+    uint16_t clientFields[WS_CLIENT_MAX];
+    uint8_t clientCount = 0;
+    ws_payload_t *shared[WS_STATE_PAYLOADS_SHARED];
+    uint16_t sharedFields[WS_STATE_PAYLOADS_SHARED];
+    size_t sharedLens[WS_STATE_PAYLOADS_SHARED];
+    uint8_t sharedCount = 0;
+    ws_payload_t *payload;
+    size_t len;
+    uint8_t match;
+    bool unshared;
 
     // Make sure server is running
-    if(server != NULL)
+    if(server == NULL)
     {
-        // Create Websocket packet
-        queued_ws_frame_t wsFrame;
+        return;
+    }
 
-        wsFrame.ws_pkt.type = HTTPD_WS_TYPE_BINARY;
-        wsFrame.ws_pkt.len = 8;
-        wsFrame.fd = clientFd;
+    wsStateSnapshot(&state, true);
 
-        // Check if we are sending to a specific client
-        if(clientFd != WS_ALL_CLIENTS)
+    portENTER_CRITICAL(&wsClientLock);
+    subscribers = wsDataSubscribers;
+    while(subscribers != 0)
+    {
+        clientIndexes[clientCount] = __builtin_ctz(subscribers);
+        if(wsClientStateFields(&wsClients[clientIndexes[clientCount]], &state, false, &clientFields[clientCount]))
         {
-            // Allocate persistent memory and copy packet data
-            queued_ws_frame_t * queuedData = calloc(1, sizeof(queued_ws_frame_t));
-            memcpy(queuedData, &wsFrame, sizeof(queued_ws_frame_t));
+            clientCount++;
+        }
+        subscribers &= subscribers - 1;
+    }
+    portEXIT_CRITICAL(&wsClientLock);
 
-            // Copy Data to be sent so that is persists after this function ends
-            uint32_t* payload = malloc(2*sizeof(uint32_t));
-            payload[0] = dataType;
-            payload[1] = data;
+    for(uint8_t i = 0; i < clientCount; i++)
+    {
+        unshared = false;
+        match = 0;
+        while((match < sharedCount) && (sharedFields[match] != clientFields[i]))
+        {
+            match++;
+        }
 
-            queuedData->ws_pkt.payload = (uint8_t*)payload;
+        if(match < sharedCount)
+        {
+            payload = shared[match];
+            len = sharedLens[match];
+        }
+        else
+        {
+            payload = wsPayloadAlloc();
+            if(payload != NULL)
+            {
+                len = buildStateFrame(payload, &state, clientFields[i]);
+                if(sharedCount < WS_STATE_PAYLOADS_SHARED)
+                {
+                    shared[sharedCount] = payload;
+                    sharedFields[sharedCount] = clientFields[i];
+                    sharedLens[sharedCount] = len;
+                    sharedCount++;
+                }
+                else
+                {
+                    unshared = true;
+                }
+            }
+        }
 
-            //httpd_queue_work(server, wsAsyncSend, queuedData);
-            wsAsyncSend(queuedData);
+        if((payload == NULL) || !wsQueueSend(payload, len, HTTPD_WS_TYPE_BINARY, clientIndexes[i]))
+        {
+            wsClientForgetFields(&wsClients[clientIndexes[i]], clientFields[i]);
+        }
 
-            return;     // Only sending to specific client. Skip the rest of the function.
+        // A payload that isn't shared is only held by its frame
+        if(unshared)
+        {
+            wsPayloadRelease(payload);
         }
+    }
 
-        // Get Client list. Return immediately if there is an error with the list.
-        if(httpd_get_client_list(server, &clientCount, allClientFds) != ESP_OK)
-            return;
+    for(uint8_t i = 0; i < sharedCount; i++)
+    {
+        wsPayloadRelease(shared[i]);
+    }
+}
 
-        // Send to all open data Websockets
-        for(uint i = 0; i < clientCount; i++)
-        {
-            // Check that socket is a data websocket
-            if((uint32_t)httpd_sess_get_ctx(server, allClientFds[i]) == WS_DATA)
-            {
-                // Create Websocket packet
-                queued_ws_frame_t * queuedData = calloc(1, sizeof(queued_ws_frame_t));
-                memcpy(queuedData, &wsFrame, sizeof(queued_ws_frame_t));
+/**
+ * @brief 
+ * Builds a state frame of every field a client subscribed to, with the sequence of the last
+ * broadcast, and records them as sent
+ * 
+ * @param client Data client
+ * @param len Length of the frame
+ * @return Payload holding the frame with one reference, NULL if the pool is empty
+ */
+static ws_payload_t *buildFullStatePayload(ws_client_t *client, size_t *len)
+{
+    ws_state_snapshot_t state;
+    uint16_t fields;
+    ws_payload_t *payload = wsPayloadAlloc();
 
-                // Copy Data to be sent so that is persists after this function ends
-                uint32_t* payload = malloc(2*sizeof(uint32_t));
-                payload[0] = dataType;
-                payload[1] = data;
+    if(payload == NULL)
+    {
+        // Sent by the next broadcast instead
+        wsClientForgetFields(client, WS_STATE_ALL_FIELDS);
+        return NULL;
+    }
 
-                // Update payload pointer
-                queuedData->ws_pkt.payload = (uint8_t*)payload;
+    wsStateSnapshot(&state, false);
 
-                // Update client Fds
-                queuedData->fd = allClientFds[i];
+    portENTER_CRITICAL(&wsClientLock);
+    wsClientStateFields(client, &state, true, &fields);
+    portEXIT_CRITICAL(&wsClientLock);
 
-                LOGI("Sending Data to client ID: %d", allClientFds[i]);
+    *len = buildStateFrame(payload, &state, fields);
+    return payload;
+}
 
-                //httpd_queue_work(server, wsAsyncSend, queuedData);
-                wsAsyncSend(queuedData);
-            }
+/**
+ * @brief 
+ * Sends every state field a client subscribed to
+ * 
+ * @param clientFd Client to send to
+ */
+static void sendFullState(int clientFd)
+{
+    size_t len;
+    int clientIndex = wsClientFind(clientFd);
+    ws_payload_t *payload;
+
+    if(clientIndex < 0)
+    {
+        return;
+    }
+
+    payload = buildFullStatePayload(&wsClients[clientIndex], &len);
+    if(payload != NULL)
+    {
+        if(!wsQueueSend(payload, len, HTTPD_WS_TYPE_BINARY, clientIndex))
+        {
+            wsClientForgetFields(&wsClients[clientIndex], WS_STATE_ALL_FIELDS);
         }
+        wsPayloadRelease(payload);
     }
 }
 
+/**
+ * @brief 
+ * Get the occupancy of the websocket send pools
+ * 
+ * @param stats Pool statistics output
+ */
+void getWsPoolStats(wsPoolStats_t *stats)
+{
+    portENTER_CRITICAL(&wsPoolLock);
+    stats->framesInUse = wsFramePool.length - wsFramePool.freeCount;
+    stats->framesPeak = wsFramePool.peakUsed;
+    stats->framesTotal = wsFramePool.length;
+    stats->framesExhausted = wsFramePool.exhausted;
+    stats->payloadsInUse = wsPayloadPool.length - wsPayloadPool.freeCount;
+    stats->payloadsPeak = wsPayloadPool.peakUsed;
+    stats->payloadsTotal = wsPayloadPool.length;
+    stats->payloadsExhausted = wsPayloadPool.exhausted;
+    portEXIT_CRITICAL(&wsPoolLock);
+}
+
+/**
+ * @brief 
+ * Get the send queue statistics of the open websockets
+ * 
+ * @param stats Statistics output, one per client
+ * @param maxCount Length of stats
+ * @return Number of clients written to stats
+ */
+uint8_t getWsClientStats(wsClientStats_t *stats, uint8_t maxCount)
+{
+    uint8_t count = 0;
+
+    portENTER_CRITICAL(&wsClientLock);
+    for(uint8_t i = 0; (i < WS_CLIENT_MAX) && (count < maxCount); i++)
+    {
+        if(wsClients[i].fd >= 0)
+        {
+            stats[count++] = wsClients[i].stats;
+        }
+    }
+    portEXIT_CRITICAL(&wsClientLock);
+
+    return count;
+}
+
 /**
  * @brief 
  * Blank Session Context Free Function. Session Context pointers are just used to save what type of connection
@@ -251,22 +1132,33 @@ static void wsSessContextFreeFunc(void *ctx)
     return;     // Do nothing
 }
 
-void sendNewConnectionData(int clientFd)
+/**
+ * @brief 
+ * Updates the settings state fields from one settings snapshot
+ */
+static void updateSettingsState()
 {
-    data32_t temp;
-
-    LOGI("Sending new Connection data");
-    temp.f = GetMinAmbientTemperature();
-    sendData(WS_DATA_SETTING_MIN_AMB,    temp.i, clientFd);
+    PumpSettings_t settings;
 
-    temp.f = GetAmbientTempHysteresis();
-    sendData(WS_DATA_SETTING_AMB_HYST,   temp.i, clientFd);
+    GetPumpSettings(&settings);
 
-    temp.f = GetMinWaterTemperature();
-    sendData(WS_DATA_SETTING_MIN_WATER,  temp.i, clientFd);
+    updateStateField(WS_DATA_SETTING_MIN_AMB,    settings.minAmbientTemperature);
+    updateStateField(WS_DATA_SETTING_AMB_HYST,   settings.ambientTempHysteresis);
+    updateStateField(WS_DATA_SETTING_MIN_WATER,  settings.minWaterTemperature);
+    updateStateField(WS_DATA_SETTING_WATER_HYST, settings.waterTempHysteresis);
+}
 
-    temp.f = GetWaterTempHysteresis();
-    sendData(WS_DATA_SETTING_WATER_HYST, temp.i, clientFd);
+/**
+ * @brief 
+ * Sends the current state to a new data websocket
+ * 
+ * @param clientFd New client
+ */
+void sendNewConnectionData(int clientFd)
+{
+    LOGI("Sending new Connection data");
+    updateSettingsState();
+    sendFullState(clientFd);
 }
 
 /**
@@ -284,10 +1176,12 @@ static esp_err_t wsHandler(httpd_req_t *req)
         switch((uint32_t)req->user_ctx)
         {
             case WS_DEBUG:
+                wsClientOpen(httpd_req_to_sockfd(req), WS_DEBUG);
                 LOGI("Handshake done, Debug Websocket opened");
                 break;
 
             case WS_DATA:
+                wsClientOpen(httpd_req_to_sockfd(req), WS_DATA);
                 LOGI("Handshake done, Data Websocket opened");
                 sendNewConnectionData(httpd_req_to_sockfd(req));
                 break;
@@ -309,10 +1203,8 @@ static esp_err_t wsHandler(httpd_req_t *req)
         return ESP_OK;
     }
 
-    // Start handling data received from websockets here. Not Implemented yet, place holder only.
-
     httpd_ws_frame_t ws_pkt;
-    data32_t *buf = NULL;
+    int16_t *buf = NULL;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
     ws_pkt.type = HTTPD_WS_TYPE_BINARY;
     /* Set max_len = 0 to get the frame len */
@@ -338,20 +1230,29 @@ static esp_err_t wsHandler(httpd_req_t *req)
         }
         
         // Show received data
-        for(uint16_t i = 0; i < (ws_pkt.len/sizeof(uint32_t)); i++)
+        for(uint16_t i = 0; i < (ws_pkt.len/sizeof(int16_t)); i++)
         {
-            if(i == 0)
-            {
-                LOGI("Data %d: %d", i, buf[i].i);
-            }
-            else
-            {
-                LOGI("Data %d: %0.2f", i, buf[i].f);
-            }
+            LOGI("Data %d: %d", i, buf[i]);
         }
     }
 
-    receiveSettingsData(buf, ws_pkt.len/sizeof(data32_t));
+    // Packets from the web page start with their wsDataType_t
+    if(ws_pkt.len < sizeof(int16_t))
+    {
+        LOGW("Websocket Packet Too Short");
+    }
+    else if(buf[0] == WS_DATA_NEW_SETTING_DATA)
+    {
+        receiveSettingsData(buf, ws_pkt.len/sizeof(int16_t), httpd_req_to_sockfd(req));
+    }
+    else if(buf[0] == WS_DATA_SUBSCRIBE)
+    {
+        receiveSubscription(buf, ws_pkt.len/sizeof(int16_t), httpd_req_to_sockfd(req));
+    }
+    else
+    {
+        LOGW("Unknown Websocket Packet Type of %d", buf[0]);
+    }
 
     free(buf);
     return ret;
@@ -435,6 +1336,124 @@ static esp_err_t common_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/**
+ * @brief 
+ * Appends a JSON array of counters to a buffer
+ * 
+ * @return Characters written, as snprintf()
+ */
+static int jsonCounterArray(char *buffer, size_t size, const uint32_t *counters, uint8_t count)
+{
+    int len = snprintf(buffer, size, "[");
+
+    for(uint8_t i = 0; (i < count) && (len < size); i++)
+    {
+        len += snprintf(&buffer[len], size - len, "%s%u", (i == 0) ? "" : ",", counters[i]);
+    }
+    if(len < size)
+    {
+        len += snprintf(&buffer[len], size - len, "]");
+    }
+    return len;
+}
+
+/**
+ * @brief 
+ * Responds with the Wi-Fi connection statistics as JSON. Latency histogram bucket i counts
+ * attempts under latencyBucketMs << i, the last bucket everything slower.
+ * 
+ * @param req 
+ * @return esp_err_t 
+ */
+static esp_err_t wifiStatsHandler(httpd_req_t *req)
+{
+    WifiStats_t stats;
+    char *json;
+    int len;
+
+    json = malloc(WIFI_JSON_BUFSIZE);
+    if(json == NULL)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No Memory");
+        return ESP_ERR_NO_MEM;
+    }
+
+    getWifiStats(&stats);
+
+    len = snprintf(json, WIFI_JSON_BUFSIZE,
+                   "{\"connected\":%s,\"channel\":%u,\"rssi\":%d,\"rssiMin\":%d,\"rssiMax\":%d,\"rssiAvg\":%d,"
+                   "\"connectAttempts\":%u,\"connectFailures\":%u,\"disconnects\":%u,\"backoffMs\":%u,"
+                   "\"lastTimeToIpMs\":%u,\"maxTimeToIpMs\":%u,\"latencyBucketMs\":%u,\"connectedLatency\":",
+                   stats.connected ? "true" : "false", stats.channel, stats.rssi, stats.rssiMin, stats.rssiMax, stats.rssiAvg,
+                   stats.connectAttempts, stats.connectFailures, stats.disconnects, stats.backoffMs,
+                   stats.lastTimeToIpMs, stats.maxTimeToIpMs, WIFI_LATENCY_BUCKET_MS);
+    len += jsonCounterArray(&json[len], WIFI_JSON_BUFSIZE - len, stats.connectedLatency, WIFI_LATENCY_BUCKETS);
+    len += snprintf(&json[len], WIFI_JSON_BUFSIZE - len, ",\"failedLatency\":");
+    len += jsonCounterArray(&json[len], WIFI_JSON_BUFSIZE - len, stats.failedLatency, WIFI_LATENCY_BUCKETS);
+    len += snprintf(&json[len], WIFI_JSON_BUFSIZE - len, ",\"recentDisconnects\":[");
+    for(uint8_t i = 0; i < stats.recentDisconnectCount; i++)
+    {
+        len += snprintf(&json[len], WIFI_JSON_BUFSIZE - len, "%s{\"reason\":%u,\"uptimeSecs\":%u}", (i == 0) ? "" : ",",
+                        stats.recentDisconnects[i].reason, stats.recentDisconnects[i].uptimeSecs);
+    }
+    len += snprintf(&json[len], WIFI_JSON_BUFSIZE - len, "]}");
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, MIN(len, WIFI_JSON_BUFSIZE - 1));
+
+    free(json);
+    return ESP_OK;
+}
+
+/**
+ * @brief 
+ * Responds with the occupancy of the websocket send pools and the client queues as JSON
+ * 
+ * @param req 
+ * @return esp_err_t 
+ */
+static esp_err_t wsStatsHandler(httpd_req_t *req)
+{
+    wsPoolStats_t stats;
+    wsClientStats_t clientStats[WS_CLIENT_MAX];
+    uint8_t clientCount;
+    char *json;
+    int len;
+
+    json = malloc(WS_STATS_JSON_BUFSIZE);
+    if(json == NULL)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No Memory");
+        return ESP_ERR_NO_MEM;
+    }
+
+    getWsPoolStats(&stats);
+    clientCount = getWsClientStats(clientStats, WS_CLIENT_MAX);
+
+    len = snprintf(json, WS_STATS_JSON_BUFSIZE,
+                   "{\"frames\":{\"inUse\":%u,\"peak\":%u,\"total\":%u,\"exhausted\":%u},"
+                   "\"payloads\":{\"inUse\":%u,\"peak\":%u,\"total\":%u,\"exhausted\":%u},\"clients\":[",
+                   stats.framesInUse, stats.framesPeak, stats.framesTotal, stats.framesExhausted,
+                   stats.payloadsInUse, stats.payloadsPeak, stats.payloadsTotal, stats.payloadsExhausted);
+    for(uint8_t i = 0; i < clientCount; i++)
+    {
+        len += snprintf(&json[len], WS_STATS_JSON_BUFSIZE - len,
+                        "%s{\"fd\":%d,\"depth\":%u,\"peakDepth\":%u,\"sent\":%u,\"dropped\":%u,\"coalesced\":%u,"
+                        "\"skipped\":%u,\"avgLatencyUs\":%u,\"maxLatencyUs\":%u}",
+                        (i == 0) ? "" : ",", clientStats[i].fd, clientStats[i].depth, clientStats[i].peakDepth,
+                        clientStats[i].sent, clientStats[i].dropped, clientStats[i].coalesced, clientStats[i].skipped,
+                        (clientStats[i].sent > 0) ? (uint32_t)(clientStats[i].totalLatencyUs / clientStats[i].sent) : 0,
+                        clientStats[i].maxLatencyUs);
+    }
+    len += snprintf(&json[len], WS_STATS_JSON_BUFSIZE - len, "]}");
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, MIN(len, WS_STATS_JSON_BUFSIZE - 1));
+
+    free(json);
+    return ESP_OK;
+}
+
 /**
  * @brief 
  * Top Level Function to start the webserver and register URIs
@@ -454,7 +1473,16 @@ esp_err_t start_web_server(const char *base_path)
 
     strlcpy(serverContext->base_path, base_path, sizeof(serverContext->base_path));
 
+    wsPoolInit(&wsFramePool);
+    wsPoolInit(&wsPayloadPool);
+    for(uint8_t i = 0; i < WS_CLIENT_MAX; i++)
+    {
+        wsClients[i].fd = -1;
+    }
+
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_open_sockets = WS_CLIENT_MAX;
+    config.close_fn = wsSessionClose;
     ESP_LOGI("startServer", "Max Open Connections = %d", config.max_open_sockets);
     config.uri_match_fn = httpd_uri_match_wildcard;
 
@@ -481,6 +1509,23 @@ esp_err_t start_web_server(const char *base_path)
     };
     httpd_register_uri_handler(server, &wsData);
 
+    /* URI handlers for statistics, before the wildcard file handler */
+    httpd_uri_t wifiStats = {
+        .uri        = "/api/v1/wifi",
+        .method     = HTTP_GET,
+        .handler    = wifiStatsHandler,
+        .user_ctx   = NULL
+    };
+    httpd_register_uri_handler(server, &wifiStats);
+
+    httpd_uri_t wsStats = {
+        .uri        = "/api/v1/wsStats",
+        .method     = HTTP_GET,
+        .handler    = wsStatsHandler,
+        .user_ctx   = NULL
+    };
+    httpd_register_uri_handler(server, &wsStats);
+
     /* URI handler for getting web server files */
     httpd_uri_t common_get_uri = {
         .uri = "/*",
@@ -8,17 +8,9 @@
 
 #include "esp_err.h"
 
-#define WS_ALL_CLIENTS (-1)
+#include <stdint.h>
 
-/**
- * @brief 
- * Union used to reinterpret floats and uint32_t types for data transmission over sockets.
- */
-typedef union
-{
-    uint32_t i;
-    float f;
-} data32_t;
+#define WS_ALL_CLIENTS (-1)
 
 typedef enum
 {
@@ -35,10 +27,42 @@ typedef enum
     WS_DATA_SETTING_MIN_WATER,
     WS_DATA_SETTING_WATER_HYST,
     WS_DATA_NEW_SETTING_DATA,
+
+    // Coalesced state
+    WS_DATA_STATE,
+
+    // Client subscription
+    WS_DATA_SUBSCRIBE,
 } wsDataType_t;
 
+/* Fields a state frame can carry, the feedback and settings data types */
+#define WS_STATE_FIELD_FIRST WS_DATA_PUMP_STATE
+#define WS_STATE_FIELD_LAST WS_DATA_SETTING_WATER_HYST
+#define WS_STATE_ALL_FIELDS (((1 << (WS_STATE_FIELD_LAST + 1)) - 1) & ~((1 << WS_STATE_FIELD_FIRST) - 1))
+
+/* Layout version of wsStateFrame_t, changed whenever the layout changes */
+#define WS_STATE_FRAME_VERSION 1
+
+/**
+ * @brief 
+ * State websocket frame, little endian. Followed by an int16_t value for each bit set in fields,
+ * in bit order, where bit n is wsDataType_t n. A broadcast carries the subscribed fields that moved
+ * past the client's deadband since it was last sent them, a new connection or subscription gets
+ * every subscribed field. Temperatures are sent as TempFixed_t (1/128 C) and only converted to C
+ * by the web page.
+ */
+typedef struct __attribute__((packed))
+{
+    uint16_t type;          // WS_DATA_STATE
+    uint8_t version;        // WS_STATE_FRAME_VERSION
+    uint8_t reserved;
+    uint16_t fields;        // Bitmask of the values that follow
+    uint32_t sequence;      // Incremented by every broadcast, clients skip broadcasts with no changes
+    uint32_t timestampMs;   // Time since boot the state was sent
+} wsStateFrame_t;
+
 /**
- * @brief Defines the indexes of the settings data packet
+ * @brief Defines the indexes of the settings data packet, an array of int16_t
  */
 typedef enum
 {
@@ -49,6 +73,53 @@ typedef enum
     SETTINGS_WATER_HYSTERESIS,
 } SettingsData;
 
+/**
+ * @brief Defines the indexes of the subscription packet, an array of int16_t. Picks the state
+ * fields a data websocket is sent and how often. A client with no subscription gets every field
+ * on any change.
+ */
+typedef enum
+{
+    SUBSCRIBE_TYPE = 0,         // WS_DATA_SUBSCRIBE
+    SUBSCRIBE_FIELDS,           // Bitmask of the fields to send, as in wsStateFrame_t
+    SUBSCRIBE_MIN_INTERVAL,     // Least time between frames, 100ms units
+    SUBSCRIBE_TEMP_DEADBAND,    // Least temperature change sent, TempFixed_t
+} SubscribeData;
+
+/**
+ * @brief Occupancy of the websocket send pools
+ */
+typedef struct
+{
+    uint8_t framesInUse;
+    uint8_t framesPeak;
+    uint8_t framesTotal;
+    uint32_t framesExhausted;       // Frames dropped because the pool was empty
+    uint8_t payloadsInUse;
+    uint8_t payloadsPeak;
+    uint8_t payloadsTotal;
+    uint32_t payloadsExhausted;     // Sends dropped because the pool was empty
+} wsPoolStats_t;
+
+/**
+ * @brief Send queue statistics of a websocket client
+ */
+typedef struct
+{
+    int fd;
+    uint8_t depth;                  // Frames queued
+    uint8_t peakDepth;
+    uint32_t sent;
+    uint32_t dropped;               // Frames dropped because the queue was full
+    uint32_t coalesced;             // Times the queue was replaced by the full state
+    uint32_t skipped;               // Broadcasts with nothing past the client's deadband or rate
+    uint32_t maxLatencyUs;          // Longest time from queued to sent
+    uint64_t totalLatencyUs;        // Of all frames sent, for the average
+} wsClientStats_t;
+
 esp_err_t start_web_server(const char *base_path);
 void sendToRemoteDebugger(const char *format, ...);
-void sendData(wsDataType_t dataType, uint32_t data, int clientFds);
\ No newline at end of file
+void updateStateField(wsDataType_t field, int16_t value);
+void broadcastState();
+void getWsPoolStats(wsPoolStats_t *stats);
+uint8_t getWsClientStats(wsClientStats_t *stats, uint8_t maxCount);
\ No newline at end of file
@@ -0,0 +1,449 @@
+/**
+ * @file wifiManager.c
+ *
+ * @brief
+ * Wi-Fi station connection manager. Each connect attempt that fails, and each connection that is
+ * lost, schedules the next attempt after a jittered exponential backoff so a missing access point
+ * doesn't keep the radio and CPU busy. Attempt latencies, disconnect reasons, time to IP and RSSI
+ * are recorded to see how good the link is.
+ */
+
+// Project Includes
+#include "wifiManager.h"
+#include "WifiConfig.h"
+#include "projectLog.h"
+
+// ESP IDF Includes
+#include "esp_event.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs.h"
+
+// FreeRTOS Includes
+#include "freertos/FreeRTOS.h"
+
+// Standard Library Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+/* NVS location of the access point of the last successful connection */
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_AP_KEY "lastAp"
+
+/* Reconnect backoff, doubled by every failed attempt and reset once an IP is assigned */
+#define WIFI_BACKOFF_MIN_MS 500
+#define WIFI_BACKOFF_MAX_MS (60 * 1000)
+
+/* RSSI sampling while connected, the average weights each new sample 1/WIFI_RSSI_AVG_WEIGHT */
+#define WIFI_RSSI_PERIOD_MS (10 * 1000)
+#define WIFI_RSSI_AVG_WEIGHT 8
+
+/* Access point the station last connected to, lets it connect without scanning every channel */
+typedef struct
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+} WifiApCache_t;
+
+WifiApCache_t WifiApCache;
+bool WifiApCacheValid = false;      // Connecting to the cached access point
+
+// Connection state and statistics, guarded by WifiLock
+portMUX_TYPE WifiLock = portMUX_INITIALIZER_UNLOCKED;
+WifiStats_t WifiStats;
+bool WifiAssociated = false;
+int64_t WifiAttemptStartUs = 0;     // Start of the attempt in progress
+int64_t WifiOutageStartUs = 0;      // First attempt since boot or the last disconnect, 0 once connected
+uint32_t WifiBackoffMs = WIFI_BACKOFF_MIN_MS;
+int32_t WifiRssiAvgSixteenths = 0;  // Moving average in 1/16 dBm
+
+// Timers
+esp_timer_handle_t WifiReconnectTimer;
+esp_timer_handle_t WifiRssiTimer;
+
+// Private Function Prototypes
+void startConnectAttempt();
+void scheduleReconnect();
+
+/**
+ * @brief Loads the access point of the last successful connection from NVS
+ *
+ * @return true if the cache was loaded
+ */
+static bool loadWifiApCache(void)
+{
+    nvs_handle_t handle;
+    size_t length = sizeof(WifiApCache);
+    esp_err_t err;
+
+    err = nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if(err != ESP_OK)
+    {
+        return false;
+    }
+
+    err = nvs_get_blob(handle, WIFI_NVS_AP_KEY, &WifiApCache, &length);
+    nvs_close(handle);
+
+    return (err == ESP_OK) && (length == sizeof(WifiApCache)) && (WifiApCache.channel != 0);
+}
+
+/**
+ * @brief Saves the access point of a successful connection to NVS, if it changed
+ *
+ * @param event Connected event with the access point's BSSID and channel
+ */
+static void saveWifiApCache(const wifi_event_sta_connected_t *event)
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    if(WifiApCacheValid && (WifiApCache.channel == event->channel) && (memcmp(WifiApCache.bssid, event->bssid, sizeof(WifiApCache.bssid)) == 0))
+    {
+        return;
+    }
+
+    memcpy(WifiApCache.bssid, event->bssid, sizeof(WifiApCache.bssid));
+    WifiApCache.channel = event->channel;
+    WifiApCacheValid = true;
+
+    err = nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if(err == ESP_OK)
+    {
+        err = nvs_set_blob(handle, WIFI_NVS_AP_KEY, &WifiApCache, sizeof(WifiApCache));
+        if(err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+
+    if(err != ESP_OK)
+    {
+        LOGE("Failed to Save Wi-Fi Access Point (%s)", esp_err_to_name(err));
+    }
+}
+
+/**
+ * @brief Points the station at the cached access point with a fast scan, or scans all channels
+ * for the strongest access point with the SSID when there is no cache
+ */
+static void setWifiConfig(void)
+{
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASSWORD,
+            .scan_method = WIFI_ALL_CHANNEL_SCAN,
+            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
+            .threshold.rssi = -127,
+            .threshold.authmode = WIFI_AUTH_OPEN,
+        },
+    };
+
+    if(WifiApCacheValid)
+    {
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        wifi_config.sta.channel = WifiApCache.channel;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, WifiApCache.bssid, sizeof(wifi_config.sta.bssid));
+        LOGI("Connecting to %s on Channel %d...", wifi_config.sta.ssid, WifiApCache.channel);
+    }
+    else
+    {
+        LOGI("Connecting to %s...", wifi_config.sta.ssid);
+    }
+
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+}
+
+/**
+ * @brief Counts a connect attempt latency in a histogram
+ *
+ * @param histogram WIFI_LATENCY_BUCKETS counters
+ * @param latencyUs Time from the start of the attempt
+ */
+static void recordLatency(uint32_t *histogram, int64_t latencyUs)
+{
+    uint8_t bucket = 0;
+
+    while((bucket < (WIFI_LATENCY_BUCKETS - 1)) && (latencyUs >= ((int64_t)(WIFI_LATENCY_BUCKET_MS * 1000) << bucket)))
+    {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+/**
+ * @brief Starts an attempt to connect, an error from the driver counts as a failed attempt
+ */
+void startConnectAttempt()
+{
+    int64_t now = esp_timer_get_time();
+    esp_err_t err;
+
+    portENTER_CRITICAL(&WifiLock);
+    WifiAttemptStartUs = now;
+    if(WifiOutageStartUs == 0)
+    {
+        WifiOutageStartUs = now;
+    }
+    WifiStats.connectAttempts++;
+    WifiStats.backoffMs = 0;
+    portEXIT_CRITICAL(&WifiLock);
+
+    err = esp_wifi_connect();
+    if(err == ESP_ERR_WIFI_NOT_STARTED)
+    {
+        return;
+    }
+    if(err != ESP_OK)
+    {
+        LOGE("Wi-Fi Connect Failed (%s)", esp_err_to_name(err));
+        portENTER_CRITICAL(&WifiLock);
+        WifiStats.connectFailures++;
+        portEXIT_CRITICAL(&WifiLock);
+        scheduleReconnect();
+    }
+}
+
+/**
+ * @brief Schedules the next connect attempt after the backoff, jittered over its upper half so
+ * stations that lost the same access point don't retry in step. Doubles the backoff.
+ */
+void scheduleReconnect()
+{
+    uint32_t delayMs;
+
+    portENTER_CRITICAL(&WifiLock);
+    delayMs = (WifiBackoffMs / 2) + (esp_random() % ((WifiBackoffMs / 2) + 1));
+    WifiBackoffMs = ((WifiBackoffMs * 2) < WIFI_BACKOFF_MAX_MS) ? (WifiBackoffMs * 2) : WIFI_BACKOFF_MAX_MS;
+    WifiStats.backoffMs = delayMs;
+    portEXIT_CRITICAL(&WifiLock);
+
+    LOGI("Wi-Fi Reconnecting in %ums", delayMs);
+
+    esp_timer_stop(WifiReconnectTimer);
+    ESP_ERROR_CHECK(esp_timer_start_once(WifiReconnectTimer, (uint64_t)delayMs * 1000));
+}
+
+/**
+ * @brief Starts the next connect attempt once the backoff elapses
+ */
+static void reconnectTimerCallback(void *arg)
+{
+    startConnectAttempt();
+}
+
+/**
+ * @brief Samples the RSSI of the access point connected to
+ */
+static void rssiTimerCallback(void *arg)
+{
+    wifi_ap_record_t apInfo;
+
+    if(esp_wifi_sta_get_ap_info(&apInfo) != ESP_OK)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&WifiLock);
+    if(WifiStats.rssi == 0)
+    {
+        // First sample of this connection
+        WifiRssiAvgSixteenths = apInfo.rssi * 16;
+        WifiStats.rssiMin = (WifiStats.rssiMin == 0) ? apInfo.rssi : MIN(WifiStats.rssiMin, apInfo.rssi);
+        WifiStats.rssiMax = (WifiStats.rssiMax == 0) ? apInfo.rssi : MAX(WifiStats.rssiMax, apInfo.rssi);
+    }
+    else
+    {
+        WifiRssiAvgSixteenths += ((apInfo.rssi * 16) - WifiRssiAvgSixteenths) / WIFI_RSSI_AVG_WEIGHT;
+        WifiStats.rssiMin = MIN(WifiStats.rssiMin, apInfo.rssi);
+        WifiStats.rssiMax = MAX(WifiStats.rssiMax, apInfo.rssi);
+    }
+    WifiStats.rssi = apInfo.rssi;
+    WifiStats.rssiAvg = WifiRssiAvgSixteenths / 16;
+    portEXIT_CRITICAL(&WifiLock);
+}
+
+/**
+ * @brief Records why the station disconnected, or why an attempt failed, and schedules the next
+ * attempt
+ */
+static void on_wifi_disconnect(void *arg, esp_event_base_t event_base,
+                               int32_t event_id, void *event_data)
+{
+    wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+    int64_t now = esp_timer_get_time();
+    bool wasAssociated;
+
+    esp_timer_stop(WifiRssiTimer);
+
+    portENTER_CRITICAL(&WifiLock);
+    wasAssociated = WifiAssociated;
+    WifiAssociated = false;
+    if(wasAssociated)
+    {
+        WifiStats.disconnects++;
+        WifiOutageStartUs = 0;
+    }
+    else
+    {
+        WifiStats.connectFailures++;
+        recordLatency(WifiStats.failedLatency, now - WifiAttemptStartUs);
+    }
+    WifiStats.connected = false;
+    WifiStats.channel = 0;
+    WifiStats.rssi = 0;
+
+    memmove(&WifiStats.recentDisconnects[1], &WifiStats.recentDisconnects[0], sizeof(WifiDisconnect_t) * (WIFI_RECENT_DISCONNECTS - 1));
+    WifiStats.recentDisconnects[0].reason = event->reason;
+    WifiStats.recentDisconnects[0].uptimeSecs = now / 1000000;
+    if(WifiStats.recentDisconnectCount < WIFI_RECENT_DISCONNECTS)
+    {
+        WifiStats.recentDisconnectCount++;
+    }
+    portEXIT_CRITICAL(&WifiLock);
+
+    LOGI("Wi-Fi %s, Reason %d", wasAssociated ? "Disconnected" : "Connect Attempt Failed", event->reason);
+
+    // The cached access point failed before connecting, it may have moved or gone
+    if(WifiApCacheValid && !wasAssociated)
+    {
+        LOGW("Cached Wi-Fi Access Point Not Found, Scanning All Channels");
+        WifiApCacheValid = false;
+        setWifiConfig();
+    }
+
+    scheduleReconnect();
+}
+
+/**
+ * @brief Records the attempt latency and caches the access point connected to, for a fast
+ * connection after the next reboot
+ */
+static void on_wifi_connect(void *esp_netif, esp_event_base_t event_base,
+                            int32_t event_id, void *event_data)
+{
+    wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&WifiLock);
+    WifiAssociated = true;
+    WifiStats.channel = event->channel;
+    recordLatency(WifiStats.connectedLatency, now - WifiAttemptStartUs);
+    portEXIT_CRITICAL(&WifiLock);
+
+    saveWifiApCache(event);
+
+#ifdef CONFIG_EXAMPLE_CONNECT_IPV6
+    // For future IPv6 support
+    esp_netif_create_ip6_linklocal(esp_netif);
+#endif
+}
+
+/**
+ * @brief Logs the IP address, records the time to IP and resets the backoff
+ */
+static void on_got_ip(void *arg, esp_event_base_t event_base,
+                      int32_t event_id, void *event_data)
+{
+    ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+    int64_t now = esp_timer_get_time();
+    uint32_t timeToIpMs = 0;
+
+    portENTER_CRITICAL(&WifiLock);
+    if(WifiOutageStartUs != 0)
+    {
+        timeToIpMs = (now - WifiOutageStartUs) / 1000;
+        WifiStats.lastTimeToIpMs = timeToIpMs;
+        WifiStats.maxTimeToIpMs = MAX(WifiStats.maxTimeToIpMs, timeToIpMs);
+        WifiOutageStartUs = 0;
+    }
+    WifiStats.connected = true;
+    WifiBackoffMs = WIFI_BACKOFF_MIN_MS;
+    portEXIT_CRITICAL(&WifiLock);
+
+    LOGI("Got IPv4 event: Interface \"%s\" address: " IPSTR ", %ums to IP", esp_netif_get_desc(event->esp_netif), IP2STR(&event->ip_info.ip), timeToIpMs);
+
+    rssiTimerCallback(NULL);
+    esp_timer_stop(WifiRssiTimer);
+    ESP_ERROR_CHECK(esp_timer_start_periodic(WifiRssiTimer, WIFI_RSSI_PERIOD_MS * 1000));
+}
+
+#ifdef CONFIG_EXAMPLE_CONNECT_IPV6
+/**
+ * @brief Logs IPv6 Address
+ */
+static void on_got_ipv6(void *arg, esp_event_base_t event_base,
+                        int32_t event_id, void *event_data)
+{
+    ip_event_got_ip6_t *event = (ip_event_got_ip6_t *)event_data;
+
+    LOGI("Got IPv6 event: Interface \"%s\" address: " IPV6STR "", esp_netif_get_desc(event->esp_netif),
+             IPV62STR(event->ip6_info.ip));
+}
+#endif
+
+/**
+ * @brief Starts the Wi-Fi station and the first connect attempt
+ *
+ * @return esp_netif_t* station interface
+ */
+esp_netif_t *wifiManagerStart(void)
+{
+    char *desc;
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+    esp_netif_inherent_config_t esp_netif_config = ESP_NETIF_INHERENT_DEFAULT_WIFI_STA();
+    // Prefix the interface description with the module TAG
+    // Warning: the interface desc is used in tests to capture actual connection details (IP, gw, mask)
+    asprintf(&desc, "%s: %s", "wifi_start", esp_netif_config.if_desc);
+    esp_netif_config.if_desc = desc;
+    esp_netif_config.route_prio = 128;
+    esp_netif_t *netif = esp_netif_create_wifi(WIFI_IF_STA, &esp_netif_config);
+    free(desc);
+    esp_wifi_set_default_wifi_sta_handlers();
+
+    const esp_timer_create_args_t reconnectTimerArgs = {
+        .callback = reconnectTimerCallback,
+        .name = "WifiReconnect"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconnectTimerArgs, &WifiReconnectTimer));
+    const esp_timer_create_args_t rssiTimerArgs = {
+        .callback = rssiTimerCallback,
+        .name = "WifiRssi"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&rssiTimerArgs, &WifiRssiTimer));
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &on_wifi_disconnect, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &on_got_ip, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &on_wifi_connect, netif));
+#ifdef CONFIG_EXAMPLE_CONNECT_IPV6
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_GOT_IP6, &on_got_ipv6, NULL));
+#endif
+
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    WifiApCacheValid = loadWifiApCache();
+    setWifiConfig();
+    ESP_ERROR_CHECK(esp_wifi_start());
+    startConnectAttempt();
+    return netif;
+}
+
+/**
+ * @brief Get a consistent copy of the connection statistics
+ *
+ * @param stats statistics output
+ */
+void getWifiStats(WifiStats_t *stats)
+{
+    portENTER_CRITICAL(&WifiLock);
+    memcpy(stats, &WifiStats, sizeof(WifiStats_t));
+    portEXIT_CRITICAL(&WifiLock);
+}
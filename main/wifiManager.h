@@ -0,0 +1,55 @@
+#pragma once
+/**
+ * @file wifiManager.h
+ *
+ * @brief
+ * Wi-Fi station connection manager. Reconnects with jittered exponential backoff instead of
+ * retrying on every disconnect, and keeps link quality statistics for the web API.
+ */
+
+// ESP IDF Includes
+#include "esp_err.h"
+#include "esp_netif.h"
+
+// Standard Library Includes
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Connect attempt latency histogram, bucket i counts attempts under WIFI_LATENCY_BUCKET_MS << i,
+ * the last bucket counts everything slower */
+#define WIFI_LATENCY_BUCKETS 8
+#define WIFI_LATENCY_BUCKET_MS 250
+
+/* Recent disconnects kept with their reasons */
+#define WIFI_RECENT_DISCONNECTS 8
+
+/* A disconnect or failed connect attempt */
+typedef struct
+{
+    uint8_t reason;                 // wifi_err_reason_t
+    uint32_t uptimeSecs;            // When it happened
+} WifiDisconnect_t;
+
+/* Connection statistics since boot */
+typedef struct
+{
+    bool connected;                 // Associated and holding an IP address
+    uint8_t channel;                // Of the access point connected to, 0 when not connected
+    int8_t rssi;                    // Latest sample, dBm, 0 when not connected
+    int8_t rssiMin;                 // Lowest sample while connected, dBm
+    int8_t rssiMax;                 // Highest sample while connected, dBm
+    int8_t rssiAvg;                 // Moving average of the samples, dBm
+    uint32_t connectAttempts;
+    uint32_t connectFailures;       // Attempts that ended without associating
+    uint32_t disconnects;           // Established connections lost
+    uint32_t backoffMs;             // Delay before the next attempt, 0 when not waiting
+    uint32_t lastTimeToIpMs;        // From the first attempt after boot or a disconnect to an IP
+    uint32_t maxTimeToIpMs;
+    uint32_t connectedLatency[WIFI_LATENCY_BUCKETS];    // Time to associate
+    uint32_t failedLatency[WIFI_LATENCY_BUCKETS];       // Time to give up
+    uint8_t recentDisconnectCount;
+    WifiDisconnect_t recentDisconnects[WIFI_RECENT_DISCONNECTS];    // Newest first
+} WifiStats_t;
+
+esp_netif_t *wifiManagerStart(void);
+void getWifiStats(WifiStats_t *stats);